@@ -0,0 +1,10 @@
+#ifndef HEAPCOUNTER_H
+#define HEAPCOUNTER_H
+#include <cstddef>
+
+// rtree_bench заменяет глобальный operator new, чтобы проверять участки без выделений памяти:
+// рабочие буферы дерева живут не в его memory_resource. Замена — в отдельной единице
+// трансляции, иначе встроенные пары new/free сбивают с толку -Wmismatched-new-delete.
+size_t heapAllocations();
+
+#endif //HEAPCOUNTER_H
@@ -0,0 +1,287 @@
+#ifndef ORACLE_H
+#define ORACLE_H
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "../geometry/Distance.h"
+#include "../geometry/Frustum.h"
+#include "../geometry/Ray.h"
+#include "../geometry/TriangleBox.h"
+#include "../geometry/TriangleIntersection.h"
+#include "../rtree/MBR.h"
+
+// Пересечение треугольников для эталона, независимое от TriangleIntersection.h, чтобы сверка
+// ловила и ошибки самого предиката. Пересечение двух треугольников выпукло, и его вершины лежат
+// на рёбрах одного из них, поэтому оно — выпуклая оболочка частей рёбер каждого треугольника
+// внутри другого. Эти части находятся отсечением ребра плоскостью и тремя полуплоскостями рёбер
+// другого треугольника (Cyrus–Beck).
+namespace oracle_geometry {
+
+struct Vec {
+    double x, y, z;
+};
+
+inline Vec toVec(const Point3D& p) {
+    return { p.x, p.y, p.z };
+}
+
+inline Vec operator+(const Vec& a, const Vec& b) {
+    return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+inline Vec operator-(const Vec& a, const Vec& b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline Vec operator*(const Vec& a, double s) {
+    return { a.x * s, a.y * s, a.z * s };
+}
+
+inline double dot(const Vec& a, const Vec& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec cross(const Vec& a, const Vec& b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline double length(const Vec& a) {
+    return std::sqrt(dot(a, a));
+}
+
+// Расстояние от x до отрезка pq (или точки, если p == q)
+inline double distanceToSegment(const Vec& x, const Vec& p, const Vec& q) {
+    const Vec d = q - p;
+    const double lengthSquared = dot(d, d);
+    const double t = lengthSquared > 0 ? std::clamp(dot(x - p, d) / lengthSquared, 0.0, 1.0) : 0.0;
+    return length(x - (p + d * t));
+}
+
+// Расстояние между отрезками pq и rs: минимум по концам одного до другого или точка пересечения
+// их прямых, если она внутри обоих
+inline double segmentsDistance(const Vec& p, const Vec& q, const Vec& r, const Vec& s) {
+    double best = std::min({ distanceToSegment(p, r, s), distanceToSegment(q, r, s),
+                             distanceToSegment(r, p, q), distanceToSegment(s, p, q) });
+    const Vec u = q - p, v = s - r, w = p - r;
+    const double a = dot(u, u), b = dot(u, v), c = dot(v, v), d = dot(u, w), e = dot(v, w);
+    const double denominator = a * c - b * b;
+    if (denominator > 0) {
+        const double t = (b * e - c * d) / denominator, k = (a * e - b * d) / denominator;
+        if (t >= 0 && t <= 1 && k >= 0 && k <= 1) best = std::min(best, length((p + u * t) - (r + v * k)));
+    }
+    return best;
+}
+
+// Часть [t0, t1] отрезка p + t(q - p), t из [0, 1], внутри замкнутого невырожденного треугольника
+// с нормалью normal; tolerance — допуск расстояний до плоскости и до прямых рёбер
+inline bool clipSegment(const Vec& p, const Vec& q, const Vec* triangle, const Vec& normal, double tolerance,
+                        double& t0, double& t1) {
+    const Vec unit = normal * (1.0 / length(normal));
+    const double dp = dot(unit, p - triangle[0]), dq = dot(unit, q - triangle[0]);
+    const bool pInPlane = std::fabs(dp) <= tolerance, qInPlane = std::fabs(dq) <= tolerance;
+    t0 = 0.0;
+    t1 = 1.0;
+    if (pInPlane && !qInPlane) {
+        t1 = 0.0;
+    } else if (qInPlane && !pInPlane) {
+        t0 = 1.0;
+    } else if (!pInPlane) {
+        if ((dp > 0) == (dq > 0)) return false;
+        t0 = t1 = dp / (dp - dq);
+    }
+
+    // Внутренняя нормаль ребра в плоскости: cross(normal, ребро) при обходе, задавшем normal
+    const Vec d = q - p;
+    for (int k = 0; k < 3; ++k) {
+        const Vec edge = triangle[(k + 1) % 3] - triangle[k];
+        const Vec inward = cross(unit, edge) * (1.0 / length(edge));
+        const double start = dot(inward, p - triangle[k]) + tolerance;
+        const double slope = dot(inward, d);
+        if (slope == 0) {
+            if (start < 0) return false;
+        } else if (slope > 0) {
+            t0 = std::max(t0, -start / slope);
+        } else {
+            t1 = std::min(t1, -start / slope);
+        }
+    }
+    return t0 <= t1;
+}
+
+// Пересекаются ли треугольники помимо общих вершин и рёбер — то же правило, что у
+// meshTrianglesIntersect: общие вершины — углы first с координатами угла second; совпадающие
+// треугольники пересекаются, вырожденные соседи — нет, без общих вершин касание считается.
+inline bool meshIntersect(const Triangle3D& first, const Triangle3D& second) {
+    const Point3D* cornersA[3] = { &first.a, &first.b, &first.c };
+    const Point3D* cornersB[3] = { &second.a, &second.b, &second.c };
+    Vec shared[3];
+    int sharedCount = 0;
+    for (const Point3D* corner : cornersA) {
+        if (std::any_of(std::begin(cornersB), std::end(cornersB), [&](const Point3D* c) { return *c == *corner; })) {
+            shared[sharedCount++] = toVec(*corner);
+        }
+    }
+    if (sharedCount == 3) return true;
+
+    const Vec a[3] = { toVec(first.a), toVec(first.b), toVec(first.c) };
+    const Vec b[3] = { toVec(second.a), toVec(second.b), toVec(second.c) };
+    const Vec na = cross(a[1] - a[0], a[2] - a[0]);
+    const Vec nb = cross(b[1] - b[0], b[2] - b[0]);
+    const bool flatA = dot(na, na) == 0, flatB = dot(nb, nb) == 0;
+    if (sharedCount > 0 && (flatA || flatB)) return false;
+
+    // Допуски относительно размера пары: отсечение — около округления double, общий элемент —
+    // с большим запасом, потому что отсечённый у общей вершины отрезок длиннее допуска отсечения
+    double scale = 0.0;
+    for (const Vec& v : { a[0], a[1], a[2], b[0], b[1], b[2] }) {
+        scale = std::max({ scale, std::fabs(v.x), std::fabs(v.y), std::fabs(v.z) });
+    }
+    const double clipTolerance = 1e-12 * scale;
+    const double sharedTolerance = 1e-6 * scale;
+
+    if (flatA && flatB) {
+        for (int e = 0; e < 3; ++e) {
+            for (int f = 0; f < 3; ++f) {
+                if (segmentsDistance(a[e], a[(e + 1) % 3], b[f], b[(f + 1) % 3]) <= clipTolerance) return true;
+            }
+        }
+        return false;
+    }
+
+    auto offShared = [&](const Vec& x) {
+        if (sharedCount == 0) return true;
+        const Vec& end = sharedCount == 1 ? shared[0] : shared[1];
+        return distanceToSegment(x, shared[0], end) > sharedTolerance;
+    };
+    auto edgesHit = [&](const Vec* edges, const Vec* triangle, const Vec& normal) {
+        for (int e = 0; e < 3; ++e) {
+            const Vec& p = edges[e];
+            const Vec& q = edges[(e + 1) % 3];
+            double t0, t1;
+            if (!clipSegment(p, q, triangle, normal, clipTolerance, t0, t1)) continue;
+            if (offShared(p + (q - p) * t0) || offShared(p + (q - p) * t1)) return true;
+        }
+        return false;
+    };
+    return (!flatB && edgesHit(a, b, nb)) || (!flatA && edgesHit(b, a, na));
+}
+
+} // namespace oracle_geometry
+
+// Эталонные ответы полным перебором: rtree_bench сверяет с ними дерево на каждом прогоне.
+class BruteForceOracle {
+    std::span<const Triangle3D> triangles;
+
+public:
+    explicit BruteForceOracle(std::span<const Triangle3D> triangles) : triangles(triangles) {}
+
+    std::vector<Triangle3D> find(const MBR& range) const {
+        std::vector<Triangle3D> result;
+        for (const auto& t : triangles) {
+            if (MBR(t).intersects(range)) result.push_back(t);
+        }
+        return result;
+    }
+
+    // Треугольники, чьи MBR не отсекает ни одна плоскость пирамиды
+    std::vector<Triangle3D> cull(const Frustum& frustum) const {
+        std::vector<Triangle3D> result;
+        for (const auto& t : triangles) {
+            const MBR box(t);
+            if (classifyBox(frustum, box.min, box.max) != Containment::Outside) result.push_back(t);
+        }
+        return result;
+    }
+
+    std::vector<Triangle3D> findExact(const MBR& range) const {
+        std::vector<Triangle3D> result;
+        for (const auto& t : triangles) {
+            if (triangleIntersectsBox(t, range.min, range.max)) result.push_back(t);
+        }
+        return result;
+    }
+
+    // Сколько треугольников пересекает triangle (включая его самого и его копии)
+    size_t countIntersecting(const Triangle3D& triangle) const {
+        return std::count_if(triangles.begin(), triangles.end(), [&](const Triangle3D& t) {
+            return trianglesIntersect(triangle, t);
+        });
+    }
+
+    // Сколько треугольников пересекает triangle помимо общих вершин и рёбер (включая его копии).
+    // Предикат свой (oracle_geometry), а не meshTrianglesIntersect, которым пользуется selfIntersections
+    size_t countMeshIntersecting(const Triangle3D& triangle) const {
+        return std::count_if(triangles.begin(), triangles.end(), [&](const Triangle3D& t) {
+            return oracle_geometry::meshIntersect(triangle, t);
+        });
+    }
+
+    // Число пар i < j, пересекающихся помимо общих вершин и рёбер: заметание по x перебирает
+    // все пары с пересекающимися MBR, без дерева
+    size_t countMeshIntersectingPairs() const {
+        std::vector<std::pair<MBR, size_t>> boxes;
+        for (size_t i = 0; i < triangles.size(); ++i) boxes.push_back({ MBR(triangles[i]), i });
+        std::sort(boxes.begin(), boxes.end(), [](const auto& a, const auto& b) {
+            return a.first.min.x < b.first.min.x;
+        });
+        size_t count = 0;
+        for (size_t i = 0; i < boxes.size(); ++i) {
+            for (size_t j = i + 1; j < boxes.size() && boxes[j].first.min.x <= boxes[i].first.max.x; ++j) {
+                if (!boxes[i].first.intersects(boxes[j].first)) continue;
+                count += oracle_geometry::meshIntersect(triangles[boxes[i].second], triangles[boxes[j].second]);
+            }
+        }
+        return count;
+    }
+
+    size_t countCopies(const Triangle3D& triangle) const {
+        return std::count_if(triangles.begin(), triangles.end(), [&](const Triangle3D& t) {
+            return std::memcmp(&t, &triangle, sizeof(Triangle3D)) == 0;
+        });
+    }
+
+    // Расстояния до k ближайших треугольников по возрастанию
+    std::vector<float> nearest(const Point3D& point, size_t k) const {
+        std::vector<float> distances;
+        distances.reserve(triangles.size());
+        for (const auto& t : triangles) {
+            distances.push_back(std::sqrt(squaredDistance(point, t)));
+        }
+        k = std::min(k, distances.size());
+        std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+        distances.resize(k);
+        return distances;
+    }
+
+    std::optional<float> raycast(const Ray& ray) const {
+        RayTriangleHit hit;
+        hit.t = ray.tMax;
+        if (!intersectRayTriangles(ray, triangles.data(), triangles.size(), hit)) return std::nullopt;
+        return hit.t;
+    }
+
+    // Совпадение наборов треугольников без учёта порядка (копии в дереве побитово равны исходным)
+    static bool sameTriangles(std::vector<Triangle3D> a, std::vector<Triangle3D> b) {
+        if (a.size() != b.size()) return false;
+        auto less = [](const Triangle3D& x, const Triangle3D& y) {
+            return std::memcmp(&x, &y, sizeof(Triangle3D)) < 0;
+        };
+        std::sort(a.begin(), a.end(), less);
+        std::sort(b.begin(), b.end(), less);
+        return std::equal(a.begin(), a.end(), b.begin(), [](const Triangle3D& x, const Triangle3D& y) {
+            return std::memcmp(&x, &y, sizeof(Triangle3D)) == 0;
+        });
+    }
+
+    // Расстояния и t считаются разными ветками кода, поэтому сравниваются с допуском
+    static bool close(float a, float b) {
+        return std::fabs(a - b) <= 1e-4f * std::max({ 1.0f, std::fabs(a), std::fabs(b) });
+    }
+};
+
+#endif //ORACLE_H
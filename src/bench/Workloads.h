@@ -0,0 +1,272 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../geometry/Frustum.h"
+#include "../geometry/Ray.h"
+#include "../geometry/Triangle3D.h"
+#include "../rtree/MBR.h"
+
+// Синтетические наборы треугольников для rtree_bench. Плотность не зависит от числа
+// треугольников: сцена растёт вместе с ним, средний треугольник имеет размер ~1.
+enum class Distribution {
+    Uniform,     // центры равномерно в кубе
+    Clustered,   // нормальные облака вокруг случайных центров
+    Flat,        // как Uniform, но все вершины в плоскости z = 0
+    Sliver,      // длинные тонкие треугольники произвольной ориентации
+    Terrain      // связная сетка-рельеф с общими вершинами и редкими пронизывающими её треугольниками
+};
+
+inline const char* distributionName(Distribution distribution) {
+    switch (distribution) {
+        case Distribution::Uniform: return "uniform";
+        case Distribution::Clustered: return "clustered";
+        case Distribution::Flat: return "flat";
+        case Distribution::Sliver: return "sliver";
+        case Distribution::Terrain: return "terrain";
+    }
+    return "";
+}
+
+inline bool parseDistribution(const std::string& name, Distribution& distribution) {
+    for (Distribution d : { Distribution::Uniform, Distribution::Clustered, Distribution::Flat, Distribution::Sliver,
+                            Distribution::Terrain }) {
+        if (name == distributionName(d)) {
+            distribution = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Рельеф на квадратной сетке с шагом 1, по два треугольника на клетку; соседние треугольники
+// ссылаются на одни и те же вершины. Примерно каждый 20000-й треугольник заменён вертикальным,
+// пронизывающим поверхность, — это и есть самопересечения, которые должна найти проверка сетки.
+inline std::vector<Triangle3D> generateTerrain(size_t count, std::uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<float> noise(0.0f, 0.3f);
+
+    const size_t cells = std::max<size_t>(1, size_t(std::ceil(std::sqrt(count / 2.0))));
+    const size_t side = cells + 1;
+    std::vector<Point3D> vertices(side * side);
+    for (size_t i = 0; i < side; ++i) {
+        for (size_t j = 0; j < side; ++j) {
+            const float height = 3.0f * std::sin(float(i) * 0.05f) * std::cos(float(j) * 0.07f) + noise(rng);
+            vertices[i * side + j] = { float(i), float(j), height };
+        }
+    }
+
+    std::vector<Triangle3D> triangles;
+    triangles.reserve(count);
+    for (size_t i = 0; i < cells && triangles.size() < count; ++i) {
+        for (size_t j = 0; j < cells && triangles.size() < count; ++j) {
+            const Point3D& p00 = vertices[i * side + j];
+            const Point3D& p10 = vertices[(i + 1) * side + j];
+            const Point3D& p01 = vertices[i * side + j + 1];
+            const Point3D& p11 = vertices[(i + 1) * side + j + 1];
+            triangles.push_back({ p00, p10, p11 });
+            if (triangles.size() < count) triangles.push_back({ p00, p11, p01 });
+        }
+    }
+
+    if (triangles.empty()) return triangles;
+    std::uniform_int_distribution<size_t> pick(0, triangles.size() - 1);
+    for (size_t k = 0; k < std::max<size_t>(1, count / 20000); ++k) {
+        Triangle3D& t = triangles[pick(rng)];
+        // Смещён от дыры на месте заменённого треугольника, чтобы пронизывать соседние клетки
+        const Point3D center = (t.a + t.b + t.c) * (1.0f / 3.0f) + Point3D{ 2.3f, 2.7f, 0.0f };
+        t = { { center.x, center.y, center.z - 2.0f },
+              { center.x + 0.5f, center.y + 0.3f, center.z + 2.0f },
+              { center.x - 0.4f, center.y + 0.6f, center.z + 2.0f } };
+    }
+    return triangles;
+}
+
+inline std::vector<Triangle3D> generateTriangles(Distribution distribution, size_t count, std::uint64_t seed) {
+    if (distribution == Distribution::Terrain) return generateTerrain(count, seed);
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+
+    const bool flat = distribution == Distribution::Flat;
+    const float side = flat ? 2.0f * std::sqrt(float(count)) : 2.0f * std::cbrt(float(count));
+
+    auto uniformPoint = [&] {
+        return Point3D{ unit(rng) * side, unit(rng) * side, flat ? 0.0f : unit(rng) * side };
+    };
+
+    // Около тысячи треугольников на облако
+    std::vector<Point3D> clusters;
+    std::normal_distribution<float> spread(0.0f, side / 64.0f);
+    if (distribution == Distribution::Clustered) {
+        clusters.resize(std::max<size_t>(1, count / 1000));
+        for (auto& c : clusters) c = uniformPoint();
+    }
+    std::uniform_int_distribution<size_t> pickCluster(0, clusters.empty() ? 0 : clusters.size() - 1);
+
+    std::vector<Triangle3D> triangles;
+    triangles.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        Point3D center;
+        if (distribution == Distribution::Clustered) {
+            const Point3D& c = clusters[pickCluster(rng)];
+            center = { c.x + spread(rng), c.y + spread(rng), c.z + spread(rng) };
+        } else {
+            center = uniformPoint();
+        }
+
+        auto corner = [&](float scale) {
+            return Point3D{ center.x + offset(rng) * scale, center.y + offset(rng) * scale,
+                            flat ? 0.0f : center.z + offset(rng) * scale };
+        };
+
+        if (distribution == Distribution::Sliver) {
+            // Длина ~ 1/20 сцены, ширина ~ 0.001
+            Point3D axis{ offset(rng), offset(rng), offset(rng) };
+            const float length = std::sqrt(dot(axis, axis));
+            axis = axis * (length > 0.0f ? side / 40.0f / length : 0.0f);
+            const Point3D a = center - axis;
+            const Point3D b = center + axis;
+            const Point3D c{ a.x + offset(rng) * 0.001f, a.y + offset(rng) * 0.001f, a.z + offset(rng) * 0.001f };
+            triangles.push_back({ a, b, c });
+        } else {
+            triangles.push_back({ corner(1.0f), corner(1.0f), corner(1.0f) });
+        }
+    }
+    return triangles;
+}
+
+// Пары треугольников на границе предиката самопересечений: общее ребро и общая вершина в одной
+// плоскости и в разных, пронизывание через общую вершину, вложенные компланарные треугольники,
+// касания и вырожденные треугольники. Пара k сдвинута на 5k по x от origin, так что пары
+// не задевают друг друга. Случайные наборы дают такие конфигурации редко
+inline std::vector<Triangle3D> predicateCases(const Point3D& origin) {
+    const Triangle3D unit{ { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 } };
+    const Triangle3D big{ { 0, 0, 0 }, { 2, 0, 0 }, { 0, 2, 0 } };
+    const Triangle3D piercing{ { 0, 0, 0 }, { 0.5f, 0.5f, 1 }, { 0.5f, 0.5f, -1 } };
+    const Triangle3D flatSegment{ { 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 } };
+    // Зеркальные копии меняют порядок пары в листе, а с ним и порядок аргументов предиката
+    auto mirror = [](const Triangle3D& t, float sx, float sy) {
+        auto flip = [&](const Point3D& p) { return Point3D{ p.x * sx, p.y * sy, p.z }; };
+        return Triangle3D{ flip(t.a), flip(t.b), flip(t.c) };
+    };
+    const Triangle3D pairs[][2] = {
+        // Общее ребро: по разные стороны, внахлёст, излом
+        { unit, { { 0, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 } } },
+        { unit, { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 } } },
+        { unit, { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 } } },
+        // Общая вершина: врозь, внахлёст, пронизывание (и зеркально), касание ребра
+        { unit, { { 0, 0, 0 }, { -1, 0, 0 }, { 0, -1, 0 } } },
+        { big, { { 0, 0, 0 }, { 1, 0.1f, 0 }, { 0.1f, 1, 0 } } },
+        { big, piercing },
+        { mirror(big, -1, 1), mirror(piercing, -1, 1) },
+        { mirror(big, 1, -1), mirror(piercing, 1, -1) },
+        { big, { { 0, 0, 0 }, { 1, 1, 1 }, { 1, 1, -1 } } },
+        // Без общих вершин: вложенный компланарный, совпадающий, касание, промах
+        { big, { { 0.5f, 0.5f, 0 }, { 1, 0.5f, 0 }, { 0.5f, 1, 0 } } },
+        { unit, { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 0 } } },
+        { unit, { { 0.5f, 0.5f, -1 }, { 0.5f, 0.5f, 1 }, { 2, 2, 0 } } },
+        { unit, { { 0.6f, 0.6f, -1 }, { 0.6f, 0.6f, 1 }, { 2, 2, 0 } } },
+        // Вырожденные: отрезки крест-накрест, отрезок сквозь треугольник, сосед-отрезок
+        { flatSegment, { { 0.5f, -1, 0 }, { 0.5f, 1, 0 }, { 0.5f, 2, 0 } } },
+        { { { 0.2f, 0.2f, -1 }, { 0.2f, 0.2f, 1 }, { 0.2f, 0.2f, 0 } }, unit },
+        { flatSegment, { { 0, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } } },
+    };
+
+    std::vector<Triangle3D> triangles;
+    for (size_t k = 0; k < std::size(pairs); ++k) {
+        const Point3D shift = origin + Point3D{ 5.0f * float(k), 0, 0 };
+        for (const Triangle3D& t : pairs[k]) {
+            triangles.push_back({ t.a + shift, t.b + shift, t.c + shift });
+        }
+    }
+    return triangles;
+}
+
+// Запросы строятся по самим данным, поэтому подходят и для загруженных сеток:
+// центры берутся у случайных треугольников.
+struct Workload {
+    std::vector<MBR> ranges;
+    std::vector<Point3D> points;
+    std::vector<Ray> rays;
+    std::vector<Frustum> frustums;
+    std::vector<MBR> frustumBoxes;   // MBR вершин пирамиды
+};
+
+// Размер прямоугольников подобран так, чтобы в среднем попадало ~expectedHits треугольников
+inline Workload generateQueries(const std::vector<Triangle3D>& triangles, size_t count, size_t expectedHits,
+                                std::uint64_t seed) {
+    Workload workload;
+    if (triangles.empty()) return workload;
+
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<size_t> pick(0, triangles.size() - 1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    const MBR bounds(triangles);
+    const float extent[3] = { bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z };
+    const int dims = int(extent[0] > 0.0f) + int(extent[1] > 0.0f) + int(extent[2] > 0.0f);
+    const float fraction = dims == 0 ? 1.0f
+        : std::pow(std::min(1.0f, float(expectedHits) / float(triangles.size())), 1.0f / float(dims));
+    const Point3D half{ extent[0] * fraction / 2, extent[1] * fraction / 2, extent[2] * fraction / 2 };
+
+    auto randomCenter = [&] {
+        return MBR(triangles[pick(rng)]).center();
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+        const Point3D c = randomCenter();
+        MBR range;
+        range.min = c - half;
+        range.max = c + half;
+        workload.ranges.push_back(range);
+
+        workload.points.push_back(randomCenter() + Point3D{ half.x * (unit(rng) - 0.5f), half.y * (unit(rng) - 0.5f),
+                                                             half.z * (unit(rng) - 0.5f) });
+
+        // Лучи из случайной точки сцены в центр случайного треугольника; у плоской сцены — сверху
+        const Point3D origin{ bounds.min.x + extent[0] * unit(rng), bounds.min.y + extent[1] * unit(rng),
+                              extent[2] > 0.0f ? bounds.min.z + extent[2] * unit(rng) : bounds.max.z + 1.0f };
+        workload.rays.push_back({ origin, randomCenter() - origin });
+    }
+
+    // Камеры смотрят на центр случайного треугольника с расстояния в четыре полудиагонали
+    // прямоугольника запроса, дальняя плоскость — за ним. Свой генератор, чтобы остальные запросы
+    // не зависели от пирамид.
+    std::mt19937_64 cameraRng(seed ^ 0x9e3779b97f4a7c15ull);
+    std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+    const float depth = std::max(4.0f * std::sqrt(dot(half, half)), 1.0f);
+    for (size_t i = 0; i < count; ++i) {
+        const Point3D target = MBR(triangles[pick(cameraRng)]).center();
+        Point3D view{ signedUnit(cameraRng), signedUnit(cameraRng), extent[2] > 0.0f ? signedUnit(cameraRng) : -1.0f };
+        const float length = std::sqrt(dot(view, view));
+        view = length > 0.0f ? view * (1.0f / length) : Point3D{ 0.0f, 0.0f, -1.0f };
+        const Point3D up = std::abs(view.z) > 0.9f ? Point3D{ 0.0f, 1.0f, 0.0f } : Point3D{ 0.0f, 0.0f, 1.0f };
+
+        const float fovY = 0.5f, aspect = 16.0f / 9.0f, near = depth * 0.05f, far = depth * 1.5f;
+        const Point3D eye = target - view * depth;
+        workload.frustums.push_back(perspectiveFrustum(eye, target, up, fovY, aspect, near, far));
+
+        Point3D right = cross(view, up);
+        right = right * (1.0f / std::sqrt(dot(right, right)));
+        const Point3D top = cross(right, view);
+        MBR box;
+        for (float distance : { near, far }) {
+            const float h = distance * std::tan(fovY / 2), w = h * aspect;
+            for (float sx : { -1.0f, 1.0f }) {
+                for (float sy : { -1.0f, 1.0f }) {
+                    box.expandToInclude(eye + view * distance + right * (sx * w) + top * (sy * h));
+                }
+            }
+        }
+        workload.frustumBoxes.push_back(box);
+    }
+    return workload;
+}
+
+#endif //WORKLOADS_H
@@ -0,0 +1,833 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HeapCounter.h"
+#include "Oracle.h"
+#include "Workloads.h"
+#include "../geometry/MeshLoader.h"
+#include "../rtree/RTree3D.h"
+#include "../rtree/MappedRTree.h"
+#include "../rtree/RTree.h"
+#include "../rtree/RTreeFileBuilder.h"
+#include "../rtree/RTreeJoin.h"
+
+// rtree_bench: построение, вставка, удаление, поиск по диапазону, kNN, лучи, отсечение пирамидой, соединение и поиск
+// самопересечений, анимация, снимки, выделения памяти при удалении и вставке, упорядоченные вставки R*, обобщённое RTree, упакованные файлы во всех кодировках и внешнее построение файла на синтетических наборах и загруженных сетках. Результаты пишутся в JSON,
+// каждый прогон сверяется с перебором.
+// Код возврата 1, если дерево разошлось с перебором.
+
+namespace {
+
+struct Options {
+    std::vector<size_t> sizes{ 1000, 10000, 100000, 1000000 };
+    std::vector<size_t> fanouts{ 8, 16, 32 };
+    std::vector<Distribution> distributions{ Distribution::Uniform, Distribution::Clustered, Distribution::Flat,
+                                             Distribution::Sliver, Distribution::Terrain };
+    std::vector<std::string> meshes;
+    InsertPolicy policy = InsertPolicy::RStar;
+    size_t queries = 1000;
+    size_t oracleQueries = 32;
+    size_t updates = 10000;
+    size_t ticks = 3;
+    size_t neighbors = 8;
+    std::uint64_t seed = 1;
+    std::string output = "rtree_bench.json";
+};
+
+struct Result {
+    std::string workload;
+    size_t size = 0;
+    size_t fanout = 0;
+    double buildMs = 0;
+    size_t updates = 0;
+    double removeMs = 0;
+    double insertMs = 0;
+    double removeHandleMs = 0;
+    size_t queries = 0;
+    double rangeMs = 0;
+    double rangeBatchMs = 0;
+    double rangeExactMs = 0;
+    size_t rangeHits = 0;
+    double knnMs = 0;
+    double rayMs = 0;
+    size_t rayHits = 0;
+    double frustumMs = 0;
+    double frustumBatchMs = 0;
+    size_t frustumHits = 0;
+    double frustumBoxMs = 0;
+    size_t frustumBoxHits = 0;
+    double joinMs = 0;
+    size_t joinPairs = 0;
+    double selfMs = 0;
+    size_t selfPairs = 0;
+    size_t ticks = 0;
+    size_t moved = 0;
+    size_t escaped = 0;
+    double animateMs = 0;
+    double animatePlainMs = 0;
+    double animateRangeMs = 0;
+    double animatePlainRangeMs = 0;
+    double snapshotUpdateMs = 0;
+    double plainUpdateMs = 0;
+    double snapshotRangeMs = 0;
+    size_t snapshotRetained = 0;
+    double streamBuildMs = 0;
+    size_t streamRuns = 0;
+    size_t streamPasses = 0;
+    size_t streamPeakBytes = 0;
+    size_t packedBytes[3] = {};
+    size_t churnAllocations = 0;
+    size_t sortedHeight = 0;
+    size_t checked = 0;
+    size_t failures = 0;
+    TreeStats tree;
+    QueryStats rangeStats;
+    QueryStats rayStats;
+};
+
+template <typename F>
+double timeMs(F&& f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Списки через запятую; размеры можно задавать как 1e6
+template <typename T, typename Parse>
+bool parseList(const std::string& text, std::vector<T>& values, Parse parse) {
+    values.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        T value;
+        if (!parse(item, value)) return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+bool parseCount(const std::string& text, size_t& value) {
+    char* end = nullptr;
+    const double number = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || *end != '\0' || number < 0) return false;
+    value = size_t(number);
+    return true;
+}
+
+void printUsage() {
+    std::cerr << "usage: rtree_bench [options]\n"
+                 "  --sizes 1e3,1e4,...        triangle counts of synthetic sets (default 1e3,1e4,1e5,1e6)\n"
+                 "  --fanouts 8,16,32          maximum node fanouts (minimum is 40% of it, rounded up)\n"
+                 "  --workloads uniform,clustered,flat,sliver,terrain\n"
+                 "  --mesh file.obj|file.stl   benchmark a mesh as well (repeatable)\n"
+                 "  --policy rstar|quadratic   insert policy (default rstar)\n"
+                 "  --queries N                queries of each kind per run (default 1000)\n"
+                 "  --oracle N                 queries of each kind checked by brute force (default 32)\n"
+                 "  --updates N                triangles removed and reinserted per run (default 10000)\n"
+                 "  --ticks N                  animation ticks moving 20% of triangles each (default 3)\n"
+                 "  --seed N\n"
+                 "  --out file.json            results (default rtree_bench.json)\n"
+                 "A 1e8 run needs roughly 8 GB: the triangles plus their copies in the tree.\n";
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string key = argv[i];
+        if (i + 1 >= argc) return false;
+        const std::string value = argv[++i];
+
+        bool ok = true;
+        if (key == "--sizes") {
+            ok = parseList(value, options.sizes, parseCount);
+        } else if (key == "--fanouts") {
+            ok = parseList(value, options.fanouts, parseCount);
+            for (size_t fanout : options.fanouts) ok = ok && fanout >= 2;
+        } else if (key == "--workloads") {
+            ok = parseList(value, options.distributions, parseDistribution);
+        } else if (key == "--mesh") {
+            options.meshes.push_back(value);
+        } else if (key == "--policy") {
+            ok = value == "rstar" || value == "quadratic";
+            options.policy = value == "quadratic" ? InsertPolicy::Quadratic : InsertPolicy::RStar;
+        } else if (key == "--queries") {
+            ok = parseCount(value, options.queries);
+        } else if (key == "--oracle") {
+            ok = parseCount(value, options.oracleQueries);
+        } else if (key == "--updates") {
+            ok = parseCount(value, options.updates);
+        } else if (key == "--ticks") {
+            ok = parseCount(value, options.ticks);
+        } else if (key == "--seed") {
+            size_t seed;
+            ok = parseCount(value, seed);
+            options.seed = seed;
+        } else if (key == "--out") {
+            options.output = value;
+        } else {
+            ok = false;
+        }
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Анимация: за такт 20% треугольников сдвигаются на свою скорость (до 0.05 по оси при размере
+// треугольника ~1). Дерево с запасом обновляется через updateBatch и refine, обычное —
+// через update каждого треугольника, то есть удалением и вставкой
+template <typename Check>
+void animate(Result& result, std::vector<Triangle3D> triangles, size_t fanout, const Options& options,
+             const Workload& workload, Check& check) {
+    // Запас вдвое больше наибольшего сдвига за такт
+    constexpr float margin = 0.1f;
+    constexpr size_t strides = 5;
+
+    RTree3D dynamic((fanout * 2 + 4) / 5, fanout, options.policy);
+    dynamic.setUpdateMargin(margin);
+    dynamic.buildTree(triangles);
+    RTree3D plain((fanout * 2 + 4) / 5, fanout, options.policy);
+    plain.buildTree(triangles);
+
+    std::mt19937_64 rng(options.seed + 2);
+    std::uniform_real_distribution<float> speed(-0.05f, 0.05f);
+    std::vector<Point3D> velocities(triangles.size());
+    for (auto& v : velocities) v = { speed(rng), speed(rng), speed(rng) };
+
+    // За такт обходится примерно восьмая часть узлов над листьями
+    const size_t refineBudget = std::max<size_t>(1, triangles.size() / (fanout * fanout) / 8);
+    std::vector<EntryHandle> handles;
+    std::vector<Triangle3D> moved;
+    result.ticks = options.ticks;
+    for (size_t tick = 0; tick < options.ticks; ++tick) {
+        handles.clear();
+        moved.clear();
+        for (size_t i = tick % strides; i < triangles.size(); i += strides) {
+            Triangle3D& t = triangles[i];
+            const Point3D& v = velocities[i];
+            t = { t.a + v, t.b + v, t.c + v };
+            handles.push_back(EntryHandle{ static_cast<std::uint32_t>(i) });
+            moved.push_back(t);
+        }
+        result.moved += moved.size();
+
+        result.animateMs += timeMs([&] {
+            result.escaped += dynamic.updateBatch(handles, moved);
+            dynamic.refine(refineBudget);
+        });
+        result.animatePlainMs += timeMs([&] {
+            for (size_t i = 0; i < handles.size(); ++i) plain.update(handles[i], moved[i]);
+        });
+    }
+
+    // С запасом MBR записей шире треугольников, поэтому качество сравнивается точными запросами
+    result.animateRangeMs = timeMs([&] {
+        for (const auto& range : workload.ranges) dynamic.find(range, QueryMode::Exact);
+    });
+    result.animatePlainRangeMs = timeMs([&] {
+        for (const auto& range : workload.ranges) plain.find(range, QueryMode::Exact);
+    });
+
+    const BruteForceOracle oracle(triangles);
+    for (size_t i = 0; i < std::min(options.oracleQueries, workload.ranges.size()); ++i) {
+        const auto expected = oracle.findExact(workload.ranges[i]);
+        check(BruteForceOracle::sameTriangles(dynamic.find(workload.ranges[i], QueryMode::Exact), expected));
+        check(BruteForceOracle::sameTriangles(plain.find(workload.ranges[i], QueryMode::Exact), expected));
+    }
+}
+
+// Снимок: updates треугольников сдвигаются через update, пока снимок жив, и так же в дереве
+// без снимка. Снимок должен по-прежнему отвечать как исходный набор
+template <typename Check>
+void snapshots(Result& result, const std::vector<Triangle3D>& triangles, size_t fanout, const Options& options,
+               const Workload& workload, Check& check) {
+    RTree3D tree((fanout * 2 + 4) / 5, fanout, options.policy);
+    tree.buildTree(triangles);
+    RTree3D plain((fanout * 2 + 4) / 5, fanout, options.policy);
+    plain.buildTree(triangles);
+
+    std::mt19937_64 rng(options.seed + 3);
+    std::uniform_real_distribution<float> shift(-0.5f, 0.5f);
+    std::vector<std::pair<EntryHandle, Triangle3D>> moves(std::min(options.updates, triangles.size()));
+    for (auto& [handle, t] : moves) {
+        handle = EntryHandle{ static_cast<std::uint32_t>(rng() % triangles.size()) };
+        const Point3D v{ shift(rng), shift(rng), shift(rng) };
+        const Triangle3D& from = triangles[handle.index];
+        t = { from.a + v, from.b + v, from.c + v };
+    }
+
+    const auto snapshot = tree.snapshot();
+    result.snapshotUpdateMs = timeMs([&] {
+        for (const auto& [handle, t] : moves) tree.update(handle, t);
+    });
+    result.plainUpdateMs = timeMs([&] {
+        for (const auto& [handle, t] : moves) plain.update(handle, t);
+    });
+    result.snapshotRetained = tree.stats().retainedNodes;
+    result.snapshotRangeMs = timeMs([&] {
+        for (const auto& range : workload.ranges) snapshot.find(range);
+    });
+
+    const BruteForceOracle oracle(triangles);
+    for (size_t i = 0; i < std::min(options.oracleQueries, workload.ranges.size()); ++i) {
+        check(BruteForceOracle::sameTriangles(snapshot.find(workload.ranges[i]), oracle.find(workload.ranges[i])));
+    }
+}
+
+// Считает обращения дерева к своему resource поверх new_delete_resource
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocations = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// После reserve удаление по дескрипторам, вставка тех же треугольников и updateBatch, оставляющий
+// их на месте, не выделяют память ни в resource дерева (страницы пула), ни через operator new
+// (рабочие буферы) — для обоих правил.
+// Раундов несколько: упакованное дерево при вставках теряет заполнение и растёт в узлах
+template <typename Check>
+void churnAllocations(Result& result, const std::vector<Triangle3D>& triangles, size_t fanout,
+                      const Options& options, Check& check) {
+    constexpr size_t rounds = 4;
+    const size_t churn = std::min(options.updates, triangles.size());
+    for (const InsertPolicy policy : { InsertPolicy::Quadratic, InsertPolicy::RStar }) {
+        CountingResource resource;
+        RTree3D tree((fanout * 2 + 4) / 5, fanout, policy, Concurrency::None, &resource);
+        tree.buildTree(triangles);
+        tree.reserve(triangles.size());
+        std::vector<EntryHandle> handles(churn);
+        for (size_t i = 0; i < churn; ++i) handles[i] = EntryHandle{ static_cast<std::uint32_t>(i) };
+
+        const size_t pool = resource.allocations;
+        const size_t heap = heapAllocations();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < churn; ++i) {
+                tree.remove(handles[i]);
+                handles[i] = tree.insert(triangles[i]);
+            }
+            // Треугольники на прежних местах остаются в своих листьях — updateBatch без перевставки
+            check(tree.updateBatch(handles, std::span(triangles).first(churn)) == 0);
+        }
+        const size_t allocations = resource.allocations - pool + heapAllocations() - heap;
+        result.churnAllocations += allocations;
+        check(allocations == 0);
+    }
+}
+
+// Обобщённое RTree строится вставками, теряет каждую третью запись и строится заново упаковкой;
+// после каждого шага поиск сверяется с перебором. remove записи, которой уже нет, вернёт false
+template <typename Payload, size_t Dim, typename Scalar, typename Check>
+void checkGenericTree(std::span<const Payload> payloads, std::span<const Box<Dim, Scalar>> ranges, Check& check) {
+    auto less = [](const Payload& a, const Payload& b) {
+        return std::memcmp(&a, &b, sizeof(Payload)) < 0;
+    };
+    auto equal = [](const Payload& a, const Payload& b) {
+        return std::memcmp(&a, &b, sizeof(Payload)) == 0;
+    };
+    auto matches = [&](const RTree<Payload, Dim, Scalar>& tree, const std::vector<Payload>& present) {
+        if (tree.size() != present.size()) return false;
+        for (const auto& range : ranges) {
+            std::vector<Payload> expected;
+            for (const Payload& p : present) {
+                if (BoxOf<Payload, Dim, Scalar>::get(p).intersects(range)) expected.push_back(p);
+            }
+            auto found = tree.find(range);
+            std::sort(found.begin(), found.end(), less);
+            std::sort(expected.begin(), expected.end(), less);
+            if (!std::equal(found.begin(), found.end(), expected.begin(), expected.end(), equal)) return false;
+        }
+        return true;
+    };
+
+    RTree<Payload, Dim, Scalar> tree;
+    for (const Payload& p : payloads) tree.insert(p);
+    std::vector<Payload> present(payloads.begin(), payloads.end());
+    check(matches(tree, present));
+
+    bool removed = true;
+    present.clear();
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        if (i % 3 == 0) {
+            removed = tree.remove(payloads[i]) && removed;
+        } else {
+            present.push_back(payloads[i]);
+        }
+    }
+    if (!payloads.empty()) {
+        const bool copyLeft = std::any_of(present.begin(), present.end(), [&](const Payload& p) {
+            return equal(p, payloads[0]);
+        });
+        removed = tree.remove(payloads[0]) == copyLeft && removed;
+        if (copyLeft) present.erase(std::find_if(present.begin(), present.end(), [&](const Payload& p) {
+            return equal(p, payloads[0]);
+        }));
+    }
+    check(removed && matches(tree, present));
+
+    tree.buildTree(payloads);
+    check(matches(tree, std::vector<Payload>(payloads.begin(), payloads.end())));
+}
+
+// Треугольники, их MBR как Box<3, float> и центры MBR в плоскости xy как Point<2, double>
+template <typename Check>
+void genericTrees(std::span<const Triangle3D> triangles, const Options& options, const Workload& workload,
+                  Check& check) {
+    const size_t count = std::min(options.oracleQueries, workload.ranges.size());
+    std::vector<Box<3, float>> ranges3;
+    std::vector<Box<2, double>> ranges2;
+    for (size_t i = 0; i < count; ++i) {
+        const MBR& r = workload.ranges[i];
+        ranges3.push_back({ { r.min.x, r.min.y, r.min.z }, { r.max.x, r.max.y, r.max.z } });
+        ranges2.push_back({ { r.min.x, r.min.y }, { r.max.x, r.max.y } });
+    }
+
+    std::vector<Box<3, float>> boxes;
+    std::vector<Point<2, double>> points;
+    for (const auto& t : triangles) {
+        const MBR box(t);
+        boxes.push_back({ { box.min.x, box.min.y, box.min.z }, { box.max.x, box.max.y, box.max.z } });
+        const Point3D c = box.center();
+        points.push_back({ c.x, c.y });
+    }
+
+    checkGenericTree<Triangle3D, 3, float>(triangles, ranges3, check);
+    checkGenericTree<Box<3, float>, 3, float>(boxes, ranges3, check);
+    checkGenericTree<Point<2, double>, 2, double>(points, ranges2, check);
+}
+
+// Самопересечения сверяются целиком: число пар selfIntersections — с перебором всех пар по
+// эталонному предикату, каждая найденная пара — с ним же. К набору за его пределами добавляются
+// пары predicateCases. Перебор пар в худшем случае квадратичен, поэтому большие наборы
+// заменяются одними predicateCases
+template <typename Check>
+void selfIntersectionPairs(std::span<const Triangle3D> triangles, size_t fanout, Check& check) {
+    constexpr size_t maxTriangles = 50000;
+    std::vector<Triangle3D> all;
+    Point3D origin{ 0, 0, 0 };
+    if (!triangles.empty() && triangles.size() <= maxTriangles) {
+        all.assign(triangles.begin(), triangles.end());
+        origin = MBR(all).max + Point3D{ 5, 5, 5 };
+    }
+    const auto cases = predicateCases(origin);
+    all.insert(all.end(), cases.begin(), cases.end());
+
+    RTree3D tree((fanout * 2 + 4) / 5, fanout);
+    tree.buildTree(all);
+    const auto pairs = selfIntersections(tree);
+    check(pairs.size() == BruteForceOracle(all).countMeshIntersectingPairs());
+    check(std::all_of(pairs.begin(), pairs.end(), [](const auto& pair) {
+        return oracle_geometry::meshIntersect(pair.first, pair.second);
+    }));
+}
+
+// Упорядоченный по x поток вставок в R*-дерево с ёмкостью по умолчанию (1, 3). Разбиения по
+// minChildren == 1 делили такие узлы 1|M и вытягивали дерево в цепочку; узлы R* заполнены хотя бы
+// на 40% ёмкости, то есть на два, так что высота не больше log2 числа записей с запасом на корень
+template <typename Check>
+void sortedInserts(Result& result, std::span<const Triangle3D> triangles, const Options& options,
+                   const Workload& workload, Check& check) {
+    std::vector<Triangle3D> sorted(triangles.begin(), triangles.begin() + std::min(options.updates, triangles.size()));
+    std::sort(sorted.begin(), sorted.end(), [](const Triangle3D& a, const Triangle3D& b) {
+        return MBR(a).center().x < MBR(b).center().x;
+    });
+    if (sorted.empty()) return;
+
+    RTree3D tree(1, 3, InsertPolicy::RStar);
+    for (const auto& t : sorted) tree.insert(t);
+    result.sortedHeight = tree.stats().height;
+    check(result.sortedHeight <= std::ceil(std::log2(double(sorted.size()))) + 1);
+
+    const BruteForceOracle oracle(sorted);
+    for (size_t i = 0; i < std::min(options.oracleQueries, workload.ranges.size()); ++i) {
+        check(BruteForceOracle::sameTriangles(tree.find(workload.ranges[i]), oracle.find(workload.ranges[i])));
+    }
+}
+
+// Дерево сохраняется во всех кодировках прямоугольников и открывается обратно. Квантованные
+// прямоугольники округляются наружу, поэтому поиск обязан вернуть все истинные попадания и
+// только их: лишние кандидаты отсекаются точным MBR треугольника. Кроме запросов нагрузки
+// проверяются вырожденные прямоугольники — вершины треугольников и касающиеся их MBR снаружи
+template <typename Check>
+void packedFiles(Result& result, const RTree3D& tree, std::span<const Triangle3D> triangles, const Options& options,
+                 const Workload& workload, Check& check) {
+    std::vector<MBR> ranges(workload.ranges.begin(),
+                            workload.ranges.begin() + std::min(options.oracleQueries, workload.ranges.size()));
+    for (size_t i = 0; i < options.oracleQueries && !triangles.empty(); ++i) {
+        const Triangle3D& t = triangles[i * triangles.size() / options.oracleQueries];
+        const MBR box(t);
+        MBR vertex;
+        vertex.min = vertex.max = t.b;
+        MBR touching;
+        touching.min = box.max;
+        touching.max = box.max + Point3D{ 1.0f, 1.0f, 1.0f };
+        MBR slab = box;
+        slab.max.z = slab.min.z;
+        ranges.insert(ranges.end(), { vertex, touching, slab });
+    }
+
+    const std::string filename = options.output + ".packed";
+    const BruteForceOracle oracle(triangles);
+    const BoxEncoding encodings[] = { BoxEncoding::Float, BoxEncoding::Quantized16, BoxEncoding::Quantized8 };
+    for (size_t e = 0; e < std::size(encodings); ++e) {
+        MappedRTree mapped;
+        check(tree.save(filename, encodings[e]) && mapped.open(filename, true) && mapped.size() == triangles.size());
+        if (!mapped.isOpen()) continue;
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        result.packedBytes[e] = static_cast<size_t>(file.tellg());
+        for (const MBR& range : ranges) {
+            check(BruteForceOracle::sameTriangles(mapped.find(range), oracle.find(range)));
+        }
+    }
+    std::remove(filename.c_str());
+}
+
+// Внешнее построение файла с бюджетом в восьмую часть треугольников, чтобы серий было несколько,
+// и сверка запросов к открытому файлу с перебором
+template <typename Check>
+void streamBuild(Result& result, const std::vector<Triangle3D>& triangles, size_t fanout, const Options& options,
+                 const Workload& workload, Check& check) {
+    const std::string filename = options.output + ".rt";
+    const size_t budget = std::max(RTreeFileBuilder::MIN_BUDGET, triangles.size() * sizeof(Triangle3D) / 8);
+    constexpr size_t chunk = 4096;
+
+    bool built = false;
+    result.streamBuildMs = timeMs([&] {
+        RTreeFileBuilder builder(filename, budget, (fanout * 2 + 4) / 5, fanout);
+        built = true;
+        for (size_t i = 0; built && i < triangles.size(); i += chunk) {
+            built = builder.add(std::span(triangles).subspan(i, std::min(chunk, triangles.size() - i)));
+        }
+        built = built && builder.finish();
+        result.streamRuns = builder.runCount();
+        result.streamPasses = builder.mergePasses();
+        result.streamPeakBytes = builder.peakBufferBytes();
+    });
+
+    MappedRTree mapped;
+    check(built && mapped.open(filename, true) && mapped.size() == triangles.size());
+    const BruteForceOracle oracle(triangles);
+    for (size_t i = 0; mapped.isOpen() && i < std::min(options.oracleQueries, workload.ranges.size()); ++i) {
+        check(BruteForceOracle::sameTriangles(mapped.find(workload.ranges[i]), oracle.find(workload.ranges[i])));
+    }
+    mapped = MappedRTree();
+    std::remove(filename.c_str());
+}
+
+Result run(const std::string& name, const std::vector<Triangle3D>& triangles, size_t fanout, const Options& options) {
+    Result result;
+    result.workload = name;
+    result.size = triangles.size();
+    result.fanout = fanout;
+
+    // Минимум, как в RTree.h, — 40% максимума с округлением вверх
+    RTree3D tree((fanout * 2 + 4) / 5, fanout, options.policy);
+    result.buildMs = timeMs([&] { tree.buildTree(triangles); });
+
+    const Workload workload = generateQueries(triangles, options.queries, 16, options.seed + 1);
+    const size_t oracleCount = std::min(options.oracleQueries, options.queries);
+    auto check = [&](bool ok) {
+        ++result.checked;
+        if (!ok) ++result.failures;
+    };
+
+    // Удаляются и затем возвращаются последние updates треугольников
+    result.updates = std::min(options.updates, triangles.size());
+    const std::span<const Triangle3D> all(triangles);
+    const auto kept = all.first(all.size() - result.updates);
+    const auto moved = all.last(result.updates);
+
+    result.removeMs = timeMs([&] {
+        for (const auto& t : moved) tree.remove(t);
+    });
+    const BruteForceOracle keptOracle(kept);
+    for (size_t i = 0; i < oracleCount; ++i) {
+        check(BruteForceOracle::sameTriangles(tree.find(workload.ranges[i]), keptOracle.find(workload.ranges[i])));
+    }
+
+    std::vector<EntryHandle> handles;
+    handles.reserve(moved.size());
+    result.insertMs = timeMs([&] {
+        for (const auto& t : moved) handles.push_back(tree.insert(t));
+    });
+
+    // Те же треугольники удаляются по дескрипторам и возвращаются снова
+    result.removeHandleMs = timeMs([&] {
+        for (EntryHandle h : handles) tree.remove(h);
+    });
+    for (size_t i = 0; i < oracleCount; ++i) {
+        check(BruteForceOracle::sameTriangles(tree.find(workload.ranges[i]), keptOracle.find(workload.ranges[i])));
+    }
+    for (const auto& t : moved) tree.insert(t);
+
+    result.tree = tree.stats();
+    result.queries = workload.ranges.size();
+    tree.resetQueryStats();
+    result.rangeMs = timeMs([&] {
+        for (const auto& range : workload.ranges) result.rangeHits += tree.find(range).size();
+    });
+    result.rangeStats = tree.queryStats();
+    result.rangeBatchMs = timeMs([&] { tree.findBatch(workload.ranges); });
+    result.rangeExactMs = timeMs([&] {
+        for (const auto& range : workload.ranges) tree.find(range, QueryMode::Exact | QueryMode::ContainedSubtrees);
+    });
+    result.knnMs = timeMs([&] {
+        for (const auto& point : workload.points) tree.nearest(point, options.neighbors);
+    });
+    tree.resetQueryStats();
+    result.rayMs = timeMs([&] {
+        for (const auto& ray : workload.rays) result.rayHits += tree.raycast(ray.origin, ray.direction).has_value();
+    });
+    result.rayStats = tree.queryStats();
+
+    // Отсечение пирамидой против поиска по её MBR, который возвращает и треугольники вне пирамиды
+    std::vector<Triangle3D> culled;
+    result.frustumMs = timeMs([&] {
+        for (const auto& frustum : workload.frustums) {
+            tree.cullFrustum(frustum, [&](const Triangle3D& t) { culled.push_back(t); });
+            result.frustumHits += culled.size();
+            culled.clear();
+        }
+    });
+    RTree3D::BatchResult culledBatch;
+    result.frustumBatchMs = timeMs([&] { culledBatch = tree.cullFrustumBatch(workload.frustums); });
+    result.frustumBoxMs = timeMs([&] {
+        for (const auto& box : workload.frustumBoxes) result.frustumBoxHits += tree.find(box).size();
+    });
+
+    // Соединение дерева с самим собой: каждый треугольник в паре с каждым пересекающим, включая себя
+    std::vector<std::pair<Triangle3D, Triangle3D>> pairs;
+    result.joinMs = timeMs([&] { pairs = join(tree, tree); });
+    result.joinPairs = pairs.size();
+
+    std::vector<std::pair<Triangle3D, Triangle3D>> selfPairs;
+    result.selfMs = timeMs([&] { selfPairs = selfIntersections(tree); });
+    result.selfPairs = selfPairs.size();
+
+    const BruteForceOracle oracle(all);
+    for (size_t i = 0; i < oracleCount; ++i) {
+        check(BruteForceOracle::sameTriangles(tree.find(workload.ranges[i]), oracle.find(workload.ranges[i])));
+        check(BruteForceOracle::sameTriangles(tree.find(workload.ranges[i], QueryMode::Exact | QueryMode::ContainedSubtrees),
+                                              oracle.findExact(workload.ranges[i])));
+
+        const auto found = tree.nearest(workload.points[i], options.neighbors);
+        const auto expected = oracle.nearest(workload.points[i], options.neighbors);
+        bool same = found.size() == expected.size();
+        for (size_t j = 0; same && j < found.size(); ++j) {
+            same = BruteForceOracle::close(found[j].distance, expected[j]);
+        }
+        check(same);
+
+        const Ray& ray = workload.rays[i];
+        const auto hit = tree.raycast(ray.origin, ray.direction);
+        const auto expectedT = oracle.raycast(ray);
+        check(hit.has_value() == expectedT.has_value() && (!hit || BruteForceOracle::close(hit->t, *expectedT)));
+
+        const auto expectedCulled = oracle.cull(workload.frustums[i]);
+        culled.clear();
+        tree.cullFrustum(workload.frustums[i], [&](const Triangle3D& t) { culled.push_back(t); });
+        check(BruteForceOracle::sameTriangles(culled, expectedCulled));
+        const auto batch = culledBatch[i];
+        check(std::equal(culled.begin(), culled.end(), batch.begin(), batch.end(), [](const auto& a, const auto& b) {
+            return std::memcmp(&a, &b, sizeof(Triangle3D)) == 0;
+        }));
+    }
+
+    // Каждая копия треугольника даёт свои пары, поэтому эталон умножается на число копий
+    for (size_t i = 0; i < oracleCount && !all.empty(); ++i) {
+        const Triangle3D& t = all[i * all.size() / oracleCount];
+        const size_t found = std::count_if(pairs.begin(), pairs.end(), [&](const auto& pair) {
+            return std::memcmp(&pair.first, &t, sizeof(Triangle3D)) == 0;
+        });
+        check(found == oracle.countIntersecting(t) * oracle.countCopies(t));
+
+        // Самопересечения — неупорядоченные пары: k копий дают по паре с каждым из остальных
+        // пересекающих и k(k - 1) / 2 пар между собой
+        const size_t copies = oracle.countCopies(t);
+        const size_t touching = std::count_if(selfPairs.begin(), selfPairs.end(), [&](const auto& pair) {
+            return std::memcmp(&pair.first, &t, sizeof(Triangle3D)) == 0 ||
+                   std::memcmp(&pair.second, &t, sizeof(Triangle3D)) == 0;
+        });
+        check(touching == copies * (oracle.countMeshIntersecting(t) - copies) + copies * (copies - 1) / 2);
+    }
+
+    packedFiles(result, tree, all, options, workload, check);
+    churnAllocations(result, triangles, fanout, options, check);
+    // Ёмкость обобщённого дерева задана при компиляции, поэтому оно проверяется раз на набор
+    if (fanout == options.fanouts.front()) {
+        genericTrees(all, options, workload, check);
+        sortedInserts(result, all, options, workload, check);
+        selfIntersectionPairs(all, fanout, check);
+    }
+    animate(result, triangles, fanout, options, workload, check);
+    snapshots(result, triangles, fanout, options, workload, check);
+    streamBuild(result, triangles, fanout, options, workload, check);
+    return result;
+}
+
+void writeQueryStats(std::ostream& out, const char* name, const QueryStats& stats) {
+    out << ", \"" << name << "\": {"
+        << "\"nodes_visited\": " << stats.nodesVisited << ", "
+        << "\"box_tests\": " << stats.boxTests << ", "
+        << "\"triangle_tests\": " << stats.triangleTests << ", "
+        << "\"hits\": " << stats.hits << ", "
+        << "\"false_positives\": " << stats.falsePositives << "}";
+}
+
+std::string escape(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') result += '\\';
+        result += c;
+    }
+    return result;
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results, const Options& options) {
+    out << "{\n"
+        << "  \"timestamp\": " << std::time(nullptr) << ",\n"
+        << "  \"policy\": \"" << (options.policy == InsertPolicy::RStar ? "rstar" : "quadratic") << "\",\n"
+        << "  \"threads\": " << std::thread::hardware_concurrency() << ",\n"
+        << "  \"seed\": " << options.seed << ",\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i ? "," : "") << "\n    {"
+            << "\"workload\": \"" << escape(r.workload) << "\", "
+            << "\"size\": " << r.size << ", "
+            << "\"fanout\": " << r.fanout << ", "
+            << "\"build_ms\": " << r.buildMs << ", "
+            << "\"updates\": " << r.updates << ", "
+            << "\"remove_ms\": " << r.removeMs << ", "
+            << "\"insert_ms\": " << r.insertMs << ", "
+            << "\"remove_handle_ms\": " << r.removeHandleMs << ", "
+            << "\"queries\": " << r.queries << ", "
+            << "\"range_ms\": " << r.rangeMs << ", "
+            << "\"range_batch_ms\": " << r.rangeBatchMs << ", "
+            << "\"range_exact_ms\": " << r.rangeExactMs << ", "
+            << "\"range_hits\": " << r.rangeHits << ", "
+            << "\"knn_ms\": " << r.knnMs << ", "
+            << "\"ray_ms\": " << r.rayMs << ", "
+            << "\"ray_hits\": " << r.rayHits << ", "
+            << "\"frustum_ms\": " << r.frustumMs << ", "
+            << "\"frustum_batch_ms\": " << r.frustumBatchMs << ", "
+            << "\"frustum_hits\": " << r.frustumHits << ", "
+            << "\"frustum_box_ms\": " << r.frustumBoxMs << ", "
+            << "\"frustum_box_hits\": " << r.frustumBoxHits << ", "
+            << "\"join_ms\": " << r.joinMs << ", "
+            << "\"join_pairs\": " << r.joinPairs << ", "
+            << "\"self_ms\": " << r.selfMs << ", "
+            << "\"self_pairs\": " << r.selfPairs << ", "
+            << "\"ticks\": " << r.ticks << ", "
+            << "\"moved\": " << r.moved << ", "
+            << "\"escaped\": " << r.escaped << ", "
+            << "\"animate_ms\": " << r.animateMs << ", "
+            << "\"animate_plain_ms\": " << r.animatePlainMs << ", "
+            << "\"animate_range_exact_ms\": " << r.animateRangeMs << ", "
+            << "\"animate_plain_range_exact_ms\": " << r.animatePlainRangeMs << ", "
+            << "\"snapshot_update_ms\": " << r.snapshotUpdateMs << ", "
+            << "\"plain_update_ms\": " << r.plainUpdateMs << ", "
+            << "\"snapshot_range_ms\": " << r.snapshotRangeMs << ", "
+            << "\"snapshot_retained_nodes\": " << r.snapshotRetained << ", "
+            << "\"stream_build_ms\": " << r.streamBuildMs << ", "
+            << "\"stream_runs\": " << r.streamRuns << ", "
+            << "\"stream_merge_passes\": " << r.streamPasses << ", "
+            << "\"stream_peak_buffer_bytes\": " << r.streamPeakBytes << ", "
+            << "\"packed_float_bytes\": " << r.packedBytes[0] << ", "
+            << "\"packed_q16_bytes\": " << r.packedBytes[1] << ", "
+            << "\"packed_q8_bytes\": " << r.packedBytes[2] << ", "
+            << "\"churn_allocations\": " << r.churnAllocations << ", "
+            << "\"sorted_rstar_height\": " << r.sortedHeight << ", "
+            << "\"oracle_checked\": " << r.checked << ", "
+            << "\"oracle_failures\": " << r.failures << ", "
+            << "\"height\": " << r.tree.height << ", "
+            << "\"nodes\": " << r.tree.nodes << ", "
+            << "\"memory_bytes\": " << r.tree.memoryBytes << ", "
+            << "\"leaf_fill\": " << r.tree.levels.front().fill << ", "
+            << "\"leaf_dead_area\": " << r.tree.levels.front().deadArea;
+        // Счётчики обходов есть только в сборке с RTREE_STATS
+        if (QUERY_STATS_ENABLED) {
+            writeQueryStats(out, "range_stats", r.rangeStats);
+            writeQueryStats(out, "ray_stats", r.rayStats);
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<Result> results;
+    auto runAll = [&](const std::string& name, const std::vector<Triangle3D>& triangles) {
+        for (size_t fanout : options.fanouts) {
+            results.push_back(run(name, triangles, fanout, options));
+            const Result& r = results.back();
+            std::cout << r.workload << " n=" << r.size << " M=" << r.fanout
+                      << ": build " << r.buildMs << " ms, remove " << r.removeMs << " ms, insert " << r.insertMs
+                      << " ms, remove by handle " << r.removeHandleMs
+                      << " ms, range " << r.rangeMs << " ms, knn " << r.knnMs << " ms, ray " << r.rayMs << " ms, frustum " << r.frustumMs
+                      << " ms, join " << r.joinMs << " ms, self " << r.selfMs
+                      << " ms, animate " << r.animateMs << " ms (plain " << r.animatePlainMs
+                      << " ms), updates under snapshot " << r.snapshotUpdateMs << " ms (plain " << r.plainUpdateMs
+                      << " ms, " << r.snapshotRetained << " nodes retained), stream build " << r.streamBuildMs << " ms (" << r.streamRuns << " runs)"
+                      << ", oracle " << r.checked - r.failures << "/" << r.checked << std::endl;
+        }
+    };
+
+    for (Distribution distribution : options.distributions) {
+        for (size_t size : options.sizes) {
+            runAll(distributionName(distribution), generateTriangles(distribution, size, options.seed));
+        }
+    }
+    for (const auto& mesh : options.meshes) {
+        std::vector<Triangle3D> triangles;
+        if (!loadMesh(mesh, triangles)) {
+            std::cerr << "cannot load " << mesh << "\n";
+            return 2;
+        }
+        runAll(mesh, triangles);
+    }
+
+    std::ofstream out(options.output);
+    writeJson(out, results, options);
+    if (!out) {
+        std::cerr << "cannot write " << options.output << "\n";
+        return 2;
+    }
+
+    for (const Result& r : results) {
+        if (r.failures) return 1;
+    }
+    return 0;
+}
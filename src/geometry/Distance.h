@@ -0,0 +1,69 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+#include <algorithm>
+
+#include "Point3D.h"
+#include "Triangle3D.h"
+
+inline Point3D closestPointOnSegment(const Point3D& p, const Point3D& a, const Point3D& b) {
+    const Point3D ab = b - a;
+    const float length = dot(ab, ab);
+    if (length == 0.0f) return a;
+    return a + ab * std::clamp(dot(p - a, ab) / length, 0.0f, 1.0f);
+}
+
+// Ближайшая к p точка треугольника (Ericson, Real-Time Collision Detection, 5.1.5)
+inline Point3D closestPointOnTriangle(const Point3D& p, const Triangle3D& t) {
+    const Point3D ab = t.b - t.a;
+    const Point3D ac = t.c - t.a;
+
+    const Point3D ap = p - t.a;
+    const float d1 = dot(ab, ap);
+    const float d2 = dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return t.a;
+
+    const Point3D bp = p - t.b;
+    const float d3 = dot(ab, bp);
+    const float d4 = dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return t.b;
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return t.a + ab * (d1 / (d1 - d3));
+
+    const Point3D cp = p - t.c;
+    const float d5 = dot(ab, cp);
+    const float d6 = dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return t.c;
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return t.a + ac * (d2 / (d2 - d6));
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        return t.b + (t.c - t.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    const float sum = va + vb + vc;
+    if (sum == 0.0f) {
+        // Вырожденный треугольник: ближайшая из точек на рёбрах
+        const Point3D candidates[3] = {
+            closestPointOnSegment(p, t.a, t.b),
+            closestPointOnSegment(p, t.b, t.c),
+            closestPointOnSegment(p, t.c, t.a)
+        };
+        return *std::min_element(std::begin(candidates), std::end(candidates), [&](const Point3D& q1, const Point3D& q2) {
+            return dot(q1 - p, q1 - p) < dot(q2 - p, q2 - p);
+        });
+    }
+
+    const float v = vb / sum;
+    const float w = vc / sum;
+    return t.a + ab * v + ac * w;
+}
+
+inline float squaredDistance(const Point3D& p, const Triangle3D& t) {
+    const Point3D d = closestPointOnTriangle(p, t) - p;
+    return dot(d, d);
+}
+
+#endif //DISTANCE_H
@@ -0,0 +1,86 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "Point3D.h"
+
+// Плоскость normal·p + d = 0; внутренняя сторона — normal·p + d >= 0
+struct Plane {
+    Point3D normal;
+    float d;
+
+    float distance(const Point3D& p) const {
+        return dot(normal, p) + d;
+    }
+};
+
+// Пирамида видимости: шесть плоскостей с нормалями внутрь, порядок любой.
+// Ненужную плоскость можно задать нулевой — ей удовлетворяет любая точка.
+using Frustum = std::array<Plane, 6>;
+
+enum class Containment : std::uint8_t {
+    Outside,
+    Intersecting,
+    Inside
+};
+
+// Положение прямоугольника [min, max] относительно пирамиды. Для каждой плоскости проверяются
+// две вершины: ближайшая к внутренней стороне (если и она снаружи — прямоугольник снаружи)
+// и дальнейшая (если и она внутри — прямоугольник целиком по внутреннюю сторону плоскости).
+// Консервативно: прямоугольник у ребра пирамиды, не отсечённый ни одной плоскостью,
+// считается пересекающим, даже если лежит снаружи.
+inline Containment classifyBox(const Frustum& frustum, const Point3D& min, const Point3D& max) {
+    bool inside = true;
+    for (const Plane& plane : frustum) {
+        const Point3D& n = plane.normal;
+        const Point3D near{ n.x >= 0.0f ? max.x : min.x, n.y >= 0.0f ? max.y : min.y, n.z >= 0.0f ? max.z : min.z };
+        const Point3D far{ n.x >= 0.0f ? min.x : max.x, n.y >= 0.0f ? min.y : max.y, n.z >= 0.0f ? min.z : max.z };
+        if (plane.distance(near) < 0.0f) return Containment::Outside;
+        inside = inside && plane.distance(far) >= 0.0f;
+    }
+    return inside ? Containment::Inside : Containment::Intersecting;
+}
+
+// Плоскости из матрицы вида и проекции (Gribb, Hartmann): m по строкам, clip = m · (x, y, z, 1),
+// видимы точки с -w <= x, y, z <= w, как в OpenGL. Нормали не нормируются — для отсечения это не нужно.
+inline Frustum frustumFromMatrix(const float (&m)[16]) {
+    auto row = [&](int r) {
+        return std::array<float, 4>{ m[4 * r], m[4 * r + 1], m[4 * r + 2], m[4 * r + 3] };
+    };
+    auto plane = [&](int r, float sign) {
+        const auto w = row(3), v = row(r);
+        return Plane{ { w[0] + sign * v[0], w[1] + sign * v[1], w[2] + sign * v[2] }, w[3] + sign * v[3] };
+    };
+    return { plane(0, 1.0f), plane(0, -1.0f), plane(1, 1.0f), plane(1, -1.0f), plane(2, 1.0f), plane(2, -1.0f) };
+}
+
+// Пирамида перспективной камеры в точке eye, смотрящей на target: fovY — полный угол по вертикали
+// в радианах, aspect — отношение ширины к высоте, near и far — расстояния до плоскостей вдоль взгляда.
+// up не должен быть параллелен направлению взгляда.
+inline Frustum perspectiveFrustum(const Point3D& eye, const Point3D& target, const Point3D& up, float fovY,
+                                  float aspect, float near, float far) {
+    auto normalize = [](const Point3D& v) {
+        const float length = std::sqrt(dot(v, v));
+        return length > 0.0f ? v * (1.0f / length) : v;
+    };
+    const Point3D forward = normalize(target - eye);
+    const Point3D right = normalize(cross(forward, up));
+    const Point3D top = cross(right, forward);
+    const float tanY = std::tan(fovY / 2);
+    const float tanX = tanY * aspect;
+
+    // Боковые плоскости проходят через eye
+    auto side = [&](const Point3D& normal) {
+        return Plane{ normal, -dot(normal, eye) };
+    };
+    return { Plane{ forward, -dot(forward, eye) - near },
+             Plane{ forward * -1.0f, dot(forward, eye) + far },
+             side(forward * tanX + right),
+             side(forward * tanX - right),
+             side(forward * tanY + top),
+             side(forward * tanY - top) };
+}
+
+#endif //FRUSTUM_H
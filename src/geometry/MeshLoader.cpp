@@ -0,0 +1,201 @@
+#include "MeshLoader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+std::string lowercaseExtension(const std::string& filename) {
+    const size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos) return {};
+    std::string extension = filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return char(std::tolower(c)); });
+    return extension;
+}
+
+bool parseFloat(const char*& cursor, float& value) {
+    char* end = nullptr;
+    value = std::strtof(cursor, &end);
+    if (end == cursor) return false;
+    cursor = end;
+    return true;
+}
+
+// Номер вершины грани OBJ: первое число токена "i/t/n", 1-based или отрицательный от конца
+bool parseObjIndex(const char*& cursor, size_t vertexCount, size_t& index) {
+    char* end = nullptr;
+    const long value = std::strtol(cursor, &end, 10);
+    if (end == cursor) return false;
+    cursor = end;
+    while (*cursor && !std::isspace(static_cast<unsigned char>(*cursor))) ++cursor;
+
+    if (value > 0 && size_t(value) <= vertexCount) {
+        index = size_t(value) - 1;
+        return true;
+    }
+    if (value < 0 && size_t(-value) <= vertexCount) {
+        index = vertexCount - size_t(-value);
+        return true;
+    }
+    return false;
+}
+
+void skipSpaces(const char*& cursor) {
+    while (*cursor == ' ' || *cursor == '\t') ++cursor;
+}
+
+// Копит треугольники и отдаёт их sink пачками по chunk
+class ChunkBuffer {
+    const TriangleSink& sink;
+    std::vector<Triangle3D> pending;
+    size_t chunk;
+
+public:
+    ChunkBuffer(const TriangleSink& sink, size_t chunk) : sink(sink), chunk(std::max<size_t>(chunk, 1)) {
+        pending.reserve(this->chunk);
+    }
+
+    bool push(const Triangle3D& triangle) {
+        pending.push_back(triangle);
+        return pending.size() < chunk || flush();
+    }
+
+    bool flush() {
+        if (pending.empty()) return true;
+        const bool ok = sink(pending);
+        pending.clear();
+        return ok;
+    }
+};
+
+bool streamBinarySTL(std::istream& in, std::uint32_t count, ChunkBuffer& out) {
+    char record[50];
+    for (std::uint32_t i = 0; i < count; ++i) {
+        if (!in.read(record, sizeof(record))) return false;
+        // Нормаль (12 байт) пропускается, затем три вершины по три float
+        float coords[9];
+        std::memcpy(coords, record + 12, sizeof(coords));
+        if (!out.push({ { coords[0], coords[1], coords[2] },
+                        { coords[3], coords[4], coords[5] },
+                        { coords[6], coords[7], coords[8] } })) {
+            return false;
+        }
+    }
+    return out.flush();
+}
+
+bool streamTextSTL(std::istream& in, ChunkBuffer& out) {
+    std::string token;
+    Point3D corners[3];
+    size_t corner = 0;
+    bool solid = false;
+    while (in >> token) {
+        if (token == "solid") {
+            solid = true;
+            std::getline(in, token);
+        } else if (token == "vertex") {
+            Point3D& p = corners[corner];
+            if (!(in >> p.x >> p.y >> p.z)) return false;
+            if (++corner == 3) {
+                if (!out.push({ corners[0], corners[1], corners[2] })) return false;
+                corner = 0;
+            }
+        }
+    }
+    return out.flush() && solid && corner == 0;
+}
+
+// Сбор всех пачек в конец triangles — для функций load*
+TriangleSink appendTo(std::vector<Triangle3D>& triangles) {
+    return [&triangles](std::span<const Triangle3D> chunk) {
+        triangles.insert(triangles.end(), chunk.begin(), chunk.end());
+        return true;
+    };
+}
+
+constexpr size_t LOAD_CHUNK = 1 << 16;
+}
+
+bool loadMesh(const std::string& filename, std::vector<Triangle3D>& triangles) {
+    return streamMesh(filename, LOAD_CHUNK, appendTo(triangles));
+}
+
+bool loadOBJ(std::istream& in, std::vector<Triangle3D>& triangles) {
+    return streamOBJ(in, LOAD_CHUNK, appendTo(triangles));
+}
+
+bool loadSTL(std::istream& in, std::vector<Triangle3D>& triangles) {
+    return streamSTL(in, LOAD_CHUNK, appendTo(triangles));
+}
+
+bool streamMesh(const std::string& filename, size_t chunk, const TriangleSink& sink) {
+    const std::string extension = lowercaseExtension(filename);
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) return false;
+
+    if (extension == "obj") return streamOBJ(in, chunk, sink);
+    if (extension == "stl") return streamSTL(in, chunk, sink);
+    return false;
+}
+
+bool streamOBJ(std::istream& in, size_t chunk, const TriangleSink& sink) {
+    ChunkBuffer out(sink, chunk);
+    std::vector<Point3D> vertices;
+    std::vector<size_t> face;
+    std::string line;
+
+    while (std::getline(in, line)) {
+        const char* cursor = line.c_str();
+        skipSpaces(cursor);
+
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            ++cursor;
+            Point3D p;
+            if (!parseFloat(cursor, p.x) || !parseFloat(cursor, p.y) || !parseFloat(cursor, p.z)) return false;
+            vertices.push_back(p);
+        } else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            ++cursor;
+            face.clear();
+            skipSpaces(cursor);
+            while (*cursor && *cursor != '\r' && *cursor != '#') {
+                size_t index;
+                if (!parseObjIndex(cursor, vertices.size(), index)) return false;
+                face.push_back(index);
+                skipSpaces(cursor);
+            }
+            if (face.size() < 3) return false;
+
+            for (size_t i = 1; i + 1 < face.size(); ++i) {
+                if (!out.push({ vertices[face[0]], vertices[face[i]], vertices[face[i + 1]] })) return false;
+            }
+        }
+    }
+    return out.flush() && in.eof();
+}
+
+bool streamSTL(std::istream& in, size_t chunk, const TriangleSink& sink) {
+    ChunkBuffer out(sink, chunk);
+    const std::streampos start = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streamoff size = in.tellg() - start;
+    in.seekg(start);
+
+    if (size >= 84) {
+        char header[84];
+        in.read(header, sizeof(header));
+        std::uint32_t count;
+        std::memcpy(&count, header + 80, sizeof(count));
+        if (in && size == 84 + std::streamoff(count) * 50) {
+            return streamBinarySTL(in, count, out);
+        }
+        in.clear();
+        in.seekg(start);
+    }
+    return streamTextSTL(in, out);
+}
@@ -0,0 +1,35 @@
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+#include <functional>
+#include <istream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Triangle3D.h"
+
+// Чтение треугольников из OBJ и STL. Треугольники добавляются в конец triangles;
+// при ошибке возвращается false, а triangles может содержать прочитанное до неё.
+
+// Формат выбирается по расширению (.obj, .stl, без учёта регистра)
+bool loadMesh(const std::string& filename, std::vector<Triangle3D>& triangles);
+
+// Вершины "v x y z" и грани "f i j k ..." (индексы вида i, i/t, i//n, i/t/n, отрицательные —
+// от конца); многоугольники разбиваются веером. Остальные строки пропускаются.
+bool loadOBJ(std::istream& in, std::vector<Triangle3D>& triangles);
+
+// Двоичный STL распознаётся по размеру (84 + 50 * число треугольников), иначе текстовый
+bool loadSTL(std::istream& in, std::vector<Triangle3D>& triangles);
+
+// Потоковое чтение для сеток, не помещающихся в память: sink получает треугольники пачками
+// не больше chunk в порядке файла и может прервать чтение, вернув false (тогда и функция
+// возвращает false). Вершины OBJ всё равно хранятся в памяти целиком — грани ссылаются на них.
+using TriangleSink = std::function<bool(std::span<const Triangle3D>)>;
+
+bool streamMesh(const std::string& filename, size_t chunk, const TriangleSink& sink);
+
+bool streamOBJ(std::istream& in, size_t chunk, const TriangleSink& sink);
+
+bool streamSTL(std::istream& in, size_t chunk, const TriangleSink& sink);
+
+#endif //MESHLOADER_H
@@ -9,4 +9,24 @@ struct Point3D {
     }
 };
 
+inline Point3D operator+(const Point3D& a, const Point3D& b) {
+    return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+inline Point3D operator-(const Point3D& a, const Point3D& b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline Point3D operator*(const Point3D& a, float s) {
+    return { a.x * s, a.y * s, a.z * s };
+}
+
+inline float dot(const Point3D& a, const Point3D& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Point3D cross(const Point3D& a, const Point3D& b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
 #endif //POINT3D_H
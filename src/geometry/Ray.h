@@ -0,0 +1,130 @@
+#ifndef RAY_H
+#define RAY_H
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "Point3D.h"
+#include "Triangle3D.h"
+
+struct Ray {
+    Point3D origin;
+    Point3D direction;
+    float tMax = std::numeric_limits<float>::infinity();
+};
+
+// Попадание луча в треугольник: точка = origin + t * direction = (1 - u - v) * a + u * b + v * c
+struct RayTriangleHit {
+    float t = std::numeric_limits<float>::infinity();
+    float u = 0.0f;
+    float v = 0.0f;
+    size_t index = 0;
+};
+
+// Möller–Trumbore для одного треугольника; попадание засчитывается при 0 <= t < tMax
+inline bool intersectRayTriangle(const Ray& ray, const Triangle3D& tri, float tMax, RayTriangleHit& hit) {
+    const Point3D e1 = tri.b - tri.a;
+    const Point3D e2 = tri.c - tri.a;
+    const Point3D p = cross(ray.direction, e2);
+    const float det = dot(e1, p);
+    if (det == 0.0f) return false;
+
+    const float inv = 1.0f / det;
+    const Point3D s = ray.origin - tri.a;
+    const float u = dot(s, p) * inv;
+    if (!(u >= 0.0f && u <= 1.0f)) return false;
+
+    const Point3D q = cross(s, e1);
+    const float v = dot(ray.direction, q) * inv;
+    if (!(v >= 0.0f && u + v <= 1.0f)) return false;
+
+    const float t = dot(e2, q) * inv;
+    if (!(t >= 0.0f && t < tMax)) return false;
+
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    return true;
+}
+
+// Ближайшее попадание среди count треугольников; hit.t задаёт верхнюю границу поиска.
+// При anyHit возвращается первое найденное попадание.
+inline bool intersectRayTriangles(const Ray& ray, const Triangle3D* tris, size_t count, RayTriangleHit& hit, bool anyHit = false) {
+    bool found = false;
+    size_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // По четыре треугольника за шаг: вершины собираются в регистры по координатам
+    const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+    const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+    for (; i + 4 <= count; i += 4) {
+        const Triangle3D* t = tris + i;
+        const __m128 ax = _mm_set_ps(t[3].a.x, t[2].a.x, t[1].a.x, t[0].a.x);
+        const __m128 ay = _mm_set_ps(t[3].a.y, t[2].a.y, t[1].a.y, t[0].a.y);
+        const __m128 az = _mm_set_ps(t[3].a.z, t[2].a.z, t[1].a.z, t[0].a.z);
+        const __m128 e1x = _mm_sub_ps(_mm_set_ps(t[3].b.x, t[2].b.x, t[1].b.x, t[0].b.x), ax);
+        const __m128 e1y = _mm_sub_ps(_mm_set_ps(t[3].b.y, t[2].b.y, t[1].b.y, t[0].b.y), ay);
+        const __m128 e1z = _mm_sub_ps(_mm_set_ps(t[3].b.z, t[2].b.z, t[1].b.z, t[0].b.z), az);
+        const __m128 e2x = _mm_sub_ps(_mm_set_ps(t[3].c.x, t[2].c.x, t[1].c.x, t[0].c.x), ax);
+        const __m128 e2y = _mm_sub_ps(_mm_set_ps(t[3].c.y, t[2].c.y, t[1].c.y, t[0].c.y), ay);
+        const __m128 e2z = _mm_sub_ps(_mm_set_ps(t[3].c.z, t[2].c.z, t[1].c.z, t[0].c.z), az);
+
+        // p = d x e2, det = e1 . p
+        const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        const __m128 inv = _mm_div_ps(one, det);
+
+        const __m128 sx = _mm_sub_ps(ox, ax), sy = _mm_sub_ps(oy, ay), sz = _mm_sub_ps(oz, az);
+        const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+        // q = s x e1
+        const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+        const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+        __m128 mask = _mm_cmpneq_ps(det, zero);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(tt, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, _mm_set1_ps(hit.t)));
+
+        int bits = _mm_movemask_ps(mask);
+        if (!bits) continue;
+
+        alignas(16) float ts[4], us[4], vs[4];
+        _mm_store_ps(ts, tt);
+        _mm_store_ps(us, u);
+        _mm_store_ps(vs, v);
+        for (int lane = 0; lane < 4; ++lane) {
+            if ((bits >> lane & 1) && ts[lane] < hit.t) {
+                hit = { ts[lane], us[lane], vs[lane], i + lane };
+                found = true;
+                if (anyHit) return true;
+            }
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        if (intersectRayTriangle(ray, tris[i], hit.t, hit)) {
+            hit.index = i;
+            found = true;
+            if (anyHit) return true;
+        }
+    }
+    return found;
+}
+
+#endif //RAY_H
@@ -0,0 +1,117 @@
+#ifndef TRIANGLEBOX_H
+#define TRIANGLEBOX_H
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "Point3D.h"
+#include "Triangle3D.h"
+
+// Пересечение треугольника с осепараллельным прямоугольником [min, max] по теореме о разделяющей оси
+// (Akenine-Möller, Fast 3D Triangle-Box Overlap Testing): оси прямоугольника, нормаль треугольника
+// и 9 произведений осей на рёбра. Касание считается пересечением, как у MBR. Оси прямоугольника
+// проверяются точно, остальные — в координатах относительно центра, с округлением float.
+inline bool triangleIntersectsBox(const Triangle3D& tri, const Point3D& min, const Point3D& max) {
+    if (std::max({ tri.a.x, tri.b.x, tri.c.x }) < min.x || std::min({ tri.a.x, tri.b.x, tri.c.x }) > max.x) return false;
+    if (std::max({ tri.a.y, tri.b.y, tri.c.y }) < min.y || std::min({ tri.a.y, tri.b.y, tri.c.y }) > max.y) return false;
+    if (std::max({ tri.a.z, tri.b.z, tri.c.z }) < min.z || std::min({ tri.a.z, tri.b.z, tri.c.z }) > max.z) return false;
+
+    const Point3D center = (min + max) * 0.5f;
+    const Point3D half = (max - min) * 0.5f;
+    const Point3D v0 = tri.a - center, v1 = tri.b - center, v2 = tri.c - center;
+
+    auto separated = [&](const Point3D& axis) {
+        const float p0 = dot(v0, axis), p1 = dot(v1, axis), p2 = dot(v2, axis);
+        const float r = half.x * std::fabs(axis.x) + half.y * std::fabs(axis.y) + half.z * std::fabs(axis.z);
+        return std::min({ p0, p1, p2 }) > r || std::max({ p0, p1, p2 }) < -r;
+    };
+
+    const Point3D edges[3] = { v1 - v0, v2 - v1, v0 - v2 };
+    for (const Point3D& e : edges) {
+        if (separated({ 0.0f, -e.z, e.y }) || separated({ e.z, 0.0f, -e.x }) || separated({ -e.y, e.x, 0.0f })) {
+            return false;
+        }
+    }
+    return !separated(cross(edges[0], edges[1]));
+}
+
+// Маска треугольников [0, count), пересекающих прямоугольник; count <= 64.
+// Те же проверки по четыре треугольника за шаг.
+inline std::uint64_t trianglesIntersectBox(const Triangle3D* tris, size_t count, const Point3D& min, const Point3D& max) {
+    std::uint64_t mask = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    const Point3D center = (min + max) * 0.5f;
+    const Point3D half = (max - min) * 0.5f;
+    const __m128 minX = _mm_set1_ps(min.x), minY = _mm_set1_ps(min.y), minZ = _mm_set1_ps(min.z);
+    const __m128 maxX = _mm_set1_ps(max.x), maxY = _mm_set1_ps(max.y), maxZ = _mm_set1_ps(max.z);
+    const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+    const __m128 hx = _mm_set1_ps(half.x), hy = _mm_set1_ps(half.y), hz = _mm_set1_ps(half.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    auto min3 = [](__m128 a, __m128 b, __m128 c) { return _mm_min_ps(a, _mm_min_ps(b, c)); };
+    auto max3 = [](__m128 a, __m128 b, __m128 c) { return _mm_max_ps(a, _mm_max_ps(b, c)); };
+
+    for (; i + 4 <= count; i += 4) {
+        const Triangle3D* t = tris + i;
+        const __m128 ax = _mm_set_ps(t[3].a.x, t[2].a.x, t[1].a.x, t[0].a.x);
+        const __m128 ay = _mm_set_ps(t[3].a.y, t[2].a.y, t[1].a.y, t[0].a.y);
+        const __m128 az = _mm_set_ps(t[3].a.z, t[2].a.z, t[1].a.z, t[0].a.z);
+        const __m128 bx = _mm_set_ps(t[3].b.x, t[2].b.x, t[1].b.x, t[0].b.x);
+        const __m128 by = _mm_set_ps(t[3].b.y, t[2].b.y, t[1].b.y, t[0].b.y);
+        const __m128 bz = _mm_set_ps(t[3].b.z, t[2].b.z, t[1].b.z, t[0].b.z);
+        const __m128 qx = _mm_set_ps(t[3].c.x, t[2].c.x, t[1].c.x, t[0].c.x);
+        const __m128 qy = _mm_set_ps(t[3].c.y, t[2].c.y, t[1].c.y, t[0].c.y);
+        const __m128 qz = _mm_set_ps(t[3].c.z, t[2].c.z, t[1].c.z, t[0].c.z);
+
+        // Оси прямоугольника: разделение, если интервал вершин целиком по одну сторону
+        __m128 out = _mm_or_ps(_mm_cmplt_ps(max3(ax, bx, qx), minX), _mm_cmpgt_ps(min3(ax, bx, qx), maxX));
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(max3(ay, by, qy), minY), _mm_cmpgt_ps(min3(ay, by, qy), maxY)));
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(max3(az, bz, qz), minZ), _mm_cmpgt_ps(min3(az, bz, qz), maxZ)));
+
+        const __m128 v0x = _mm_sub_ps(ax, cx), v0y = _mm_sub_ps(ay, cy), v0z = _mm_sub_ps(az, cz);
+        const __m128 v1x = _mm_sub_ps(bx, cx), v1y = _mm_sub_ps(by, cy), v1z = _mm_sub_ps(bz, cz);
+        const __m128 v2x = _mm_sub_ps(qx, cx), v2y = _mm_sub_ps(qy, cy), v2z = _mm_sub_ps(qz, cz);
+
+        auto separated = [&](__m128 nx, __m128 ny, __m128 nz) {
+            const __m128 p0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v0x, nx), _mm_mul_ps(v0y, ny)), _mm_mul_ps(v0z, nz));
+            const __m128 p1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v1x, nx), _mm_mul_ps(v1y, ny)), _mm_mul_ps(v1z, nz));
+            const __m128 p2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v2x, nx), _mm_mul_ps(v2y, ny)), _mm_mul_ps(v2z, nz));
+            const __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(hx, _mm_and_ps(nx, absMask)), _mm_mul_ps(hy, _mm_and_ps(ny, absMask))),
+                                        _mm_mul_ps(hz, _mm_and_ps(nz, absMask)));
+            return _mm_or_ps(_mm_cmpgt_ps(min3(p0, p1, p2), r), _mm_cmplt_ps(max3(p0, p1, p2), _mm_sub_ps(zero, r)));
+        };
+
+        const __m128 ex[3] = { _mm_sub_ps(v1x, v0x), _mm_sub_ps(v2x, v1x), _mm_sub_ps(v0x, v2x) };
+        const __m128 ey[3] = { _mm_sub_ps(v1y, v0y), _mm_sub_ps(v2y, v1y), _mm_sub_ps(v0y, v2y) };
+        const __m128 ez[3] = { _mm_sub_ps(v1z, v0z), _mm_sub_ps(v2z, v1z), _mm_sub_ps(v0z, v2z) };
+        for (int e = 0; e < 3; ++e) {
+            out = _mm_or_ps(out, separated(zero, _mm_sub_ps(zero, ez[e]), ey[e]));
+            out = _mm_or_ps(out, separated(ez[e], zero, _mm_sub_ps(zero, ex[e])));
+            out = _mm_or_ps(out, separated(_mm_sub_ps(zero, ey[e]), ex[e], zero));
+        }
+
+        // Нормаль треугольника e0 x e1
+        const __m128 nx = _mm_sub_ps(_mm_mul_ps(ey[0], ez[1]), _mm_mul_ps(ez[0], ey[1]));
+        const __m128 ny = _mm_sub_ps(_mm_mul_ps(ez[0], ex[1]), _mm_mul_ps(ex[0], ez[1]));
+        const __m128 nz = _mm_sub_ps(_mm_mul_ps(ex[0], ey[1]), _mm_mul_ps(ey[0], ex[1]));
+        out = _mm_or_ps(out, separated(nx, ny, nz));
+
+        mask |= std::uint64_t(~_mm_movemask_ps(out) & 0xF) << i;
+    }
+#endif
+
+    for (; i < count; ++i) {
+        if (triangleIntersectsBox(tris[i], min, max)) mask |= std::uint64_t(1) << i;
+    }
+    return mask;
+}
+
+#endif //TRIANGLEBOX_H
@@ -0,0 +1,279 @@
+#ifndef TRIANGLEINTERSECTION_H
+#define TRIANGLEINTERSECTION_H
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "Triangle3D.h"
+
+// Пересечение двух треугольников (Möller, A Fast Triangle-Triangle Intersection Test, 1997):
+// отсечение по плоскостям друг друга, затем сравнение отрезков пересечения на прямой пересечения
+// плоскостей; компланарные треугольники проверяются в проекции на координатную плоскость.
+// Касание считается пересечением. Вычисления в double; расстояния до плоскостей и концы отрезков
+// сравниваются с относительным допуском, иначе треугольники с общей вершиной или ребром
+// (соседи в сетке) разделялись бы ошибкой округления. Вырожденные треугольники обрабатываются
+// как отрезки и точки.
+namespace triangle_intersection {
+
+struct Vec {
+    double x, y, z;
+
+    double operator[](int axis) const {
+        return axis == 0 ? x : axis == 1 ? y : z;
+    }
+};
+
+inline Vec toVec(const Point3D& p) {
+    return { p.x, p.y, p.z };
+}
+
+inline Vec sub(const Vec& a, const Vec& b) {
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline Vec cross(const Vec& a, const Vec& b) {
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline double dot(const Vec& a, const Vec& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline double length(const Vec& v) {
+    return std::sqrt(dot(v, v));
+}
+
+inline bool isZero(const Vec& v) {
+    return v.x == 0.0 && v.y == 0.0 && v.z == 0.0;
+}
+
+// Знаковая площадь (удвоенная) треугольника в плоскости осей i, j
+inline double orient2D(const Vec& a, const Vec& b, const Vec& c, int i, int j) {
+    return (b[i] - a[i]) * (c[j] - a[j]) - (b[j] - a[j]) * (c[i] - a[i]);
+}
+
+// Пересечение отрезков pq и rs в плоскости осей i, j, включая касание и наложение
+inline bool segmentsIntersect2D(const Vec& p, const Vec& q, const Vec& r, const Vec& s, int i, int j) {
+    const double d1 = orient2D(r, s, p, i, j), d2 = orient2D(r, s, q, i, j);
+    const double d3 = orient2D(p, q, r, i, j), d4 = orient2D(p, q, s, i, j);
+    if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) return true;
+
+    auto onSegment = [&](const Vec& a, const Vec& b, const Vec& c) {
+        return std::min(a[i], b[i]) <= c[i] && c[i] <= std::max(a[i], b[i]) &&
+               std::min(a[j], b[j]) <= c[j] && c[j] <= std::max(a[j], b[j]);
+    };
+    return (d1 == 0 && onSegment(r, s, p)) || (d2 == 0 && onSegment(r, s, q)) ||
+           (d3 == 0 && onSegment(p, q, r)) || (d4 == 0 && onSegment(p, q, s));
+}
+
+inline bool pointInTriangle2D(const Vec& p, const Vec* t, int i, int j) {
+    const double d0 = orient2D(t[0], t[1], p, i, j);
+    const double d1 = orient2D(t[1], t[2], p, i, j);
+    const double d2 = orient2D(t[2], t[0], p, i, j);
+    return (d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0);
+}
+
+// Оси координатной плоскости, на которую проекция с нормалью normal не вырождается
+inline std::pair<int, int> projectionAxes(const Vec& normal) {
+    const double ax = std::fabs(normal.x), ay = std::fabs(normal.y), az = std::fabs(normal.z);
+    if (ax >= ay && ax >= az) return { 1, 2 };
+    if (ay >= az) return { 0, 2 };
+    return { 0, 1 };
+}
+
+inline bool coplanarIntersect(const Vec* a, const Vec* b, const Vec& normal) {
+    const auto [i, j] = projectionAxes(normal);
+    for (int e = 0; e < 3; ++e) {
+        for (int f = 0; f < 3; ++f) {
+            if (segmentsIntersect2D(a[e], a[(e + 1) % 3], b[f], b[(f + 1) % 3], i, j)) return true;
+        }
+    }
+    // Один треугольник целиком внутри другого
+    return pointInTriangle2D(a[0], b, i, j) || pointInTriangle2D(b[0], a, i, j);
+}
+
+// Относительная погрешность: много больше округления double, много меньше шага float
+constexpr double epsilon = 1e-10;
+
+// Знаковые расстояния (умноженные на |normal|) вершин p до плоскости через origin;
+// значения в пределах погрешности обнуляются
+inline void planeDistances(const Vec* p, const Vec& normal, const Vec& origin, double* d) {
+    double scale = 0.0;
+    for (int k = 0; k < 3; ++k) {
+        const Vec offset = sub(p[k], origin);
+        d[k] = dot(normal, offset);
+        scale = std::max(scale, length(offset));
+    }
+    const double tolerance = epsilon * length(normal) * scale;
+    for (int k = 0; k < 3; ++k) {
+        if (std::fabs(d[k]) <= tolerance) d[k] = 0.0;
+    }
+}
+
+// Отрезок [t0, t1] пересечения треугольника с плоскостью другого, в проекциях p вершин на прямую
+// пересечения плоскостей; d — знаковые расстояния вершин до этой плоскости (не все одного знака)
+inline void interval(const double* p, const double* d, double& t0, double& t1) {
+    int alone;
+    if (d[0] * d[1] > 0) {
+        alone = 2;
+    } else if (d[0] * d[2] > 0) {
+        alone = 1;
+    } else if (d[1] * d[2] > 0 || d[0] != 0) {
+        alone = 0;
+    } else {
+        alone = d[1] != 0 ? 1 : 2;
+    }
+    const int u = (alone + 1) % 3, v = (alone + 2) % 3;
+    t0 = p[alone] + (p[u] - p[alone]) * d[alone] / (d[alone] - d[u]);
+    t1 = p[alone] + (p[v] - p[alone]) * d[alone] / (d[alone] - d[v]);
+    if (t0 > t1) std::swap(t0, t1);
+}
+
+// Пересечение отрезка pq с невырожденным треугольником t с нормалью normal
+inline bool segmentIntersectsTriangle(const Vec& p, const Vec& q, const Vec* t, const Vec& normal) {
+    const double dp = dot(normal, sub(p, t[0])), dq = dot(normal, sub(q, t[0]));
+    if ((dp > 0 && dq > 0) || (dp < 0 && dq < 0)) return false;
+    if (dp == 0 && dq == 0) {
+        const auto [i, j] = projectionAxes(normal);
+        for (int e = 0; e < 3; ++e) {
+            if (segmentsIntersect2D(p, q, t[e], t[(e + 1) % 3], i, j)) return true;
+        }
+        return pointInTriangle2D(p, t, i, j);
+    }
+    // Точка пересечения прямой с плоскостью и её положение относительно рёбер
+    const double s = dp / (dp - dq);
+    const Vec x{ p.x + (q.x - p.x) * s, p.y + (q.y - p.y) * s, p.z + (q.z - p.z) * s };
+    const auto [i, j] = projectionAxes(normal);
+    return pointInTriangle2D(x, t, i, j);
+}
+
+// Самый длинный отрезок вырожденного треугольника (или точка)
+inline std::pair<Vec, Vec> longestEdge(const Vec* t) {
+    int best = 0;
+    double length = -1.0;
+    for (int e = 0; e < 3; ++e) {
+        const Vec d = sub(t[(e + 1) % 3], t[e]);
+        if (dot(d, d) > length) {
+            length = dot(d, d);
+            best = e;
+        }
+    }
+    return { t[best], t[(best + 1) % 3] };
+}
+
+// Пересечение отрезков в пространстве: компланарны и пересекаются в проекции
+inline bool segmentsIntersect3D(const Vec& p, const Vec& q, const Vec& r, const Vec& s) {
+    const Vec u = sub(q, p), v = sub(s, r);
+    const Vec normal = cross(u, v);
+    if (dot(normal, sub(r, p)) != 0) return false;
+    if (!isZero(normal)) {
+        const auto [i, j] = projectionAxes(normal);
+        return segmentsIntersect2D(p, q, r, s, i, j);
+    }
+    // Параллельные (или точки): пересекаются, если лежат на одной прямой и проекции перекрываются
+    const Vec along = !isZero(u) ? u : v;
+    if (isZero(along)) return p.x == r.x && p.y == r.y && p.z == r.z;
+    if (!isZero(cross(along, sub(r, p))) || !isZero(cross(along, sub(s, p)))) return false;
+    const double p0 = dot(p, along), p1 = dot(q, along), r0 = dot(r, along), r1 = dot(s, along);
+    return std::max(std::min(p0, p1), std::min(r0, r1)) <= std::min(std::max(p0, p1), std::max(r0, r1));
+}
+
+}
+
+inline bool trianglesIntersect(const Triangle3D& first, const Triangle3D& second) {
+    using namespace triangle_intersection;
+    const Vec a[3] = { toVec(first.a), toVec(first.b), toVec(first.c) };
+    const Vec b[3] = { toVec(second.a), toVec(second.b), toVec(second.c) };
+    const Vec na = cross(sub(a[1], a[0]), sub(a[2], a[0]));
+    const Vec nb = cross(sub(b[1], b[0]), sub(b[2], b[0]));
+
+    if (isZero(na) || isZero(nb)) {
+        if (!isZero(nb)) {
+            const auto [p, q] = longestEdge(a);
+            return segmentIntersectsTriangle(p, q, b, nb);
+        }
+        if (!isZero(na)) {
+            const auto [p, q] = longestEdge(b);
+            return segmentIntersectsTriangle(p, q, a, na);
+        }
+        const auto [p, q] = longestEdge(a);
+        const auto [r, s] = longestEdge(b);
+        return segmentsIntersect3D(p, q, r, s);
+    }
+
+    // Вершины a относительно плоскости b
+    double da[3];
+    planeDistances(a, nb, b[0], da);
+    if ((da[0] > 0 && da[1] > 0 && da[2] > 0) || (da[0] < 0 && da[1] < 0 && da[2] < 0)) return false;
+    if (da[0] == 0 && da[1] == 0 && da[2] == 0) return coplanarIntersect(a, b, nb);
+
+    double db[3];
+    planeDistances(b, na, a[0], db);
+    if ((db[0] > 0 && db[1] > 0 && db[2] > 0) || (db[0] < 0 && db[1] < 0 && db[2] < 0)) return false;
+    if (db[0] == 0 && db[1] == 0 && db[2] == 0) return coplanarIntersect(a, b, na);
+
+    // Проекции на прямую пересечения плоскостей — по её наибольшей координате
+    const Vec direction = cross(na, nb);
+    const double ax = std::fabs(direction.x), ay = std::fabs(direction.y), az = std::fabs(direction.z);
+    const int axis = ax >= ay && ax >= az ? 0 : ay >= az ? 1 : 2;
+    const double pa[3] = { a[0][axis], a[1][axis], a[2][axis] };
+    const double pb[3] = { b[0][axis], b[1][axis], b[2][axis] };
+
+    double a0, a1, b0, b1;
+    interval(pa, da, a0, a1);
+    interval(pb, db, b0, b1);
+    const double tolerance = epsilon * std::max({ std::fabs(a0), std::fabs(a1), std::fabs(b0), std::fabs(b1) });
+    return a0 <= b1 + tolerance && b0 <= a1 + tolerance;
+}
+
+// Пересечение соседних треугольников сетки помимо их общей вершины или ребра (общими считаются
+// вершины с равными координатами). Треугольники с общей вершиной v пересекаются где-то ещё, только
+// если ребро одного, противолежащее v, задевает другой. Треугольники с общим ребром в разных
+// плоскостях встречаются лишь по нему; в одной плоскости они накладываются, если третьи вершины
+// лежат по одну сторону ребра. Совпадающие треугольники пересекаются; вырожденные соседи — нет.
+inline bool meshTrianglesIntersect(const Triangle3D& first, const Triangle3D& second) {
+    using namespace triangle_intersection;
+    const Point3D* cornersA[3] = { &first.a, &first.b, &first.c };
+    const Point3D* cornersB[3] = { &second.a, &second.b, &second.c };
+    int sharedA[3], sharedB[3];
+    int shared = 0;
+    for (int i = 0; i < 3; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            if (*cornersA[i] == *cornersB[k]) {
+                sharedA[shared] = i;
+                sharedB[shared] = k;
+                ++shared;
+                break;
+            }
+        }
+    }
+    if (shared == 0) return trianglesIntersect(first, second);
+    if (shared == 3) return true;
+
+    const Vec a[3] = { toVec(first.a), toVec(first.b), toVec(first.c) };
+    const Vec b[3] = { toVec(second.a), toVec(second.b), toVec(second.c) };
+    const Vec na = cross(sub(a[1], a[0]), sub(a[2], a[0]));
+    const Vec nb = cross(sub(b[1], b[0]), sub(b[2], b[0]));
+    if (isZero(na) || isZero(nb)) return false;
+
+    if (shared == 1) {
+        const int i = sharedA[0], k = sharedB[0];
+        return segmentIntersectsTriangle(a[(i + 1) % 3], a[(i + 2) % 3], b, nb) ||
+               segmentIntersectsTriangle(b[(k + 1) % 3], b[(k + 2) % 3], a, na);
+    }
+
+    // Общее ребро: третьи вершины и проверка компланарности с тем же допуском, что в trianglesIntersect
+    const Vec& oppositeA = a[3 - sharedA[0] - sharedA[1]];
+    const Vec& oppositeB = b[3 - sharedB[0] - sharedB[1]];
+    const Vec& edgeStart = a[sharedA[0]];
+    const Vec& edgeEnd = a[sharedA[1]];
+    const Vec offset = sub(oppositeB, edgeStart);
+    if (std::fabs(dot(na, offset)) > epsilon * length(na) * length(offset)) return false;
+
+    const auto [u, v] = projectionAxes(na);
+    const double sideA = orient2D(edgeStart, edgeEnd, oppositeA, u, v);
+    const double sideB = orient2D(edgeStart, edgeEnd, oppositeB, u, v);
+    return (sideA > 0 && sideB > 0) || (sideA < 0 && sideB < 0);
+}
+
+#endif //TRIANGLEINTERSECTION_H
@@ -0,0 +1,120 @@
+#ifndef BOX_H
+#define BOX_H
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+
+#include "../geometry/Triangle3D.h"
+
+// Точка и прямоугольник произвольной размерности для обобщённого RTree (RTree.h).
+// MBR — тот же прямоугольник, закреплённый за 3D и float.
+template <size_t Dim, typename Scalar>
+using Point = std::array<Scalar, Dim>;
+
+template <size_t Dim, typename Scalar>
+struct Box {
+    Point<Dim, Scalar> min;
+    Point<Dim, Scalar> max;
+
+    // Как у MBR, по умолчанию прямоугольник пуст: ничего не пересекает и нейтрален для expandToInclude
+    Box() {
+        min.fill(std::numeric_limits<Scalar>::max());
+        max.fill(std::numeric_limits<Scalar>::lowest());
+    }
+
+    Box(const Point<Dim, Scalar>& min, const Point<Dim, Scalar>& max) : min(min), max(max) {}
+
+    bool operator==(const Box& other) const = default;
+
+    Scalar volume() const {
+        Scalar result = 1;
+        for (size_t d = 0; d < Dim; ++d) {
+            result *= max[d] - min[d];
+        }
+        return result;
+    }
+
+    // Сумма рёбер: в отличие от объёма не вырождается в 0 у плоских прямоугольников
+    Scalar margin() const {
+        Scalar result = 0;
+        for (size_t d = 0; d < Dim; ++d) {
+            result += max[d] - min[d];
+        }
+        return result;
+    }
+
+    Scalar overlap(const Box& other) const {
+        Scalar result = 1;
+        for (size_t d = 0; d < Dim; ++d) {
+            const Scalar extent = std::min(max[d], other.max[d]) - std::max(min[d], other.min[d]);
+            if (extent <= 0) return 0;
+            result *= extent;
+        }
+        return result;
+    }
+
+    Scalar center(size_t axis) const {
+        return (min[axis] + max[axis]) / 2;
+    }
+
+    static Box combine(const Box& a, const Box& b) {
+        Box result = a;
+        result.expandToInclude(b);
+        return result;
+    }
+
+    Box* expandToInclude(const Box& other) {
+        for (size_t d = 0; d < Dim; ++d) {
+            min[d] = std::min(min[d], other.min[d]);
+            max[d] = std::max(max[d], other.max[d]);
+        }
+        return this;
+    }
+
+    bool contains(const Box& other) const {
+        for (size_t d = 0; d < Dim; ++d) {
+            if (other.min[d] < min[d] || other.max[d] > max[d]) return false;
+        }
+        return true;
+    }
+
+    bool intersects(const Box& other) const {
+        for (size_t d = 0; d < Dim; ++d) {
+            if (other.min[d] > max[d] || other.max[d] < min[d]) return false;
+        }
+        return true;
+    }
+};
+
+// Прямоугольник записи дерева. Для своих типов записей достаточно добавить специализацию
+// со статической функцией get(const Payload&).
+template <typename Payload, size_t Dim, typename Scalar>
+struct BoxOf;
+
+template <size_t Dim, typename Scalar>
+struct BoxOf<Box<Dim, Scalar>, Dim, Scalar> {
+    static Box<Dim, Scalar> get(const Box<Dim, Scalar>& box) {
+        return box;
+    }
+};
+
+template <size_t Dim, typename Scalar>
+struct BoxOf<Point<Dim, Scalar>, Dim, Scalar> {
+    static Box<Dim, Scalar> get(const Point<Dim, Scalar>& point) {
+        return { point, point };
+    }
+};
+
+template <typename Scalar>
+struct BoxOf<Triangle3D, 3, Scalar> {
+    static Box<3, Scalar> get(const Triangle3D& t) {
+        Box<3, Scalar> box;
+        for (const Point3D& p : { t.a, t.b, t.c }) {
+            box.expandToInclude({ { Scalar(p.x), Scalar(p.y), Scalar(p.z) }, { Scalar(p.x), Scalar(p.y), Scalar(p.z) } });
+        }
+        return box;
+    }
+};
+
+#endif //BOX_H
@@ -0,0 +1,75 @@
+#ifndef BULKLOAD_H
+#define BULKLOAD_H
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Общее для упаковки снизу вверх: RTree3D::buildTree, обобщённый RTree и RTreeFileBuilder
+// режут упорядоченные записи на узлы одинаково.
+namespace bulk {
+
+// Группы уровня из count записей: все по maxChildren, кроме последней; если она меньше
+// minChildren, недостающее берётся из предпоследней
+struct GroupShape {
+    std::uint64_t count;
+    std::uint64_t groups;
+    std::uint64_t borrow = 0;
+    size_t maxChildren;
+
+    GroupShape(std::uint64_t count, size_t minChildren, size_t maxChildren)
+        : count(count), groups((count + maxChildren - 1) / maxChildren), maxChildren(maxChildren) {
+        if (groups <= 1) return;
+        const std::uint64_t last = count - (groups - 1) * maxChildren;
+        if (last < minChildren) borrow = minChildren - last;
+    }
+
+    std::uint64_t groupSize(std::uint64_t g) const {
+        if (g + 1 == groups) return count - (groups - 1) * maxChildren + borrow;
+        if (g + 2 == groups) return maxChildren - borrow;
+        return maxChildren;
+    }
+};
+
+// Границы групп: группа g — записи [bounds[g], bounds[g + 1])
+inline std::vector<size_t> groupBounds(size_t count, size_t minChildren, size_t maxChildren) {
+    const GroupShape shape(count, minChildren, maxChildren);
+    std::vector<size_t> bounds(shape.groups + 1, 0);
+    for (size_t g = 0; g < shape.groups; ++g) {
+        bounds[g + 1] = bounds[g] + shape.groupSize(g);
+    }
+    return bounds;
+}
+
+// Sort-Tile-Recursive по dims осям, начиная с axis; coordinate(entry, axis) — координата центра.
+// Число узлов делим на S^(dims - axis) плиток: S слоёв по текущей оси, каждый слой — целое
+// число полных узлов
+template <typename Entry, typename Coordinate>
+void sortTileRecursive(std::span<Entry> entries, size_t dims, size_t maxChildren, const Coordinate& coordinate,
+                       size_t axis = 0) {
+    std::sort(entries.begin(), entries.end(), [&](const Entry& e1, const Entry& e2) {
+        return coordinate(e1, axis) < coordinate(e2, axis);
+    });
+    if (axis + 1 >= dims) return;
+
+    const size_t nodeCount = (entries.size() + maxChildren - 1) / maxChildren;
+    const size_t remainingAxes = dims - axis;
+    size_t slabs = 1;
+    auto power = [](size_t base, size_t exp) {
+        size_t result = 1;
+        while (exp-- > 0) result *= base;
+        return result;
+    };
+    while (power(slabs, remainingAxes) < nodeCount) ++slabs;
+
+    const size_t slabSize = (nodeCount + slabs - 1) / slabs * maxChildren;
+    for (size_t first = 0; first < entries.size(); first += slabSize) {
+        sortTileRecursive(entries.subspan(first, std::min(slabSize, entries.size() - first)), dims, maxChildren,
+                          coordinate, axis + 1);
+    }
+}
+
+} // namespace bulk
+
+#endif //BULKLOAD_H
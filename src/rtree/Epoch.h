@@ -0,0 +1,84 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Эпохи для отложенного освобождения узлов (epoch-based reclamation, K. Fraser, 2004).
+// Читатель на время обхода отмечается в счётчике чётности текущей эпохи. Писатель
+// продвигает эпоху, только когда не осталось читателей предыдущей, поэтому узел,
+// снятый с публикации в эпоху e, можно переиспользовать начиная с эпохи e + 2.
+// Счётчики разнесены по потокам и кэш-линиям, чтобы читатели не мешали друг другу.
+class EpochManager {
+    struct alignas(64) Counter {
+        std::atomic<std::int64_t> value{ 0 };
+    };
+
+public:
+    static constexpr size_t SHARDS = 64;
+
+    // Отметка читателя; копия удерживает ту же эпоху.
+    class Guard {
+        std::atomic<std::int64_t>* counter = nullptr;
+
+    public:
+        Guard() = default;
+
+        explicit Guard(std::atomic<std::int64_t>* counter) : counter(counter) {}
+
+        Guard(const Guard& other) : counter(other.counter) {
+            if (counter) counter->fetch_add(1);
+        }
+
+        Guard(Guard&& other) noexcept : counter(std::exchange(other.counter, nullptr)) {}
+
+        Guard& operator=(Guard other) noexcept {
+            std::swap(counter, other.counter);
+            return *this;
+        }
+
+        ~Guard() {
+            if (counter) counter->fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    Guard pin() const {
+        const size_t shard = threadShard();
+        for (;;) {
+            const std::uint64_t e = epoch.load();
+            auto& counter = readers[e & 1][shard].value;
+            counter.fetch_add(1);
+            // Эпоха могла смениться между чтением и отметкой — тогда отметка не в той чётности
+            if (epoch.load() == e) return Guard(&counter);
+            counter.fetch_sub(1);
+        }
+    }
+
+    std::uint64_t current() const {
+        return epoch.load();
+    }
+
+    // Продвигает эпоху, если читателей предыдущей эпохи не осталось. Вызывается одним писателем.
+    bool tryAdvance() {
+        const std::uint64_t e = epoch.load();
+        for (const auto& counter : readers[(e + 1) & 1]) {
+            if (counter.value.load() != 0) return false;
+        }
+        epoch.store(e + 1);
+        return true;
+    }
+
+private:
+    std::atomic<std::uint64_t> epoch{ 0 };
+    mutable std::array<std::array<Counter, SHARDS>, 2> readers;
+
+    static size_t threadShard() {
+        static std::atomic<size_t> nextShard{ 0 };
+        thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return shard;
+    }
+};
+
+#endif //EPOCH_H
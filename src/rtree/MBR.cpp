@@ -1,5 +1,7 @@
 #include "MBR.h"
 
+#include <algorithm>
+
 MBR::MBR(const Triangle3D& triangle) {
     // Инициализируем минимальные и максимальные значения для каждой оси
     min.x = std::min({triangle.a.x, triangle.b.x, triangle.c.x});
@@ -11,35 +13,38 @@ MBR::MBR(const Triangle3D& triangle) {
     max.z = std::max({triangle.a.z, triangle.b.z, triangle.c.z});
 }
 
-MBR::MBR(const std::vector<Triangle3D>& triangles) {
-    std::vector<float> xs, ys, zs;
-
+MBR::MBR(const std::vector<Triangle3D>& triangles) : MBR() {
     for (const auto& tri : triangles) {
-        xs.push_back(tri.a.x);
-        xs.push_back(tri.b.x);
-        xs.push_back(tri.c.x);
+        expandToInclude(tri);
+    }
+}
 
-        ys.push_back(tri.a.y);
-        ys.push_back(tri.b.y);
-        ys.push_back(tri.c.y);
+float MBR::volume() const {
+    return (max.x - min.x) * (max.y - min.y) * (max.z - min.z);
+}
 
-        zs.push_back(tri.a.z);
-        zs.push_back(tri.b.z);
-        zs.push_back(tri.c.z);
-    }
+float MBR::area() const {
+    float dx = max.x - min.x;
+    float dy = max.y - min.y;
+    float dz = max.z - min.z;
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
 
-    min.x = *std::min_element(xs.begin(), xs.end());
-    max.x = *std::max_element(xs.begin(), xs.end());
+float MBR::margin() const {
+    return (max.x - min.x) + (max.y - min.y) + (max.z - min.z);
+}
 
-    min.y = *std::min_element(ys.begin(), ys.end());
-    max.y = *std::max_element(ys.begin(), ys.end());
+float MBR::overlap(const MBR& other) const {
+    if (!intersects(other)) return 0.0f;
 
-    min.z = *std::min_element(zs.begin(), zs.end());
-    max.z = *std::max_element(zs.begin(), zs.end());
+    MBR common;
+    common.min = { std::max(min.x, other.min.x), std::max(min.y, other.min.y), std::max(min.z, other.min.z) };
+    common.max = { std::min(max.x, other.max.x), std::min(max.y, other.max.y), std::min(max.z, other.max.z) };
+    return common.area();
 }
 
-float MBR::volume() const {
-    return (max.x - min.x) * (max.y - min.y) * (max.z - min.z);
+Point3D MBR::center() const {
+    return { (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f };
 }
 
 MBR MBR::combine(const MBR& a, const MBR& b) {
@@ -56,6 +61,13 @@ MBR MBR::combine(const MBR& a, const MBR& b) {
     return result;
 }
 
+MBR MBR::inflated(float margin) const {
+    MBR result;
+    result.min = { min.x - margin, min.y - margin, min.z - margin };
+    result.max = { max.x + margin, max.y + margin, max.z + margin };
+    return result;
+}
+
 MBR* MBR::expandToInclude(const MBR& other) {
     min.x = std::min(min.x, other.min.x);
     min.y = std::min(min.y, other.min.y);
@@ -106,3 +118,10 @@ bool MBR::intersects(const MBR& other) const {
            (min.y <= other.max.y && max.y >= other.min.y) &&
            (min.z <= other.max.z && max.z >= other.min.z);
 }
+
+float MBR::squaredDistance(const Point3D& p) const {
+    float dx = std::max({ min.x - p.x, 0.0f, p.x - max.x });
+    float dy = std::max({ min.y - p.y, 0.0f, p.y - max.y });
+    float dz = std::max({ min.z - p.z, 0.0f, p.z - max.z });
+    return dx * dx + dy * dy + dz * dz;
+}
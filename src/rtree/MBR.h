@@ -22,8 +22,20 @@ struct MBR {
 
     float volume() const;
 
+    // Площадь поверхности и сумма рёбер: в отличие от объёма не вырождаются в 0 у плоских MBR
+    float area() const;
+
+    float margin() const;
+
+    float overlap(const MBR& other) const;
+
+    Point3D center() const;
+
     static MBR combine(const MBR& a, const MBR& b);
 
+    // MBR, расширенный на margin по каждой оси в обе стороны
+    MBR inflated(float margin) const;
+
     MBR* expandToInclude(const MBR& other);
 
     MBR* expandToInclude(const Triangle3D &obj);
@@ -34,6 +46,9 @@ struct MBR {
     bool contains(const MBR& other) const;
 
     bool intersects(const MBR& other) const;
+
+    // Квадрат расстояния от точки до ближайшей точки MBR (0, если точка внутри)
+    float squaredDistance(const Point3D& p) const;
 };
 
 #endif //MBR_H
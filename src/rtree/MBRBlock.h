@@ -0,0 +1,292 @@
+#ifndef MBRBLOCK_H
+#define MBRBLOCK_H
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "MBR.h"
+#include "../geometry/Frustum.h"
+
+// Невладеющее представление прямоугольников в виде структуры массивов: позволяет
+// проверять запрос сразу против пачки записей, где бы ни лежали массивы.
+// Ядра читают целые пачки по WIDTH, поэтому за последней записью должно быть
+// ещё WIDTH - 1 доступных значений.
+struct MBRView {
+    // Ширина самого широкого векторного пути
+    static constexpr size_t WIDTH = 8;
+
+    const float* minX;
+    const float* minY;
+    const float* minZ;
+    const float* maxX;
+    const float* maxY;
+    const float* maxZ;
+
+    // Битовая маска записей [first, first + count), пересекающих query; count <= 64.
+    std::uint64_t intersectMask(size_t first, size_t count, const MBR& query) const;
+
+    // Маска записей, которые луч origin + t / invDir пересекает при 0 <= t <= tMax (slab-тест);
+    // в tNear[i] пишется t входа в i-й MBR. tNear должен вмещать count, округлённое до WIDTH.
+    std::uint64_t rayMask(size_t first, size_t count, const Point3D& origin, const Point3D& invDir,
+                          float tMax, float* tNear) const;
+
+    // Положение записей [first, first + count) относительно плоскости; count <= 64.
+    // В outside — записи целиком снаружи, в inside — целиком по внутреннюю сторону.
+    void planeMasks(size_t first, size_t count, const Plane& plane, std::uint64_t& outside,
+                    std::uint64_t& inside) const;
+};
+
+// Владеющий набор SoA-массивов. Слоты узлов выравниваются по WIDTH,
+// чтобы ядро могло читать целые пачки без отдельной обработки хвоста.
+struct MBRBlock {
+    static constexpr size_t WIDTH = MBRView::WIDTH;
+
+    std::pmr::vector<float> minX, minY, minZ;
+    std::pmr::vector<float> maxX, maxY, maxZ;
+
+    explicit MBRBlock(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : minX(resource), minY(resource), minZ(resource), maxX(resource), maxY(resource), maxZ(resource) {}
+
+    size_t size() const {
+        return minX.size();
+    }
+
+    void resize(size_t count) {
+        const MBR empty;
+        minX.resize(count, empty.min.x);
+        minY.resize(count, empty.min.y);
+        minZ.resize(count, empty.min.z);
+        maxX.resize(count, empty.max.x);
+        maxY.resize(count, empty.max.y);
+        maxZ.resize(count, empty.max.z);
+    }
+
+    void reserve(size_t count) {
+        for (auto* v : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ }) {
+            v->reserve(count);
+        }
+    }
+
+    void clear() {
+        resize(0);
+    }
+
+    void set(size_t i, const MBR& box) {
+        minX[i] = box.min.x;
+        minY[i] = box.min.y;
+        minZ[i] = box.min.z;
+        maxX[i] = box.max.x;
+        maxY[i] = box.max.y;
+        maxZ[i] = box.max.z;
+    }
+
+    MBR get(size_t i) const {
+        MBR box;
+        box.min = { minX[i], minY[i], minZ[i] };
+        box.max = { maxX[i], maxY[i], maxZ[i] };
+        return box;
+    }
+
+    void copy(size_t to, size_t from) {
+        minX[to] = minX[from];
+        minY[to] = minY[from];
+        minZ[to] = minZ[from];
+        maxX[to] = maxX[from];
+        maxY[to] = maxY[from];
+        maxZ[to] = maxZ[from];
+    }
+
+    MBRView view() const {
+        return { minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data() };
+    }
+
+    std::uint64_t intersectMask(size_t first, size_t count, const MBR& query) const {
+        return view().intersectMask(first, count, query);
+    }
+
+    std::uint64_t rayMask(size_t first, size_t count, const Point3D& origin, const Point3D& invDir,
+                          float tMax, float* tNear) const {
+        return view().rayMask(first, count, origin, invDir, tMax, tNear);
+    }
+
+    void planeMasks(size_t first, size_t count, const Plane& plane, std::uint64_t& outside,
+                    std::uint64_t& inside) const {
+        view().planeMasks(first, count, plane, outside, inside);
+    }
+};
+
+inline std::uint64_t MBRView::intersectMask(size_t first, size_t count, const MBR& query) const {
+    std::uint64_t mask = 0;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256 qMinX = _mm256_set1_ps(query.min.x), qMaxX = _mm256_set1_ps(query.max.x);
+    const __m256 qMinY = _mm256_set1_ps(query.min.y), qMaxY = _mm256_set1_ps(query.max.y);
+    const __m256 qMinZ = _mm256_set1_ps(query.min.z), qMaxZ = _mm256_set1_ps(query.max.z);
+    for (; i < count; i += 8) {
+        const size_t j = first + i;
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(minX + j), qMaxX, _CMP_LE_OQ),
+                                   _mm256_cmp_ps(_mm256_loadu_ps(maxX + j), qMinX, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_loadu_ps(minY + j), qMaxY, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_loadu_ps(maxY + j), qMinY, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_loadu_ps(minZ + j), qMaxZ, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_loadu_ps(maxZ + j), qMinZ, _CMP_GE_OQ));
+        mask |= static_cast<std::uint64_t>(_mm256_movemask_ps(hit)) << i;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 qMinX = _mm_set1_ps(query.min.x), qMaxX = _mm_set1_ps(query.max.x);
+    const __m128 qMinY = _mm_set1_ps(query.min.y), qMaxY = _mm_set1_ps(query.max.y);
+    const __m128 qMinZ = _mm_set1_ps(query.min.z), qMaxZ = _mm_set1_ps(query.max.z);
+    for (; i < count; i += 4) {
+        const size_t j = first + i;
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(minX + j), qMaxX),
+                                _mm_cmpge_ps(_mm_loadu_ps(maxX + j), qMinX));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_loadu_ps(minY + j), qMaxY));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(_mm_loadu_ps(maxY + j), qMinY));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_loadu_ps(minZ + j), qMaxZ));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(_mm_loadu_ps(maxZ + j), qMinZ));
+        mask |= static_cast<std::uint64_t>(_mm_movemask_ps(hit)) << i;
+    }
+#else
+    for (; i < count; ++i) {
+        const size_t j = first + i;
+        const bool hit = minX[j] <= query.max.x && maxX[j] >= query.min.x &&
+                         minY[j] <= query.max.y && maxY[j] >= query.min.y &&
+                         minZ[j] <= query.max.z && maxZ[j] >= query.min.z;
+        mask |= static_cast<std::uint64_t>(hit) << i;
+    }
+#endif
+
+    // Отбрасываем биты выравнивающего хвоста
+    return count < 64 ? mask & ((std::uint64_t(1) << count) - 1) : mask;
+}
+
+inline std::uint64_t MBRView::rayMask(size_t first, size_t count, const Point3D& origin, const Point3D& invDir,
+                                       float tMax, float* tNear) const {
+    std::uint64_t mask = 0;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+    const __m256 ix = _mm256_set1_ps(invDir.x), iy = _mm256_set1_ps(invDir.y), iz = _mm256_set1_ps(invDir.z);
+    const __m256 limit = _mm256_set1_ps(tMax);
+    for (; i < count; i += 8) {
+        const size_t j = first + i;
+        const __m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(minX + j), ox), ix);
+        const __m256 x2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(maxX + j), ox), ix);
+        const __m256 y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(minY + j), oy), iy);
+        const __m256 y2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(maxY + j), oy), iy);
+        const __m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(minZ + j), oz), iz);
+        const __m256 z2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(maxZ + j), oz), iz);
+        __m256 enter = _mm256_max_ps(_mm256_min_ps(x1, x2), _mm256_setzero_ps());
+        enter = _mm256_max_ps(enter, _mm256_min_ps(y1, y2));
+        enter = _mm256_max_ps(enter, _mm256_min_ps(z1, z2));
+        __m256 exit = _mm256_min_ps(_mm256_max_ps(x1, x2), limit);
+        exit = _mm256_min_ps(exit, _mm256_max_ps(y1, y2));
+        exit = _mm256_min_ps(exit, _mm256_max_ps(z1, z2));
+        _mm256_storeu_ps(tNear + i, enter);
+        mask |= static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ))) << i;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+    const __m128 ix = _mm_set1_ps(invDir.x), iy = _mm_set1_ps(invDir.y), iz = _mm_set1_ps(invDir.z);
+    const __m128 limit = _mm_set1_ps(tMax);
+    for (; i < count; i += 4) {
+        const size_t j = first + i;
+        const __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minX + j), ox), ix);
+        const __m128 x2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxX + j), ox), ix);
+        const __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minY + j), oy), iy);
+        const __m128 y2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxY + j), oy), iy);
+        const __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minZ + j), oz), iz);
+        const __m128 z2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxZ + j), oz), iz);
+        __m128 enter = _mm_max_ps(_mm_min_ps(x1, x2), _mm_setzero_ps());
+        enter = _mm_max_ps(enter, _mm_min_ps(y1, y2));
+        enter = _mm_max_ps(enter, _mm_min_ps(z1, z2));
+        __m128 exit = _mm_min_ps(_mm_max_ps(x1, x2), limit);
+        exit = _mm_min_ps(exit, _mm_max_ps(y1, y2));
+        exit = _mm_min_ps(exit, _mm_max_ps(z1, z2));
+        _mm_storeu_ps(tNear + i, enter);
+        mask |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_cmple_ps(enter, exit))) << i;
+    }
+#else
+    for (; i < count; ++i) {
+        const size_t j = first + i;
+        const float x1 = (minX[j] - origin.x) * invDir.x, x2 = (maxX[j] - origin.x) * invDir.x;
+        const float y1 = (minY[j] - origin.y) * invDir.y, y2 = (maxY[j] - origin.y) * invDir.y;
+        const float z1 = (minZ[j] - origin.z) * invDir.z, z2 = (maxZ[j] - origin.z) * invDir.z;
+        const float enter = std::max({ std::min(x1, x2), std::min(y1, y2), std::min(z1, z2), 0.0f });
+        const float exit = std::min({ std::max(x1, x2), std::max(y1, y2), std::max(z1, z2), tMax });
+        tNear[i] = enter;
+        mask |= static_cast<std::uint64_t>(enter <= exit) << i;
+    }
+#endif
+
+    return count < 64 ? mask & ((std::uint64_t(1) << count) - 1) : mask;
+}
+
+inline void MBRView::planeMasks(size_t first, size_t count, const Plane& plane, std::uint64_t& outside,
+                                std::uint64_t& inside) const {
+    // Ближняя к внутренней стороне вершина (near) и дальняя (far) выбираются по знакам нормали
+    // один раз на плоскость, дальше — только умножения и сложения по столбцам. Порядок сложений
+    // тот же, что в Plane::distance, поэтому результат совпадает с classifyBox
+    const Point3D& n = plane.normal;
+    const float* nearX = n.x >= 0.0f ? maxX : minX;
+    const float* nearY = n.y >= 0.0f ? maxY : minY;
+    const float* nearZ = n.z >= 0.0f ? maxZ : minZ;
+    const float* farX = n.x >= 0.0f ? minX : maxX;
+    const float* farY = n.y >= 0.0f ? minY : maxY;
+    const float* farZ = n.z >= 0.0f ? minZ : maxZ;
+    std::uint64_t out = 0, in = 0;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256 nx = _mm256_set1_ps(n.x), ny = _mm256_set1_ps(n.y), nz = _mm256_set1_ps(n.z);
+    const __m256 d = _mm256_set1_ps(plane.d), zero = _mm256_setzero_ps();
+    for (; i < count; i += 8) {
+        const size_t j = first + i;
+        __m256 dn = _mm256_add_ps(_mm256_mul_ps(nx, _mm256_loadu_ps(nearX + j)),
+                                  _mm256_mul_ps(ny, _mm256_loadu_ps(nearY + j)));
+        dn = _mm256_add_ps(_mm256_add_ps(dn, _mm256_mul_ps(nz, _mm256_loadu_ps(nearZ + j))), d);
+        __m256 df = _mm256_add_ps(_mm256_mul_ps(nx, _mm256_loadu_ps(farX + j)),
+                                  _mm256_mul_ps(ny, _mm256_loadu_ps(farY + j)));
+        df = _mm256_add_ps(_mm256_add_ps(df, _mm256_mul_ps(nz, _mm256_loadu_ps(farZ + j))), d);
+        out |= static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(dn, zero, _CMP_LT_OQ))) << i;
+        in |= static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_cmp_ps(df, zero, _CMP_GE_OQ))) << i;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 nx = _mm_set1_ps(n.x), ny = _mm_set1_ps(n.y), nz = _mm_set1_ps(n.z);
+    const __m128 d = _mm_set1_ps(plane.d), zero = _mm_setzero_ps();
+    for (; i < count; i += 4) {
+        const size_t j = first + i;
+        __m128 dn = _mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(nearX + j)),
+                               _mm_mul_ps(ny, _mm_loadu_ps(nearY + j)));
+        dn = _mm_add_ps(_mm_add_ps(dn, _mm_mul_ps(nz, _mm_loadu_ps(nearZ + j))), d);
+        __m128 df = _mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(farX + j)),
+                               _mm_mul_ps(ny, _mm_loadu_ps(farY + j)));
+        df = _mm_add_ps(_mm_add_ps(df, _mm_mul_ps(nz, _mm_loadu_ps(farZ + j))), d);
+        out |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_cmplt_ps(dn, zero))) << i;
+        in |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_cmpge_ps(df, zero))) << i;
+    }
+#else
+    for (; i < count; ++i) {
+        const size_t j = first + i;
+        const float dn = n.x * nearX[j] + n.y * nearY[j] + n.z * nearZ[j] + plane.d;
+        const float df = n.x * farX[j] + n.y * farY[j] + n.z * farZ[j] + plane.d;
+        out |= static_cast<std::uint64_t>(dn < 0.0f) << i;
+        in |= static_cast<std::uint64_t>(df >= 0.0f) << i;
+    }
+#endif
+
+    const std::uint64_t valid = count < 64 ? (std::uint64_t(1) << count) - 1 : ~std::uint64_t(0);
+    outside = out & valid;
+    inside = in & valid;
+}
+
+#endif //MBRBLOCK_H
@@ -0,0 +1,174 @@
+#include "MappedRTree.h"
+
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RTREE_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedRTree::MappedRTree(MappedRTree&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedRTree& MappedRTree::operator=(MappedRTree&& other) noexcept {
+    if (this == &other) return *this;
+    close();
+    data = std::exchange(other.data, nullptr);
+    length = std::exchange(other.length, 0);
+    mapped = std::exchange(other.mapped, false);
+    buffer = std::move(other.buffer);
+    header = std::exchange(other.header, nullptr);
+    nodes = other.nodes;
+    triangles = other.triangles;
+    nodeBoxes = other.nodeBoxes;
+    triangleBoxes = other.triangleBoxes;
+    return *this;
+}
+
+MappedRTree::~MappedRTree() {
+    close();
+}
+
+bool MappedRTree::open(const std::string& filename, bool verifyChecksum) {
+    close();
+#ifdef RTREE_HAS_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(packed::Header))) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    // Отображение держит файл само, дескриптор больше не нужен
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+    // Запросы обращаются к узлам вразброс; упреждающее чтение только засоряет кэш
+    madvise(view, static_cast<size_t>(info.st_size), MADV_RANDOM);
+    data = static_cast<const std::byte*>(view);
+    length = static_cast<size_t>(info.st_size);
+    mapped = true;
+#else
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return false;
+    buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()))) {
+        buffer.clear();
+        return false;
+    }
+    data = buffer.data();
+    length = buffer.size();
+#endif
+
+    if (!validate(verifyChecksum)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedRTree::close() {
+#ifdef RTREE_HAS_MMAP
+    if (mapped) munmap(const_cast<std::byte*>(data), length);
+#endif
+    data = nullptr;
+    length = 0;
+    mapped = false;
+    buffer.clear();
+    header = nullptr;
+    nodes = nullptr;
+    triangles = nullptr;
+}
+
+bool MappedRTree::validate(bool verifyChecksum) {
+    if (length < sizeof(packed::Header)) return false;
+    const auto* h = reinterpret_cast<const packed::Header*>(data);
+    if (std::memcmp(h->magic, packed::MAGIC, sizeof(packed::MAGIC)) != 0) return false;
+    if (h->byteOrder != packed::ENDIAN_TAG || h->version != packed::VERSION) return false;
+    if (h->headerChecksum != packed::headerChecksum(*h)) return false;
+
+    if (h->boxBits != 32 && h->boxBits != 16 && h->boxBits != 8) return false;
+    if (h->fileSize != length || h->nodeCount == 0 || h->leafBegin >= h->nodeCount ||
+        h->nodeCount > UINT32_MAX || h->triangleCount > UINT32_MAX || h->height > packed::MAX_HEIGHT) {
+        return false;
+    }
+
+    // Секции должны лежать по порядку, без перекрытий и в пределах файла, иначе обход по
+    // повреждённым смещениям вышел бы за отображение. Смещения из файла сравниваются с length
+    // до сложения, чтобы подобранное смещение не переполнило сумму. Размеры не переполняются:
+    // числа записей уже не больше UINT32_MAX
+    const std::uint64_t sections[][2] = {
+        { h->nodesOffset, h->nodeCount * sizeof(packed::PackedNode) },
+        { h->nodeBoxesOffset, packed::boxesSize(h->nodeCount, h->boxBits) },
+        { h->trianglesOffset, h->triangleCount * sizeof(Triangle3D) },
+        { h->triangleBoxesOffset, packed::boxesSize(h->triangleCount, h->boxBits) },
+    };
+    std::uint64_t end = sizeof(packed::Header);
+    for (const auto& [offset, size] : sections) {
+        if (offset < end || offset > length || size > length - offset || offset % packed::ALIGNMENT != 0) {
+            return false;
+        }
+        end = offset + size;
+    }
+    if (verifyChecksum &&
+        h->payloadChecksum != packed::checksum(data + h->nodesOffset, h->fileSize - h->nodesOffset)) {
+        return false;
+    }
+
+    // Узлы лежат по уровням в порядке обхода в ширину: потомки узлов уровня [levelBegin, levelEnd)
+    // занимают подряд весь следующий уровень, листья — ровно последний, на глубине height.
+    // Так обход не выйдет за массив узлов, не зациклится и рекурсия не глубже height.
+    // O(nodeCount) по массиву узлов — дешевле суммы
+    const auto* packedNodes = reinterpret_cast<const packed::PackedNode*>(data + h->nodesOffset);
+    std::uint64_t levelBegin = 0;
+    std::uint64_t levelEnd = 1;
+    for (std::uint32_t level = 0; level < h->height; ++level) {
+        if (levelEnd > h->leafBegin) return false;
+        std::uint64_t next = levelEnd;
+        for (std::uint64_t i = levelBegin; i < levelEnd; ++i) {
+            if (packedNodes[i].first != next) return false;
+            next += packedNodes[i].count;
+            if (next > h->nodeCount) return false;
+        }
+        levelBegin = levelEnd;
+        levelEnd = next;
+    }
+    if (levelBegin != h->leafBegin || levelEnd != h->nodeCount) return false;
+    for (std::uint64_t i = h->leafBegin; i < h->nodeCount; ++i) {
+        if (std::uint64_t(packedNodes[i].first) + packedNodes[i].count > h->triangleCount) return false;
+    }
+
+    header = h;
+    nodes = reinterpret_cast<const packed::PackedNode*>(data + h->nodesOffset);
+    triangles = reinterpret_cast<const Triangle3D*>(data + h->trianglesOffset);
+    // Для квантованных файлов представления строятся в query по типу значений
+    if (h->boxBits == 32) {
+        nodeBoxes = packed::boxView(data + h->nodeBoxesOffset, h->nodeCount);
+        triangleBoxes = packed::boxView(data + h->triangleBoxesOffset, h->triangleCount);
+    }
+    return true;
+}
+
+MBR MappedRTree::bounds() const {
+    if (!isOpen() || nodes[0].count == 0) return MBR();
+    const float* root = header->rootBox;
+    MBR box;
+    box.min = { root[0], root[1], root[2] };
+    box.max = { root[3], root[4], root[5] };
+    return box;
+}
+
+std::vector<Triangle3D> MappedRTree::find(const MBR& searchMBR) const {
+    std::vector<Triangle3D> result;
+    query(searchMBR, [&](const Triangle3D& triangle) {
+        result.push_back(triangle);
+    });
+    return result;
+}
@@ -0,0 +1,179 @@
+#ifndef MAPPEDRTREE_H
+#define MAPPEDRTREE_H
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MBR.h"
+#include "MBRBlock.h"
+#include "RTreeFile.h"
+#include "../geometry/Triangle3D.h"
+
+// Дерево только для чтения поверх файла, записанного RTree3D::save. Файл отображается
+// в память, и запросы идут прямо по отображению без разбора и копирования, так что
+// открытие занимает миллисекунды, а страницы делятся между процессами через кэш ОС.
+// Без mmap (не POSIX) файл целиком читается в память.
+class MappedRTree {
+public:
+    MappedRTree() = default;
+
+    MappedRTree(MappedRTree&& other) noexcept;
+
+    MappedRTree& operator=(MappedRTree&& other) noexcept;
+
+    MappedRTree(const MappedRTree&) = delete;
+    MappedRTree& operator=(const MappedRTree&) = delete;
+
+    ~MappedRTree();
+
+    // Возвращает false, если файл не открылся, не того формата или версии, или повреждён.
+    // Заголовок, границы секций и ссылки узлов (уровни в порядке обхода в ширину, листья
+    // на глубине height не больше packed::MAX_HEIGHT, диапазоны — в пределах секций)
+    // проверяются всегда, так что обход не выйдет за файл, не зациклится и не переполнит стек.
+    // Контрольная сумма данных — только при verifyChecksum, так как для этого нужно прочитать
+    // весь файл; без неё повреждённые прямоугольники и треугольники дадут неверные ответы, но не сбой.
+    bool open(const std::string& filename, bool verifyChecksum = false);
+
+    void close();
+
+    bool isOpen() const {
+        return header != nullptr;
+    }
+
+    // Число треугольников
+    size_t size() const {
+        return isOpen() ? header->triangleCount : 0;
+    }
+
+    MBR bounds() const;
+
+    std::vector<Triangle3D> find(const MBR& searchMBR) const;
+
+    // Как RTree3D::query: visitor(const Triangle3D&), false прекращает обход.
+    // Для квантованных файлов результат тот же, что для float: в листьях
+    // кандидаты проверяются по точному прямоугольнику треугольника.
+    template <typename Visitor>
+    void query(const MBR& searchMBR, Visitor&& visitor) const;
+
+private:
+    const std::byte* data = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::vector<std::byte> buffer;
+
+    const packed::Header* header = nullptr;
+    const packed::PackedNode* nodes = nullptr;
+    const Triangle3D* triangles = nullptr;
+    MBRView nodeBoxes{};
+    MBRView triangleBoxes{};
+
+    bool validate(bool verifyChecksum);
+
+    template <typename Visitor>
+    bool visit(std::uint32_t i, Visitor& visitor) const;
+
+    template <typename Visitor>
+    bool queryNode(std::uint32_t node, const MBR& searchMBR, Visitor& visitor) const;
+
+    // Квантованные прямоугольники типа T; frame — рамка, в которой закодированы потомки node
+    template <typename T>
+    struct QuantizedBoxes {
+        packed::QuantizedView<T> nodes;
+        packed::QuantizedView<T> triangles;
+    };
+
+    template <typename T, typename Visitor>
+    bool queryQuantized(std::uint32_t node, const packed::Frame& frame, const QuantizedBoxes<T>& boxes,
+                        const MBR& searchMBR, Visitor& visitor) const;
+};
+
+template <typename Visitor>
+void MappedRTree::query(const MBR& searchMBR, Visitor&& visitor) const {
+    if (!isOpen() || nodes[0].count == 0) return;
+    if (header->boxBits == 32) {
+        queryNode(0, searchMBR, visitor);
+        return;
+    }
+
+    const auto quantized = [&]<typename T>(T) {
+        const QuantizedBoxes<T> boxes{
+            packed::QuantizedView<T>::at(data + header->nodeBoxesOffset, header->nodeCount),
+            packed::QuantizedView<T>::at(data + header->triangleBoxesOffset, header->triangleCount),
+        };
+        const auto frame = packed::makeFrame(bounds(), packed::QuantizedView<T>::LEVELS);
+        queryQuantized(0, frame, boxes, searchMBR, visitor);
+    };
+    if (header->boxBits == 16) {
+        quantized(std::uint16_t{});
+    } else {
+        quantized(std::uint8_t{});
+    }
+}
+
+template <typename Visitor>
+bool MappedRTree::visit(std::uint32_t i, Visitor& visitor) const {
+    if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, const Triangle3D&>>) {
+        visitor(triangles[i]);
+        return true;
+    } else {
+        return visitor(triangles[i]);
+    }
+}
+
+template <typename Visitor>
+bool MappedRTree::queryNode(std::uint32_t node, const MBR& searchMBR, Visitor& visitor) const {
+    const auto [first, count] = nodes[node];
+    const bool leaf = node >= header->leafBegin;
+    const MBRView& boxes = leaf ? triangleBoxes : nodeBoxes;
+    for (size_t chunk = 0; chunk < count; chunk += 64) {
+        std::uint64_t hits = boxes.intersectMask(first + chunk, std::min<size_t>(64, count - chunk), searchMBR);
+        while (hits) {
+            const std::uint32_t i = first + static_cast<std::uint32_t>(chunk + std::countr_zero(hits));
+            hits &= hits - 1;
+
+            if (!leaf) {
+                if (!queryNode(i, searchMBR, visitor)) return false;
+                continue;
+            }
+
+            if (!visit(i, visitor)) return false;
+        }
+    }
+    return true;
+}
+
+template <typename T, typename Visitor>
+bool MappedRTree::queryQuantized(std::uint32_t node, const packed::Frame& frame, const QuantizedBoxes<T>& boxes,
+                                 const MBR& searchMBR, Visitor& visitor) const {
+    constexpr std::uint32_t levels = packed::QuantizedView<T>::LEVELS;
+    const auto query = packed::quantizeQuery(frame, searchMBR, levels);
+    if (query.empty) return true;
+
+    const auto [first, count] = nodes[node];
+    const bool leaf = node >= header->leafBegin;
+    const packed::QuantizedView<T>& view = leaf ? boxes.triangles : boxes.nodes;
+    for (size_t chunk = 0; chunk < count; chunk += 64) {
+        std::uint64_t hits = view.intersectMask(first + chunk, std::min<size_t>(64, count - chunk), query);
+        while (hits) {
+            const std::uint32_t i = first + static_cast<std::uint32_t>(chunk + std::countr_zero(hits));
+            hits &= hits - 1;
+
+            if (!leaf) {
+                const auto childFrame = packed::makeFrame(packed::dequantize(frame, view.get(i)), levels);
+                if (!queryQuantized(i, childFrame, boxes, searchMBR, visitor)) return false;
+                continue;
+            }
+
+            // Квантованный прямоугольник шире настоящего: отсекаем ложные попадания
+            if (!MBR(triangles[i]).intersects(searchMBR)) continue;
+            if (!visit(i, visitor)) return false;
+        }
+    }
+    return true;
+}
+
+#endif //MAPPEDRTREE_H
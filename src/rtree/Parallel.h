@@ -0,0 +1,186 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с кражей работы для параллельных циклов. Диапазон индексов заранее
+// делится поровну между участниками; каждый берёт из своей части блоки по grain,
+// а закончив, забирает половину остатка у другого. Вызывающий поток тоже участвует.
+class WorkStealingPool {
+public:
+    // Пул на все ядра, создаётся при первом обращении
+    static WorkStealingPool& instance() {
+        static WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    explicit WorkStealingPool(size_t participants)
+        : participants(std::max<size_t>(participants, 1)), ranges(std::make_unique<Range[]>(this->participants)) {
+        for (size_t w = 1; w < this->participants; ++w) {
+            threads.emplace_back([this, w] { workerLoop(w); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Число участников, включая вызывающий поток; номера участников в body — из [0, size())
+    size_t size() const {
+        return participants;
+    }
+
+    // Вызывает body(begin, end, worker) для непересекающихся блоков, покрывающих [0, count).
+    // Вложенный вызов из потока пула выполняется последовательно.
+    void run(size_t count, size_t grain, const std::function<void(size_t, size_t, size_t)>& body) {
+        if (count == 0) return;
+        grain = std::max<size_t>(grain, 1);
+        if (insideWorker() || participants == 1 || count <= grain) {
+            body(0, count, 0);
+            return;
+        }
+
+        std::lock_guard jobLock(jobMutex);
+        for (size_t w = 0; w < participants; ++w) {
+            std::lock_guard lock(ranges[w].lock);
+            ranges[w].begin = count * w / participants;
+            ranges[w].end = count * (w + 1) / participants;
+        }
+        {
+            std::lock_guard lock(wakeMutex);
+            job = &body;
+            jobGrain = grain;
+            active = participants - 1;
+            ++generation;
+        }
+        wake.notify_all();
+
+        insideWorker() = true;
+        drain(0);
+        insideWorker() = false;
+
+        std::unique_lock lock(wakeMutex);
+        done.wait(lock, [this] { return active == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct alignas(64) Range {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    size_t participants;
+    std::unique_ptr<Range[]> ranges;
+    std::vector<std::thread> threads;
+
+    std::mutex jobMutex;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t, size_t, size_t)>* job = nullptr;
+    size_t jobGrain = 1;
+    size_t active = 0;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+
+    static bool& insideWorker() {
+        thread_local bool inside = false;
+        return inside;
+    }
+
+    void workerLoop(size_t self) {
+        insideWorker() = true;
+        std::uint64_t seen = 0;
+        std::unique_lock lock(wakeMutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+
+            lock.unlock();
+            drain(self);
+            lock.lock();
+
+            if (--active == 0) done.notify_one();
+        }
+    }
+
+    void drain(size_t self) {
+        size_t begin, end;
+        while (take(self, begin, end)) {
+            (*job)(begin, end, self);
+        }
+    }
+
+    // Следующий блок: из своей части, иначе половина остатка чужой части
+    bool take(size_t self, size_t& begin, size_t& end) {
+        const size_t grain = jobGrain;
+        auto& own = ranges[self];
+        {
+            std::lock_guard lock(own.lock);
+            if (own.begin < own.end) {
+                begin = own.begin;
+                end = std::min(own.end, own.begin + grain);
+                own.begin = end;
+                return true;
+            }
+        }
+
+        for (size_t k = 1; k < participants; ++k) {
+            auto& victim = ranges[(self + k) % participants];
+            size_t stolenBegin, stolenEnd;
+            {
+                std::lock_guard lock(victim.lock);
+                const size_t remaining = victim.end - victim.begin;
+                if (remaining == 0) continue;
+                if (remaining <= grain) {
+                    begin = victim.begin;
+                    end = victim.end;
+                    victim.begin = victim.end;
+                    return true;
+                }
+                stolenBegin = victim.begin + remaining / 2;
+                stolenEnd = victim.end;
+                victim.end = stolenBegin;
+            }
+
+            std::lock_guard lock(own.lock);
+            begin = stolenBegin;
+            end = std::min(stolenEnd, stolenBegin + grain);
+            own.begin = end;
+            own.end = stolenEnd;
+            return true;
+        }
+        return false;
+    }
+};
+
+// Выполняет body(i) для i из [0, count) на всех ядрах блоками по grain.
+template <typename Body>
+void parallelFor(size_t count, size_t grain, Body&& body) {
+    WorkStealingPool::instance().run(count, grain, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i) {
+            body(i);
+        }
+    });
+}
+
+#endif //PARALLEL_H
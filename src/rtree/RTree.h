@@ -0,0 +1,645 @@
+#ifndef RTREE_H
+#define RTREE_H
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "Box.h"
+#include "BulkLoad.h"
+#include "RTreeNode.h"
+
+// Обобщённое R*-дерево с параметрами времени компиляции: тип записи, размерность,
+// тип координат и ёмкость узлов. Узлы — массивы фиксированной длины MaxFanout,
+// поэтому циклы по потомкам имеют известную длину и разворачиваются/векторизуются.
+// Записи — точки, прямоугольники, треугольники или любой тип со специализацией BoxOf;
+// remove ищет запись через ==.
+//
+// RTree3D остаётся отдельной реализацией: параллельное чтение, пакетные операции,
+// лучи и упакованные файлы построены на его пуле узлов с ёмкостью времени выполнения.
+//
+// MinFanout по умолчанию — 40% ёмкости с округлением вверх, как рекомендуют для R*:
+// с меньшим минимумом разбиение точек вырождается в отщепление одной записи.
+template <typename Payload, size_t Dim = 3, typename Scalar = float, size_t MaxFanout = 16,
+          size_t MinFanout = (MaxFanout * 2 + 4) / 5>
+class RTree {
+    static_assert(Dim >= 1);
+    static_assert(MaxFanout >= 2 && MaxFanout <= 64, "маска потомков узла — 64 бита");
+    static_assert(MinFanout >= 1 && 2 * MinFanout <= MaxFanout + 1);
+    static_assert(std::is_floating_point_v<Scalar>);
+    static_assert(std::is_default_constructible_v<Payload>);
+
+public:
+    using BoxType = Box<Dim, Scalar>;
+    using PointType = Point<Dim, Scalar>;
+
+    RTree() {
+        clear();
+    }
+
+    void insert(const Payload& payload);
+
+    // Возвращает false, если записи нет в дереве
+    bool remove(const Payload& payload);
+
+    // Упаковка STR; прежнее содержимое удаляется
+    void buildTree(std::span<const Payload> payloads);
+
+    void clear();
+
+    std::vector<Payload> find(const BoxType& searchBox) const;
+
+    // Как RTree3D::query: visitor(const Payload&), false прекращает обход.
+    template <typename Visitor>
+    void query(const BoxType& searchBox, Visitor&& visitor) const;
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t height() const {
+        return rootLevel + 1;
+    }
+
+    BoxType bounds() const {
+        return rootLevel == 0 ? leaves[root].boxes.bounds() : branches[root].boxes.bounds();
+    }
+
+private:
+    static constexpr size_t OVERFLOW_SIZE = MaxFanout + 1;
+
+    // Прямоугольники слотов узла структурой массивов. Свободные слоты хранят пустой
+    // прямоугольник: он не пересекает запрос и не расширяет bounds, поэтому циклы идут
+    // по всем MaxFanout слотам без проверки count.
+    struct SlotBoxes {
+        alignas(64) std::array<std::array<Scalar, MaxFanout>, Dim> min;
+        alignas(64) std::array<std::array<Scalar, MaxFanout>, Dim> max;
+
+        SlotBoxes() {
+            for (size_t d = 0; d < Dim; ++d) {
+                min[d].fill(std::numeric_limits<Scalar>::max());
+                max[d].fill(std::numeric_limits<Scalar>::lowest());
+            }
+        }
+
+        BoxType get(size_t i) const {
+            BoxType box;
+            for (size_t d = 0; d < Dim; ++d) {
+                box.min[d] = min[d][i];
+                box.max[d] = max[d][i];
+            }
+            return box;
+        }
+
+        void set(size_t i, const BoxType& box) {
+            for (size_t d = 0; d < Dim; ++d) {
+                min[d][i] = box.min[d];
+                max[d][i] = box.max[d];
+            }
+        }
+
+        BoxType bounds() const {
+            BoxType box;
+            for (size_t d = 0; d < Dim; ++d) {
+                box.min[d] = *std::min_element(min[d].begin(), min[d].end());
+                box.max[d] = *std::max_element(max[d].begin(), max[d].end());
+            }
+            return box;
+        }
+
+        std::uint64_t intersectMask(const BoxType& query) const {
+            std::array<std::uint8_t, MaxFanout> hit;
+            hit.fill(1);
+            for (size_t d = 0; d < Dim; ++d) {
+                for (size_t i = 0; i < MaxFanout; ++i) {
+                    hit[i] &= static_cast<std::uint8_t>((min[d][i] <= query.max[d]) & (max[d][i] >= query.min[d]));
+                }
+            }
+            std::uint64_t mask = 0;
+            for (size_t i = 0; i < MaxFanout; ++i) {
+                mask |= std::uint64_t(hit[i]) << i;
+            }
+            return mask;
+        }
+    };
+
+    struct Branch {
+        SlotBoxes boxes;
+        std::array<NodeId, MaxFanout> children;
+        std::uint32_t count = 0;
+    };
+
+    struct Leaf {
+        SlotBoxes boxes;
+        std::array<Payload, MaxFanout> entries;
+        std::uint32_t count = 0;
+    };
+
+    // Записи переполненного узла вместе с новой
+    template <typename Item>
+    struct Overflow {
+        std::array<BoxType, OVERFLOW_SIZE> boxes;
+        std::array<Item, OVERFLOW_SIZE> items;
+    };
+
+    struct BulkEntry {
+        PointType center;
+        std::uint32_t index;
+    };
+
+    // Уровень 0 — листья; корень находится на уровне rootLevel
+    std::vector<Branch> branches;
+    std::vector<Leaf> leaves;
+    std::vector<NodeId> freeBranches;
+    std::vector<NodeId> freeLeaves;
+    NodeId root = NULL_NODE;
+    size_t rootLevel = 0;
+    size_t count = 0;
+
+    static BoxType boxOf(const Payload& payload) {
+        return BoxOf<Payload, Dim, Scalar>::get(payload);
+    }
+
+    NodeId allocateLeaf();
+
+    NodeId allocateBranch();
+
+    void release(NodeId node, size_t level);
+
+    BoxType nodeBounds(NodeId node, size_t level) const {
+        return level == 0 ? leaves[node].boxes.bounds() : branches[node].boxes.bounds();
+    }
+
+    size_t nodeCount(NodeId node, size_t level) const {
+        return level == 0 ? leaves[node].count : branches[node].count;
+    }
+
+    void insertEntry(const BoxType& box, const Payload& payload);
+
+    NodeId insertNode(NodeId node, size_t level, const BoxType& box, const Payload& payload);
+
+    static size_t chooseSubtree(const Branch& branch, const BoxType& box);
+
+    template <typename Item>
+    static size_t splitOrder(const Overflow<Item>& overflow, std::array<std::uint8_t, OVERFLOW_SIZE>& order);
+
+    template <typename Node, typename Item>
+    static void splitInto(Node& first, Node& second, const Overflow<Item>& overflow, std::array<Item, MaxFanout> Node::*items);
+
+    template <typename Node>
+    static void removeSlot(Node& node, size_t i);
+
+    bool removeNode(NodeId node, size_t level, const BoxType& box, const Payload& payload, std::vector<Payload>& orphans);
+
+    void collect(NodeId node, size_t level, std::vector<Payload>& result) const;
+
+    static void sortTileRecursive(std::span<BulkEntry> entries) {
+        bulk::sortTileRecursive(entries, Dim, MaxFanout, [](const BulkEntry& e, size_t axis) {
+            return e.center[axis];
+        });
+    }
+
+    template <typename Visitor>
+    bool queryNode(NodeId node, size_t level, const BoxType& searchBox, Visitor& visitor) const;
+};
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::clear() {
+    branches.clear();
+    leaves.clear();
+    freeBranches.clear();
+    freeLeaves.clear();
+    root = allocateLeaf();
+    rootLevel = 0;
+    count = 0;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+NodeId RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::allocateLeaf() {
+    if (!freeLeaves.empty()) {
+        const NodeId id = freeLeaves.back();
+        freeLeaves.pop_back();
+        leaves[id] = Leaf();
+        return id;
+    }
+    leaves.emplace_back();
+    return static_cast<NodeId>(leaves.size() - 1);
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+NodeId RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::allocateBranch() {
+    if (!freeBranches.empty()) {
+        const NodeId id = freeBranches.back();
+        freeBranches.pop_back();
+        branches[id] = Branch();
+        return id;
+    }
+    branches.emplace_back();
+    return static_cast<NodeId>(branches.size() - 1);
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::release(NodeId node, size_t level) {
+    if (level == 0) {
+        freeLeaves.push_back(node);
+        return;
+    }
+    const Branch& branch = branches[node];
+    for (size_t i = 0; i < branch.count; ++i) {
+        release(branch.children[i], level - 1);
+    }
+    freeBranches.push_back(node);
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::insert(const Payload& payload) {
+    insertEntry(boxOf(payload), payload);
+    ++count;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::insertEntry(const BoxType& box, const Payload& payload) {
+    const NodeId sibling = insertNode(root, rootLevel, box, payload);
+    if (sibling == NULL_NODE) return;
+
+    // Корень разделился: дерево растёт на уровень вверх
+    const NodeId newRoot = allocateBranch();
+    Branch& branch = branches[newRoot];
+    branch.boxes.set(0, nodeBounds(root, rootLevel));
+    branch.boxes.set(1, nodeBounds(sibling, rootLevel));
+    branch.children[0] = root;
+    branch.children[1] = sibling;
+    branch.count = 2;
+    root = newRoot;
+    ++rootLevel;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+NodeId RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::insertNode(NodeId node, size_t level, const BoxType& box,
+                                                                     const Payload& payload) {
+    if (level == 0) {
+        Leaf& leaf = leaves[node];
+        if (leaf.count < MaxFanout) {
+            leaf.boxes.set(leaf.count, box);
+            leaf.entries[leaf.count++] = payload;
+            return NULL_NODE;
+        }
+
+        Overflow<Payload> overflow;
+        for (size_t i = 0; i < MaxFanout; ++i) {
+            overflow.boxes[i] = leaf.boxes.get(i);
+            overflow.items[i] = leaf.entries[i];
+        }
+        overflow.boxes[MaxFanout] = box;
+        overflow.items[MaxFanout] = payload;
+        // allocateLeaf может переместить leaves, ссылки берутся заново
+        const NodeId sibling = allocateLeaf();
+        splitInto(leaves[node], leaves[sibling], overflow, &Leaf::entries);
+        return sibling;
+    }
+
+    const size_t slot = chooseSubtree(branches[node], box);
+    const NodeId child = branches[node].children[slot];
+    const NodeId split = insertNode(child, level - 1, box, payload);
+
+    Branch& branch = branches[node];
+    if (split == NULL_NODE) {
+        BoxType childBox = branch.boxes.get(slot);
+        branch.boxes.set(slot, *childBox.expandToInclude(box));
+        return NULL_NODE;
+    }
+
+    branch.boxes.set(slot, nodeBounds(child, level - 1));
+    const BoxType splitBox = nodeBounds(split, level - 1);
+    if (branch.count < MaxFanout) {
+        branch.boxes.set(branch.count, splitBox);
+        branch.children[branch.count++] = split;
+        return NULL_NODE;
+    }
+
+    Overflow<NodeId> overflow;
+    for (size_t i = 0; i < MaxFanout; ++i) {
+        overflow.boxes[i] = branch.boxes.get(i);
+        overflow.items[i] = branch.children[i];
+    }
+    overflow.boxes[MaxFanout] = splitBox;
+    overflow.items[MaxFanout] = split;
+    const NodeId sibling = allocateBranch();
+    splitInto(branches[node], branches[sibling], overflow, &Branch::children);
+    return sibling;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+size_t RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::chooseSubtree(const Branch& branch, const BoxType& box) {
+    // Наименьшее увеличение объёма, затем периметра (плоские и точечные прямоугольники), затем наименьший объём
+    size_t best = 0;
+    Scalar bestVolume = std::numeric_limits<Scalar>::max();
+    Scalar bestMargin = std::numeric_limits<Scalar>::max();
+    Scalar bestSize = std::numeric_limits<Scalar>::max();
+    for (size_t i = 0; i < branch.count; ++i) {
+        const BoxType current = branch.boxes.get(i);
+        const BoxType enlarged = BoxType::combine(current, box);
+        const Scalar size = current.volume();
+        const Scalar volume = enlarged.volume() - size;
+        const Scalar margin = enlarged.margin() - current.margin();
+        if (volume < bestVolume ||
+            (volume == bestVolume && (margin < bestMargin || (margin == bestMargin && size < bestSize)))) {
+            best = i;
+            bestVolume = volume;
+            bestMargin = margin;
+            bestSize = size;
+        }
+    }
+    return best;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+template <typename Item>
+size_t RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::splitOrder(const Overflow<Item>& overflow,
+                                                                     std::array<std::uint8_t, OVERFLOW_SIZE>& order) {
+    // Разбиение R*: ось с наименьшей суммой периметров по всем распределениям,
+    // на ней — распределение с наименьшим перекрытием групп, затем с наименьшим объёмом.
+    // Распределение k — первые k записей в порядке сортировки по нижней или верхней границе.
+    const auto& boxes = overflow.boxes;
+    auto sorted = [&](size_t axis, bool upper) {
+        std::array<std::uint8_t, OVERFLOW_SIZE> result;
+        for (size_t i = 0; i < OVERFLOW_SIZE; ++i) {
+            result[i] = static_cast<std::uint8_t>(i);
+        }
+        std::sort(result.begin(), result.end(), [&](std::uint8_t a, std::uint8_t b) {
+            const Scalar ka = upper ? boxes[a].max[axis] : boxes[a].min[axis];
+            const Scalar kb = upper ? boxes[b].max[axis] : boxes[b].min[axis];
+            return ka < kb || (ka == kb && a < b);
+        });
+        return result;
+    };
+    // prefix[k] — прямоугольник первых k + 1 записей, suffix[k] — записей с k до конца
+    auto accumulate = [&](const std::array<std::uint8_t, OVERFLOW_SIZE>& sequence,
+                          std::array<BoxType, OVERFLOW_SIZE>& prefix, std::array<BoxType, OVERFLOW_SIZE>& suffix) {
+        prefix[0] = boxes[sequence[0]];
+        for (size_t i = 1; i < OVERFLOW_SIZE; ++i) {
+            prefix[i] = BoxType::combine(prefix[i - 1], boxes[sequence[i]]);
+        }
+        suffix[OVERFLOW_SIZE - 1] = boxes[sequence[OVERFLOW_SIZE - 1]];
+        for (size_t i = OVERFLOW_SIZE - 1; i-- > 0;) {
+            suffix[i] = BoxType::combine(suffix[i + 1], boxes[sequence[i]]);
+        }
+    };
+
+    std::array<BoxType, OVERFLOW_SIZE> prefix, suffix;
+    size_t bestAxis = 0;
+    Scalar bestMargin = std::numeric_limits<Scalar>::max();
+    for (size_t axis = 0; axis < Dim; ++axis) {
+        Scalar margin = 0;
+        for (const bool upper : { false, true }) {
+            accumulate(sorted(axis, upper), prefix, suffix);
+            for (size_t k = MinFanout; k <= OVERFLOW_SIZE - MinFanout; ++k) {
+                margin += prefix[k - 1].margin() + suffix[k].margin();
+            }
+        }
+        if (margin < bestMargin) {
+            bestMargin = margin;
+            bestAxis = axis;
+        }
+    }
+
+    size_t bestSplit = MinFanout;
+    bestMargin = std::numeric_limits<Scalar>::max();
+    Scalar bestOverlap = std::numeric_limits<Scalar>::max();
+    Scalar bestVolume = std::numeric_limits<Scalar>::max();
+    for (const bool upper : { false, true }) {
+        const auto sequence = sorted(bestAxis, upper);
+        accumulate(sequence, prefix, suffix);
+        for (size_t k = MinFanout; k <= OVERFLOW_SIZE - MinFanout; ++k) {
+            const Scalar overlap = prefix[k - 1].overlap(suffix[k]);
+            const Scalar volume = prefix[k - 1].volume() + suffix[k].volume();
+            const Scalar margin = prefix[k - 1].margin() + suffix[k].margin();
+            if (overlap < bestOverlap || (overlap == bestOverlap && (volume < bestVolume ||
+                                          (volume == bestVolume && margin < bestMargin)))) {
+                bestOverlap = overlap;
+                bestVolume = volume;
+                bestMargin = margin;
+                bestSplit = k;
+                order = sequence;
+            }
+        }
+    }
+    return bestSplit;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+template <typename Node, typename Item>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::splitInto(Node& first, Node& second, const Overflow<Item>& overflow,
+                                                                  std::array<Item, MaxFanout> Node::*items) {
+    std::array<std::uint8_t, OVERFLOW_SIZE> order;
+    const size_t split = splitOrder(overflow, order);
+
+    first.boxes = SlotBoxes();
+    first.count = 0;
+    second.count = 0;
+    for (size_t i = 0; i < OVERFLOW_SIZE; ++i) {
+        Node& target = i < split ? first : second;
+        target.boxes.set(target.count, overflow.boxes[order[i]]);
+        (target.*items)[target.count++] = overflow.items[order[i]];
+    }
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+template <typename Node>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::removeSlot(Node& node, size_t i) {
+    // Последний слот переносится на место удалённого, освободившийся снова пуст
+    const size_t last = --node.count;
+    node.boxes.set(i, node.boxes.get(last));
+    node.boxes.set(last, BoxType());
+    if constexpr (std::is_same_v<Node, Leaf>) {
+        node.entries[i] = node.entries[last];
+    } else {
+        node.children[i] = node.children[last];
+    }
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+bool RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::remove(const Payload& payload) {
+    std::vector<Payload> orphans;
+    if (!removeNode(root, rootLevel, boxOf(payload), payload, orphans)) return false;
+    --count;
+
+    // Корень с единственным потомком заменяется потомком
+    while (rootLevel > 0 && branches[root].count == 1) {
+        const NodeId child = branches[root].children[0];
+        freeBranches.push_back(root);
+        root = child;
+        --rootLevel;
+    }
+
+    // Записи расформированных узлов вставляются заново
+    for (const Payload& orphan : orphans) {
+        insertEntry(boxOf(orphan), orphan);
+    }
+    return true;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+bool RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::removeNode(NodeId node, size_t level, const BoxType& box,
+                                                                   const Payload& payload, std::vector<Payload>& orphans) {
+    if (level == 0) {
+        Leaf& leaf = leaves[node];
+        for (size_t i = 0; i < leaf.count; ++i) {
+            if (leaf.entries[i] == payload) {
+                removeSlot(leaf, i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Branch& branch = branches[node];
+    for (size_t i = 0; i < branch.count; ++i) {
+        if (!branch.boxes.get(i).contains(box)) continue;
+        const NodeId child = branch.children[i];
+        if (!removeNode(child, level - 1, box, payload, orphans)) continue;
+
+        // Недозаполненный потомок расформировывается, его записи вставит remove
+        if (nodeCount(child, level - 1) < MinFanout) {
+            collect(child, level - 1, orphans);
+            release(child, level - 1);
+            removeSlot(branch, i);
+        } else {
+            branch.boxes.set(i, nodeBounds(child, level - 1));
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::collect(NodeId node, size_t level,
+                                                                std::vector<Payload>& result) const {
+    if (level == 0) {
+        const Leaf& leaf = leaves[node];
+        result.insert(result.end(), leaf.entries.begin(), leaf.entries.begin() + leaf.count);
+        return;
+    }
+    const Branch& branch = branches[node];
+    for (size_t i = 0; i < branch.count; ++i) {
+        collect(branch.children[i], level - 1, result);
+    }
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::buildTree(std::span<const Payload> payloads) {
+    clear();
+    if (payloads.empty()) return;
+    count = payloads.size();
+
+    std::vector<BoxType> boxes(payloads.size());
+    std::vector<BulkEntry> entries(payloads.size());
+    for (size_t i = 0; i < payloads.size(); ++i) {
+        boxes[i] = boxOf(payloads[i]);
+        for (size_t d = 0; d < Dim; ++d) {
+            entries[i].center[d] = boxes[i].center(d);
+        }
+        entries[i].index = static_cast<std::uint32_t>(i);
+    }
+
+    sortTileRecursive(entries);
+    auto bounds = bulk::groupBounds(entries.size(), MinFanout, MaxFanout);
+
+    // Корневой лист из clear() становится первым листом
+    std::vector<NodeId> level;
+    std::vector<BoxType> levelBoxes;
+    for (size_t g = 0; g + 1 < bounds.size(); ++g) {
+        const NodeId id = g == 0 ? root : allocateLeaf();
+        Leaf& leaf = leaves[id];
+        for (size_t i = bounds[g]; i < bounds[g + 1]; ++i) {
+            leaf.boxes.set(leaf.count, boxes[entries[i].index]);
+            leaf.entries[leaf.count++] = payloads[entries[i].index];
+        }
+        level.push_back(id);
+        levelBoxes.push_back(leaf.boxes.bounds());
+    }
+
+    // Верхние уровни упаковываются тем же способом по центрам прямоугольников узлов
+    rootLevel = 0;
+    while (level.size() > 1) {
+        entries.resize(level.size());
+        for (size_t i = 0; i < level.size(); ++i) {
+            for (size_t d = 0; d < Dim; ++d) {
+                entries[i].center[d] = levelBoxes[i].center(d);
+            }
+            entries[i].index = static_cast<std::uint32_t>(i);
+        }
+
+        sortTileRecursive(entries);
+        bounds = bulk::groupBounds(entries.size(), MinFanout, MaxFanout);
+
+        std::vector<NodeId> parents;
+        std::vector<BoxType> parentBoxes;
+        for (size_t g = 0; g + 1 < bounds.size(); ++g) {
+            const NodeId id = allocateBranch();
+            Branch& branch = branches[id];
+            for (size_t i = bounds[g]; i < bounds[g + 1]; ++i) {
+                branch.boxes.set(branch.count, levelBoxes[entries[i].index]);
+                branch.children[branch.count++] = level[entries[i].index];
+            }
+            parents.push_back(id);
+            parentBoxes.push_back(branch.boxes.bounds());
+        }
+        level = std::move(parents);
+        levelBoxes = std::move(parentBoxes);
+        ++rootLevel;
+    }
+    root = level[0];
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+std::vector<Payload> RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::find(const BoxType& searchBox) const {
+    std::vector<Payload> result;
+    query(searchBox, [&](const Payload& payload) {
+        result.push_back(payload);
+    });
+    return result;
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+template <typename Visitor>
+void RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::query(const BoxType& searchBox, Visitor&& visitor) const {
+    queryNode(root, rootLevel, searchBox, visitor);
+}
+
+template <typename Payload, size_t Dim, typename Scalar, size_t MaxFanout, size_t MinFanout>
+template <typename Visitor>
+bool RTree<Payload, Dim, Scalar, MaxFanout, MinFanout>::queryNode(NodeId node, size_t level, const BoxType& searchBox,
+                                                                  Visitor& visitor) const {
+    if (level == 0) {
+        const Leaf& leaf = leaves[node];
+        std::uint64_t hits = leaf.boxes.intersectMask(searchBox);
+        while (hits) {
+            const Payload& payload = leaf.entries[std::countr_zero(hits)];
+            hits &= hits - 1;
+            if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, const Payload&>>) {
+                visitor(payload);
+            } else if (!visitor(payload)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const Branch& branch = branches[node];
+    std::uint64_t hits = branch.boxes.intersectMask(searchBox);
+    while (hits) {
+        const NodeId child = branch.children[std::countr_zero(hits)];
+        hits &= hits - 1;
+        if (!queryNode(child, level - 1, searchBox, visitor)) return false;
+    }
+    return true;
+}
+
+#endif //RTREE_H
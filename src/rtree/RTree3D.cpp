@@ -1,204 +1,1141 @@
 #include "RTree3D.h"
 
+#include <array>
+#include <cassert>
+#include <cmath>
 #include <fstream>
+#include <queue>
+#include <tuple>
 
-RTree3D::RTree3D(size_t minChildren, size_t maxChildren) : minChildren(minChildren), maxChildren(maxChildren) {
-    root = std::make_shared<RTreeLeaf>();
+#include "BulkLoad.h"
+#include "Parallel.h"
+#include "RTreeFile.h"
+#include "SpaceFillingCurve.h"
+#include "../geometry/Distance.h"
+
+namespace {
+
+// Стоимость прямоугольника в квадратичной политике: площадь поверхности, при равенстве — сумма
+// рёбер. Объём плоских MBR всегда 0 и не различает варианты
+struct QuadraticCost {
+    float area;
+    float margin;
+
+    auto operator<=>(const QuadraticCost&) const = default;
+};
+
+QuadraticCost costOf(const MBR& box) {
+    return { box.area(), box.margin() };
 }
 
-void RTree3D::insert(const Triangle3D& obj) {
-    auto newChild = insertRecursive(root, obj);
+QuadraticCost operator-(const QuadraticCost& a, const QuadraticCost& b) {
+    return { a.area - b.area, a.margin - b.margin };
+}
 
-    if (newChild) {
-        auto newRoot = std::make_shared<RTreeInnerNode>();
-        newRoot->insert(root);
-        newRoot->insert(newChild);
-        root = newRoot;
-    }
+// Прирост стоимости box при добавлении added
+QuadraticCost growth(const MBR& box, const MBR& added) {
+    return costOf(MBR::combine(box, added)) - costOf(box);
+}
+
+// Пустое место в общем MBR пары: чем больше, тем хуже им быть в одной группе
+QuadraticCost waste(const MBR& a, const MBR& b) {
+    return costOf(MBR::combine(a, b)) - costOf(a) - costOf(b);
+}
+
+// Насколько одной группе выгоднее принять запись, чем другой
+QuadraticCost preference(const QuadraticCost& d1, const QuadraticCost& d2) {
+    return { std::abs(d1.area - d2.area), std::abs(d1.margin - d2.margin) };
+}
+
+} // namespace
+
+template <typename Source>
+BasicRTree3D<Source>::BasicRTree3D(size_t minChildren, size_t maxChildren, InsertPolicy policy, Concurrency concurrency,
+                                   std::pmr::memory_resource* resource)
+    : pool(maxChildren, resource), maxChildren(maxChildren), minChildren(minChildren), policy(policy), concurrency(concurrency) {
+    root = pool.allocate(NodeKind::Leaf);
+    publishedRoot.store(root);
 }
 
-void RTree3D::remove(const Triangle3D& target) {
-    if (!root) return;
+template <typename Source>
+BasicRTree3D<Source>::BasicRTree3D(Source source, size_t minChildren, size_t maxChildren, InsertPolicy policy,
+                                   Concurrency concurrency, std::pmr::memory_resource* resource)
+    : BasicRTree3D(minChildren, maxChildren, policy, concurrency, resource) {
+    this->source = std::move(source);
+}
 
-    std::vector<Triangle3D> reinserts;
-    bool found = removeRecursive(root, target, reinserts);
+template <typename Source>
+BasicRTree3D<Source>::~BasicRTree3D() {
+    // Живой снимок отпустил бы свою версию через уничтоженное дерево
+    assert(liveSnapshots.load() == 0 && "снимки RTree3D должны быть уничтожены раньше дерева");
+}
 
-    if (!found) {
+template <typename Source>
+EntryHandle BasicRTree3D<Source>::insert(const Entry& obj) {
+    const auto lock = lockWriters();
+    const EntryHandle handle = pool.allocateHandle();
+    insertEntry({ obj, handle });
+    publish();
+    return handle;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::remove(const Entry& target) {
+    const auto lock = lockWriters();
+    if (root == NULL_NODE) return;
+
+    auto& path = scratch.path;
+    path.clear();
+    if (!findPath(root, target, path)) {
         // Объект не найден, ничего не делаем
         return;
     }
+    removeAlongPath(path, &target, NULL_HANDLE);
+    publish();
+}
+
+template <typename Source>
+bool BasicRTree3D<Source>::remove(EntryHandle handle) {
+    const auto lock = lockWriters();
+    auto& path = scratch.path;
+    if (!pathToRoot(pool.leafOf(handle), path)) return false;
+
+    removeAlongPath(path, nullptr, handle);
+    pool.releaseHandle(handle);
+    publish();
+    return true;
+}
+
+template <typename Source>
+bool BasicRTree3D<Source>::update(EntryHandle handle, const Entry& entry) {
+    const auto lock = lockWriters();
+    if (pool.leafOf(handle) == NULL_NODE) return false;
+    if (updateInPlace(handle, entry)) {
+        publish();
+        return true;
+    }
+
+    auto& path = scratch.path;
+    pathToRoot(pool.leafOf(handle), path);
+    if (!updateInLeaf(path, handle, entry)) {
+        removeAlongPath(path, nullptr, handle);
+        insertEntry({ entry, handle });
+    }
+    publish();
+    return true;
+}
+
+template <typename Source>
+size_t BasicRTree3D<Source>::updateBatch(std::span<const EntryHandle> handles, std::span<const Entry> entries) {
+    const auto lock = lockWriters();
+    auto& path = scratch.path;
+    auto& escaped = scratch.escaped;
+    escaped.clear();
+    for (size_t i = 0; i < std::min(handles.size(), entries.size()); ++i) {
+        if (pool.leafOf(handles[i]) == NULL_NODE || updateInPlace(handles[i], entries[i])) continue;
+
+        pathToRoot(pool.leafOf(handles[i]), path);
+        if (updateInLeaf(path, handles[i], entries[i])) continue;
+        removeAlongPath(path, nullptr, handles[i]);
+        escaped.push_back({ entries[i], handles[i] });
+    }
+    insertEntries(escaped);
+    publish();
+    return escaped.size();
+}
+
+// Запись, оставшаяся в своём хранимом MBR, меняется в листе без пересчёта MBR узлов;
+// false, если запаса нет или запись из него вышла
+template <typename Source>
+bool BasicRTree3D<Source>::updateInPlace(EntryHandle handle, const Entry& entry) {
+    if (updateMargin <= 0.0f) return false;
+
+    NodeId leaf = pool.leafOf(handle);
+    const auto handles = pool.getHandles(leaf);
+    const size_t index = std::find(handles.begin(), handles.end(), handle) - handles.begin();
+    const MBR stored = pool.getBox(leaf, index);
+    if (!stored.contains(boxOf(entry))) return false;
+
+    if (copying()) {
+        auto& path = scratch.path;
+        pathToRoot(leaf, path);
+        writablePath(path);
+        leaf = path.back();
+    }
+    pool.setEntry(leaf, index, entry, stored);
+    return true;
+}
+
+// Запись, чей MBR укладывается в MBR её листа, остаётся в нём: меняется на месте,
+// MBR предков только сжимаются. path — путь от корня до листа; false, если не укладывается
+template <typename Source>
+bool BasicRTree3D<Source>::updateInLeaf(std::vector<NodeId>& path, EntryHandle handle, const Entry& entry) {
+    const MBR box = boxOf(Item{ entry, handle });
+    if (!pool[path.back()].mbr.contains(box)) return false;
+
+    writablePath(path);
+    const NodeId leaf = path.back();
+    const auto handles = pool.getHandles(leaf);
+    const size_t index = std::find(handles.begin(), handles.end(), handle) - handles.begin();
+    pool.setEntry(leaf, index, entry, box);
+    for (size_t i = path.size(); i-- > 0;) {
+        pool.recalculateMBR(path[i]);
+    }
+    return true;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::reserve(size_t entries) {
+    const auto lock = lockWriters();
+
+    // Узлы, кроме корня, заполнены хотя бы на minChildren; у внутренних берём не меньше двух
+    // потомков, иначе высота не ограничена
+    const size_t leaves = entries / std::max<size_t>(minChildren, 1) + 1;
+    const size_t fanIn = std::max<size_t>(minChildren, 2);
+    size_t inners = 0;
+    size_t levels = 1;
+    for (size_t count = leaves; count > 1; ++levels) {
+        count = (count + fanIn - 1) / fanIn;
+        inners += count;
+    }
+    // Запас на узел, занятый разбиением до того, как освободится другой
+    pool.reserveTotal(leaves + levels, inners + levels);
+    pool.reserveHandles(entries);
+
+    const size_t overflow = maxChildren + 1;
+    scratch.path.reserve(levels + 1);
+    // remove перевставляет записи отцепленных поддеревьев, в худшем случае почти все
+    scratch.reinserts.reserve(entries);
+    scratch.reinserted.reserve(levels + 1);
+    // Перевставки R* вложены не глубже высоты дерева
+    while (scratch.frames.size() < levels + 1) scratch.frames.emplace_back();
+    for (auto& frame : scratch.frames) {
+        frame.path.reserve(levels + 1);
+        frame.triangles.reserve(overflow);
+        frame.children.reserve(overflow);
+    }
+    scratch.overflow.triangles.reserve(overflow);
+    scratch.overflow.children.reserve(overflow);
+    scratch.overflow.boxes.reserve(overflow);
+    scratch.order.reserve(overflow);
+    scratch.bestOrder.reserve(overflow);
+    scratch.prefix.reserve(overflow);
+    scratch.suffix.reserve(overflow);
+    scratch.distances.reserve(overflow);
+    scratch.splitTriangles.reserve(overflow);
+    scratch.splitChildren.reserve(overflow);
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::setUpdateMargin(float margin) {
+    const auto lock = lockWriters();
+    updateMargin = std::max(margin, 0.0f);
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::refine(size_t budget) {
+    const auto lock = lockWriters();
+    auto& path = scratch.path;
+    for (size_t step = 0; step < budget && !pool[root].isLeaf(); ++step) {
+        // Номера, ставшие недействительными после изменений дерева, ограничиваются
+        path.assign(1, root);
+        for (size_t depth = 0; depth < refineCursor.size(); ++depth) {
+            const auto children = pool.getChildren(path.back());
+            refineCursor[depth] = std::min<std::uint32_t>(refineCursor[depth], children.size() - 1);
+            const NodeId child = children[refineCursor[depth]];
+            if (pool[child].isLeaf()) {
+                refineCursor.resize(depth);
+                break;
+            }
+            path.push_back(child);
+        }
+
+        writablePath(path);
+        refineNode(path.back());
+        for (size_t i = path.size() - 1; i-- > 0;) {
+            pool.recalculateMBR(path[i]);
+        }
+        advanceRefineCursor(path);
+    }
+    publish();
+}
+
+// Над листьями — обновление MBR записей, затем переносы между потомками, пока они выгодны
+template <typename Source>
+void BasicRTree3D<Source>::refineNode(NodeId node) {
+    if (pool[pool.getChildren(node)[0]].isLeaf()) {
+        for (size_t i = 0; i < pool[node].count; ++i) {
+            refitLeaf(node, pool.getChildren(node)[i]);
+        }
+    }
+    for (size_t i = 0; i < pool[node].count; ++i) {
+        for (size_t moves = 0; moves < maxChildren && moveBoundaryEntry(node, i); ++moves) {
+        }
+    }
+    pool.recalculateMBR(node);
+}
+
+// MBR записей листа строятся заново по текущим треугольникам; лист копируется,
+// только если какой-то из них изменился
+template <typename Source>
+void BasicRTree3D<Source>::refitLeaf(NodeId parent, NodeId leaf) {
+    const size_t count = pool[leaf].count;
+    size_t first = 0;
+    for (; first < count; ++first) {
+        const MBR box = boxOf(Item{ pool.getEntries(leaf)[first], pool.getHandles(leaf)[first] });
+        const MBR stored = pool.getBox(leaf, first);
+        if (!(box.min == stored.min && box.max == stored.max)) break;
+    }
+    if (first == count) return;
+
+    leaf = writableChild(parent, leaf);
+    for (size_t i = first; i < count; ++i) {
+        const Entry entry = pool.getEntries(leaf)[i];
+        pool.setEntry(leaf, i, entry, boxOf(Item{ entry, pool.getHandles(leaf)[i] }));
+    }
+    pool.recalculateMBR(leaf);
+}
+
+// Переносит из потомка from в соседний потомок запись с границы его MBR, если сжатие from
+// перекрывает рост соседа по площади. Аналог поворотов AABB-деревьев, сохраняющий уровни
+template <typename Source>
+bool BasicRTree3D<Source>::moveBoundaryEntry(NodeId node, size_t from) {
+    // Перенос, выигрывающий меньше этой доли площади, не стоит копирования узлов
+    constexpr float MIN_GAIN = 0.01f;
+
+    NodeId donor = pool.getChildren(node)[from];
+    const size_t count = pool[donor].count;
+    if (count <= std::max<size_t>(minChildren, 1)) return false;
+
+    const MBR& donorBox = pool[donor].mbr;
+    float bestGain = donorBox.area() * MIN_GAIN;
+    size_t bestEntry = count, bestTarget = 0;
+    for (size_t e = 0; e < count; ++e) {
+        const MBR box = pool.getBox(donor, e);
+        if (box.min.x > donorBox.min.x && box.min.y > donorBox.min.y && box.min.z > donorBox.min.z &&
+            box.max.x < donorBox.max.x && box.max.y < donorBox.max.y && box.max.z < donorBox.max.z) {
+            continue;
+        }
+        MBR rest;
+        for (size_t k = 0; k < count; ++k) {
+            if (k != e) rest.expandToInclude(pool.getBox(donor, k));
+        }
+        const float shrink = donorBox.area() - rest.area();
+        if (shrink <= bestGain) continue;
+
+        const auto siblings = pool.getChildren(node);
+        for (size_t j = 0; j < siblings.size(); ++j) {
+            const RTreeNode& target = pool[siblings[j]];
+            if (j == from || target.count >= maxChildren) continue;
+            const float gain = shrink - (MBR::combine(target.mbr, box).area() - target.mbr.area());
+            if (gain > bestGain) {
+                bestGain = gain;
+                bestEntry = e;
+                bestTarget = j;
+            }
+        }
+    }
+    if (bestEntry == count) return false;
+
+    donor = writableChild(node, donor);
+    const NodeId target = writableChild(node, pool.getChildren(node)[bestTarget]);
+    if (pool[donor].isLeaf()) {
+        const Entry entry = pool.getEntries(donor)[bestEntry];
+        const EntryHandle handle = pool.getHandles(donor)[bestEntry];
+        const MBR box = pool.getBox(donor, bestEntry);
+        pool.removeHandle(donor, handle);
+        pool.addEntry(target, entry, box, handle);
+    } else {
+        const NodeId child = pool.getChildren(donor)[bestEntry];
+        pool.removeChild(donor, child);
+        pool.recalculateMBR(donor);
+        pool.addChild(target, child);
+    }
+    return true;
+}
+
+// Следующий внутренний узел в порядке обхода в глубину; после последнего — снова корень
+template <typename Source>
+void BasicRTree3D<Source>::advanceRefineCursor(const std::vector<NodeId>& path) {
+    if (!pool[pool.getChildren(path.back())[0]].isLeaf()) {
+        refineCursor.push_back(0);
+        return;
+    }
+    while (!refineCursor.empty()) {
+        const size_t depth = refineCursor.size() - 1;
+        if (refineCursor[depth] + 1 < pool[path[depth]].count) {
+            ++refineCursor[depth];
+            return;
+        }
+        refineCursor.pop_back();
+    }
+}
+
+// Путь от корня делается изменяемым сверху вниз; path получает идентификаторы копий
+template <typename Source>
+void BasicRTree3D<Source>::writablePath(std::vector<NodeId>& path) {
+    path[0] = root = writable(root);
+    for (size_t i = 1; i < path.size(); ++i) {
+        path[i] = writableChild(path[i - 1], path[i]);
+    }
+}
+
+// Путь от корня до leaf по ссылкам на родителей; false, если лист не в дереве
+template <typename Source>
+bool BasicRTree3D<Source>::pathToRoot(NodeId leaf, std::vector<NodeId>& path) const {
+    path.clear();
+    if (leaf == NULL_NODE) return false;
+    for (NodeId node = leaf;; node = pool[node].parent) {
+        if (node == NULL_NODE) return false;
+        path.push_back(node);
+        if (node == root) break;
+    }
+    std::reverse(path.begin(), path.end());
+    return true;
+}
+
+// Удаляет из листа path.back() записи, равные *target, или запись с дескриптором handle
+// и сжимает путь: узлы с недобором расформировываются, их записи перевставляются
+template <typename Source>
+void BasicRTree3D<Source>::removeAlongPath(std::vector<NodeId>& path, const Entry* target, EntryHandle handle) {
+    // Путь до листа делаем изменяемым сверху вниз, затем сжимаем снизу вверх
+    writablePath(path);
+    if (target) {
+        pool.removeEntry(path.back(), *target);
+    } else {
+        pool.removeHandle(path.back(), handle);
+    }
 
-    if (!root->isLeaf()) {
-        auto internal = std::dynamic_pointer_cast<RTreeInnerNode>(root);
-        if (internal->getChildren().size() == 1) {
-            root = internal->getChildren()[0];
+    auto& reinserts = scratch.reinserts;
+    reinserts.clear();
+    for (size_t i = path.size() - 1; i > 0; --i) {
+        const NodeId child = path[i];
+        const NodeId node = path[i - 1];
+        if (pool[child].count < minChildren) {
+            // Элементов слишком мало — реинсертим
+            collectAllTriangles(child, reinserts);
+            pool.removeChild(node, child);
+            releaseSubtree(child);
+        }
+        pool.recalculateMBR(node);
+    }
+
+    if (!pool[root].isLeaf()) {
+        const auto children = pool.getChildren(root);
+        if (children.size() == 1) {
+            NodeId oldRoot = root;
+            root = children[0];
+            retire(oldRoot);
+        } else if (children.empty()) {
+            retire(root);
+            root = allocateNode(NodeKind::Leaf);
         }
     }
 
     // Перевставка треугольников
     for (auto& tri : reinserts) {
-        insert(tri);
+        insertEntry(tri);
+    }
+}
+
+template <typename Source>
+std::vector<EntryHandle> BasicRTree3D<Source>::insertBatch(std::span<const Entry> triangles) {
+    const auto lock = lockWriters();
+    std::vector<Item> items(triangles.size());
+    std::vector<EntryHandle> handles(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        handles[i] = pool.allocateHandle();
+        items[i] = { triangles[i], handles[i] };
+    }
+    insertEntries(items);
+    publish();
+    return handles;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::removeBatch(std::span<const Entry> targets) {
+    const auto lock = lockWriters();
+    if (targets.empty()) return;
+
+    std::vector<MBR> boxes;
+    boxes.reserve(targets.size());
+    for (const auto& target : targets) {
+        boxes.push_back(boxOf(target));
+    }
+    const auto items = spatialOrder(boxes);
+    std::vector<char> found(targets.size(), 0);
+    std::vector<Item> orphans;
+    bool changed = false;
+    root = removeBatchNode(root, { targets, boxes }, items, found, orphans, changed);
+    if (!changed) return;
+
+    while (!pool[root].isLeaf() && pool[root].count == 1) {
+        NodeId oldRoot = root;
+        root = pool.getChildren(root)[0];
+        retire(oldRoot);
     }
+    if (!pool[root].isLeaf() && pool[root].count == 0) {
+        retire(root);
+        root = allocateNode(NodeKind::Leaf);
+    }
+
+    // Треугольники расформированных узлов возвращаются одним пакетом
+    insertEntries(orphans);
+    publish();
 }
 
-std::vector<Triangle3D> RTree3D::find(const MBR& searchMBR) const {
-    std::vector<Triangle3D> result;
-    find(root, searchMBR, result);
+template <typename Source>
+std::vector<typename Source::Entry> BasicRTree3D<Source>::find(const MBR& searchMBR, QueryMode mode) const {
+    std::vector<Entry> result;
+    query(searchMBR, [&](const Entry& triangle) {
+        result.push_back(triangle);
+    }, mode);
     return result;
 }
 
-void RTree3D::buildTree(const std::vector<Triangle3D>& triangles) {
-    if (triangles.size() <= maxChildren) {
-        auto leaf = std::make_shared<RTreeLeaf>();
-        for (const auto& tri : triangles) {
-            leaf->addTriangle(tri);
+template <typename Source>
+RTreeQueryRange<typename Source::Entry> BasicRTree3D<Source>::query(const MBR& searchMBR) const {
+    auto guard = pin();
+    return { pool, currentRoot(), searchMBR, std::move(guard) };
+}
+
+template <typename Source>
+typename BasicRTree3D<Source>::BatchResult BasicRTree3D<Source>::findBatch(std::span<const MBR> queries, QueryOrder order, QueryMode mode) const {
+    BatchResult result;
+    result.offsets.assign(queries.size() + 1, 0);
+    if (queries.empty()) return result;
+
+    std::vector<std::uint32_t> sequence;
+    if (order == QueryOrder::Morton) {
+        sequence = spatialOrder(queries);
+    }
+
+    // Каждый поток складывает попадания в свой буфер и запоминает, где лежит ответ запроса;
+    // затем ответы переносятся в общий массив в исходном порядке
+    struct alignas(64) WorkerHits {
+        std::vector<Entry> hits;
+    };
+    struct Location {
+        std::uint32_t worker;
+        std::uint32_t count;
+        size_t first;
+    };
+
+    auto& workers = WorkStealingPool::instance();
+    std::vector<WorkerHits> buffers(workers.size());
+    std::vector<Location> locations(queries.size());
+
+    const auto guard = pin();
+    const NodeId start = currentRoot();
+    workers.run(queries.size(), 64, [&](size_t begin, size_t end, size_t worker) {
+        const QueryStatsScope scope(counters);
+        countQuery(&QueryStats::queries, end - begin);
+        auto& hits = buffers[worker].hits;
+        auto collect = [&hits](const Entry& triangle) {
+            hits.push_back(triangle);
+        };
+        for (size_t k = begin; k < end; ++k) {
+            const size_t q = sequence.empty() ? k : sequence[k];
+            const size_t first = hits.size();
+            queryNode(start, queries[q], collect, mode);
+            locations[q] = { static_cast<std::uint32_t>(worker), static_cast<std::uint32_t>(hits.size() - first), first };
         }
-        root = leaf;
-    } else {
-        if (triangles.empty()) return;
-        size_t levels = std::ceil(log(triangles.size()) / log(maxChildren)) - 1;
+    });
 
-        root = std::make_shared<RTreeInnerNode>();
-        buildNode(root, levels - 1, triangles);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        result.offsets[q + 1] = result.offsets[q] + locations[q].count;
     }
+    result.hits.resize(result.offsets.back());
+    parallelFor(queries.size(), 1024, [&](size_t q) {
+        const auto& location = locations[q];
+        const auto& hits = buffers[location.worker].hits;
+        std::copy_n(hits.begin() + location.first, location.count, result.hits.begin() + result.offsets[q]);
+    });
+    return result;
 }
 
-void RTree3D::buildNode(std::shared_ptr<RTreeNode> node, size_t level, const std::vector<Triangle3D>& triangles) {
-    if (level == 0) {
-        size_t childrenCount = std::ceil(std::pow(triangles.size(), 1.0f / (level + 2)));
-        auto groups = splitIntoGroups(triangles, childrenCount, level);
+template <typename Source>
+typename BasicRTree3D<Source>::BatchResult BasicRTree3D<Source>::cullFrustumBatch(std::span<const Frustum> frustums) const {
+    BatchResult result;
+    result.offsets.assign(frustums.size() + 1, 0);
+    if (frustums.empty()) return result;
+
+    struct alignas(64) WorkerHits {
+        std::vector<Entry> hits;
+    };
+    struct Location {
+        std::uint32_t worker;
+        size_t count;
+        size_t first;
+    };
 
-        for (const auto& group : groups) {
-            auto newLeaf = std::make_shared<RTreeLeaf>();
-            for (const auto& tri : group) {
-                newLeaf->addTriangle(tri);
+    const auto guard = pin();
+    const NodeId start = currentRoot();
+    const size_t count = pool[start].count;
+    auto& workers = WorkStealingPool::instance();
+    // Пирамид мало — задача: пирамида и один потомок корня, иначе пирамида целиком
+    const bool split = !pool[start].isLeaf() && count > 1 && frustums.size() < 4 * workers.size();
+    const size_t parts = split ? count : 1;
+    const std::uint32_t allPlanes = (1u << std::tuple_size_v<Frustum>) - 1;
+
+    std::vector<WorkerHits> buffers(workers.size());
+    std::vector<Location> locations(frustums.size() * parts);
+    workers.run(locations.size(), 1, [&](size_t begin, size_t end, size_t worker) {
+        const QueryStatsScope scope(counters);
+        auto& hits = buffers[worker].hits;
+        auto collect = [&hits](const Entry& triangle) {
+            hits.push_back(triangle);
+        };
+        for (size_t task = begin; task < end; ++task) {
+            const size_t part = task % parts;
+            if (part == 0) countQuery(&QueryStats::queries);
+            const size_t first = hits.size();
+            if (parts == 1) {
+                cullNode(start, 0, count, frustums[task / parts], allPlanes, collect);
+            } else {
+                cullNode(start, part, part + 1, frustums[task / parts], allPlanes, collect);
             }
-            auto inner = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-            inner->insert(newLeaf);
+            locations[task] = { static_cast<std::uint32_t>(worker), hits.size() - first, first };
         }
-        return;
+    });
+
+    // Задачи идут по пирамидам, поэтому смещения задач сразу дают смещения пирамид
+    std::vector<size_t> taskOffsets(locations.size() + 1, 0);
+    for (size_t task = 0; task < locations.size(); ++task) {
+        taskOffsets[task + 1] = taskOffsets[task] + locations[task].count;
+    }
+    for (size_t f = 0; f <= frustums.size(); ++f) {
+        result.offsets[f] = taskOffsets[f * parts];
     }
+    result.hits.resize(taskOffsets.back());
+    parallelFor(locations.size(), 64, [&](size_t task) {
+        const auto& location = locations[task];
+        const auto& hits = buffers[location.worker].hits;
+        std::copy_n(hits.begin() + location.first, location.count, result.hits.begin() + taskOffsets[task]);
+    });
+    return result;
+}
 
-    size_t childrenCount = std::ceil(std::pow(triangles.size(), 1.0f / (level + 2)));
-    auto groups = splitIntoGroups(triangles, childrenCount, level);
+template <typename Source>
+std::vector<typename BasicRTree3D<Source>::Neighbor> BasicRTree3D<Source>::nearest(const Point3D& point, size_t k, float maxDistance) const {
+    const auto guard = pin();
+    return nearestFrom(currentRoot(), point, k, maxDistance);
+}
 
-    auto internal = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-    for (const auto& group : groups) {
-        auto child = std::make_shared<RTreeInnerNode>();
-        internal->insert(child);
-        buildNode(child, level - 1, group);
-        internal->recalculateMBR();
+template <typename Source>
+typename BasicRTree3D<Source>::Snapshot BasicRTree3D<Source>::snapshot() {
+    const auto lock = lockWriters();
+    {
+        const std::lock_guard guard(snapshotMutex);
+        ++snapshots[version];
+        ++liveSnapshots;
     }
-    internal->recalculateMBR();
+    return Snapshot(this, root, version);
 }
 
-std::vector<std::vector<Triangle3D>> RTree3D::splitIntoGroups(const std::vector<Triangle3D>& triangles, size_t groupCount, int level) {
-    struct Group {
-        std::vector<Triangle3D> triangles;
+template <typename Source>
+std::vector<typename BasicRTree3D<Source>::Neighbor> BasicRTree3D<Source>::nearestFrom(NodeId start, const Point3D& point, size_t k, float maxDistance) const {
+    // Кандидат очереди: узел (index == NODE_ENTRY) или треугольник index листа node
+    struct Candidate {
+        float distance;
+        NodeId node;
+        std::uint32_t index;
+
+        bool operator>(const Candidate& other) const {
+            return distance > other.distance;
+        }
     };
+    constexpr std::uint32_t NODE_ENTRY = std::numeric_limits<std::uint32_t>::max();
 
-    if (triangles.empty() || groupCount == 0) {
-        return {};
+    std::vector<Neighbor> result;
+    if (k == 0 || maxDistance < 0.0f) return result;
+
+    const QueryStatsScope scope(counters);
+    countQuery(&QueryStats::queries);
+
+    // Листья, раскрытые обходом, и листья, давшие результат: для подсчёта ложных спусков
+    [[maybe_unused]] size_t expandedLeaves = 0;
+    [[maybe_unused]] std::vector<NodeId> resultLeaves;
+
+    // Обход по возрастанию минимального расстояния: треугольник, извлечённый из очереди,
+    // не дальше любого ещё не раскрытого узла
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> queue;
+    queue.push({ std::sqrt(pool[start].mbr.squaredDistance(point)), start, NODE_ENTRY });
+
+    while (!queue.empty() && result.size() < k) {
+        const Candidate top = queue.top();
+        queue.pop();
+        if (top.distance > maxDistance) break;
+
+        if (top.index != NODE_ENTRY) {
+            result.push_back({ pool.getEntries(top.node)[top.index], top.distance });
+            if constexpr (QUERY_STATS_ENABLED) resultLeaves.push_back(top.node);
+            continue;
+        }
+
+        countQuery(&QueryStats::nodesVisited);
+        if (pool[top.node].isLeaf()) {
+            const auto triangles = pool.getEntries(top.node);
+            countQuery(&QueryStats::triangleTests, triangles.size());
+            if constexpr (QUERY_STATS_ENABLED) ++expandedLeaves;
+            for (std::uint32_t i = 0; i < triangles.size(); ++i) {
+                const float distance = std::sqrt(squaredDistance(point, source.triangle(triangles[i])));
+                if (distance <= maxDistance) queue.push({ distance, top.node, i });
+            }
+        } else {
+            const auto children = pool.getChildren(top.node);
+            countQuery(&QueryStats::boxTests, children.size());
+            for (NodeId child : children) {
+                const float distance = std::sqrt(pool[child].mbr.squaredDistance(point));
+                if (distance <= maxDistance) queue.push({ distance, child, NODE_ENTRY });
+            }
+        }
     }
 
-    // Вычисляем глобальные min/max
-    MBR subtreeMBR = MBR(triangles);
+    if constexpr (QUERY_STATS_ENABLED) {
+        std::sort(resultLeaves.begin(), resultLeaves.end());
+        const size_t usedLeaves = std::unique(resultLeaves.begin(), resultLeaves.end()) - resultLeaves.begin();
+        countQuery(&QueryStats::hits, result.size());
+        countQuery(&QueryStats::falsePositives, expandedLeaves - usedLeaves);
+    }
+    return result;
+}
 
-    // Разбиение по одной координате
-    std::vector<Triangle3D> sorted = triangles;
+template <typename Source>
+std::vector<typename BasicRTree3D<Source>::Neighbor> BasicRTree3D<Source>::withinDistance(const Point3D& point, float maxDistance) const {
+    return nearest(point, std::numeric_limits<size_t>::max(), maxDistance);
+}
 
-    float dx = subtreeMBR.max.x - subtreeMBR.min.x;
-    float dy = subtreeMBR.max.y - subtreeMBR.min.y;
-    float dz = subtreeMBR.max.z - subtreeMBR.min.z;
+template <typename Source>
+std::optional<typename BasicRTree3D<Source>::RayHit> BasicRTree3D<Source>::raycast(const Point3D& origin, const Point3D& direction, float tMax) const {
+    return raycast(Ray{ origin, direction, tMax });
+}
 
-    if (dx >= dy && dx >= dz) {
-        std::sort(sorted.begin(), sorted.end(), [](const Triangle3D& t1, const Triangle3D& t2) {
-            float ca = (t1.a.x + t1.b.x + t1.c.x) / 3.0f;
-            float cb = (t2.a.x + t2.b.x + t2.c.x) / 3.0f;
-            return ca < cb;
-        });
-    } else if (dy >= dz) {
-        std::sort(sorted.begin(), sorted.end(), [](const Triangle3D& t1, const Triangle3D& t2) {
-            float ca = (t1.a.y + t1.b.y + t1.c.y) / 3.0f;
-            float cb = (t2.a.y + t2.b.y + t2.c.y) / 3.0f;
-            return ca < cb;
-        });
+template <typename Source>
+bool BasicRTree3D<Source>::occluded(const Point3D& origin, const Point3D& direction, float tMax) const {
+    return occluded(Ray{ origin, direction, tMax });
+}
+
+template <typename Source>
+std::vector<std::optional<typename BasicRTree3D<Source>::RayHit>> BasicRTree3D<Source>::raycast(std::span<const Ray> rays) const {
+    std::vector<std::optional<RayHit>> result(rays.size());
+    parallelFor(rays.size(), 256, [&](size_t i) {
+        result[i] = raycast(rays[i]);
+    });
+    return result;
+}
+
+template <typename Source>
+std::vector<std::uint8_t> BasicRTree3D<Source>::occluded(std::span<const Ray> rays) const {
+    std::vector<std::uint8_t> result(rays.size());
+    parallelFor(rays.size(), 256, [&](size_t i) {
+        result[i] = occluded(rays[i]);
+    });
+    return result;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::buildTree(const std::vector<Entry>& triangles, BulkLoadStrategy strategy) {
+    const auto lock = lockWriters();
+
+    // Старое дерево может обходиться читателями или снимками — его узлы уходят через publish
+    if (copying()) {
+        releaseSubtree(root);
     } else {
-        std::sort(sorted.begin(), sorted.end(), [](const Triangle3D& t1, const Triangle3D& t2) {
-            float ca = (t1.a.z + t1.b.z + t1.c.z) / 3.0f;
-            float cb = (t2.a.z + t2.b.z + t2.c.z) / 3.0f;
-            return ca < cb;
-        });
+        pool.clear();
     }
+    pool.resetHandles(triangles.size());
 
-    // Нарезаем на группы
-    const int maxTrianglesPerGroup = (level != 0)
-        ? pow(maxChildren, level + 1)
-        : maxChildren;
+    if (triangles.empty()) {
+        root = allocateNode(NodeKind::Leaf);
+        publish();
+        return;
+    }
+
+    const size_t leafCount = (triangles.size() + maxChildren - 1) / maxChildren;
+    pool.reserve(leafCount, leafCount / std::max<size_t>(maxChildren - 1, 1) + 1);
 
-    std::vector<Group> groups(groupCount);
+    std::vector<BulkEntry> entries(triangles.size());
+    std::vector<MBR> boxes(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        boxes[i] = boxOf(Item{ triangles[i], EntryHandle{ static_cast<std::uint32_t>(i) } });
+        entries[i] = { boxes[i].center(), 0, static_cast<std::uint32_t>(i) };
+    }
 
-    int idx = 0;
-    for (int i = 0; i < groupCount; ++i) {
-        for (int j = 0; j < maxTrianglesPerGroup && idx < sorted.size(); ++j) {
-            groups[i].triangles.push_back(sorted[idx++]);
+    // Уровень листьев: подряд идущие треугольники упорядоченной последовательности
+    orderEntries(entries, strategy);
+    auto bounds = bulk::groupBounds(entries.size(), minChildren, maxChildren);
+
+    std::vector<NodeId> level;
+    level.reserve(bounds.size() - 1);
+    for (size_t g = 0; g + 1 < bounds.size(); ++g) {
+        NodeId leaf = allocateNode(NodeKind::Leaf);
+        for (size_t i = bounds[g]; i < bounds[g + 1]; ++i) {
+            const std::uint32_t index = entries[i].index;
+            pool.addEntry(leaf, triangles[index], boxes[index], EntryHandle{ index });
         }
+        level.push_back(leaf);
     }
 
-    // Приведение к нужному типу
-    std::vector<std::vector<Triangle3D>> result;
-    result.reserve(groups.size());
-    for (auto& group : groups) {
-        if (group.triangles.size() != 0) {
-            result.push_back(std::move(group.triangles));
+    // Верхние уровни упаковываются тем же способом по центрам MBR узлов
+    while (level.size() > 1) {
+        entries.resize(level.size());
+        for (size_t i = 0; i < level.size(); ++i) {
+            entries[i] = { pool[level[i]].mbr.center(), 0, static_cast<std::uint32_t>(i) };
         }
+
+        orderEntries(entries, strategy);
+        bounds = bulk::groupBounds(entries.size(), minChildren, maxChildren);
+
+        std::vector<NodeId> parents;
+        parents.reserve(bounds.size() - 1);
+        for (size_t g = 0; g + 1 < bounds.size(); ++g) {
+            NodeId parent = allocateNode(NodeKind::Inner);
+            for (size_t i = bounds[g]; i < bounds[g + 1]; ++i) {
+                pool.addChild(parent, level[entries[i].index]);
+            }
+            parents.push_back(parent);
+        }
+        level = std::move(parents);
     }
 
-    return result;
+    root = level[0];
+    publish();
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::orderEntries(std::vector<BulkEntry>& entries, BulkLoadStrategy strategy) const {
+    if (strategy == BulkLoadStrategy::SortTileRecursive) {
+        sortTileRecursive(entries);
+        return;
+    }
+
+    MBR bounds;
+    for (const auto& entry : entries) {
+        bounds.expandToInclude(entry.center);
+    }
+    for (auto& entry : entries) {
+        entry.key = strategy == BulkLoadStrategy::Hilbert
+            ? curve::hilbert(entry.center, bounds)
+            : curve::morton(entry.center, bounds);
+    }
+    std::sort(entries.begin(), entries.end(), [](const BulkEntry& e1, const BulkEntry& e2) {
+        return e1.key < e2.key;
+    });
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::sortTileRecursive(std::span<BulkEntry> entries) const {
+    bulk::sortTileRecursive(entries, 3, maxChildren, [](const BulkEntry& e, size_t axis) {
+        return axis == 0 ? e.center.x : axis == 1 ? e.center.y : e.center.z;
+    });
 }
 
-void RTree3D::exportToSVG(const std::string& filename, float scale) const {
+template <typename Source>
+void BasicRTree3D<Source>::exportToSVG(const std::string& filename, float scale) const {
     std::ofstream file(filename);
     if (!file.is_open()) return;
 
     file << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n";
-    drawNode(root, file, scale);
+    const auto guard = pin();
+    drawNode(currentRoot(), file, scale);
     file << "</svg>\n";
 }
 
-void RTree3D::drawNode(const std::shared_ptr<RTreeNode>& node, std::ofstream& file, float scale) const {
+namespace {
+
+// Буферизованная запись в файл с подсчётом контрольной суммы записанного
+class ChecksumWriter {
+    static constexpr size_t CHUNK = 1 << 20;
+
+    std::ofstream& file;
+    std::vector<char> pending;
+    std::uint64_t hash = packed::checksum(nullptr, 0);
+    std::uint64_t written = 0;
+
+public:
+    explicit ChecksumWriter(std::ofstream& file) : file(file) {
+        pending.reserve(CHUNK + 64);
+    }
+
+    void write(const void* data, size_t size) {
+        const auto* bytes = static_cast<const char*>(data);
+        pending.insert(pending.end(), bytes, bytes + size);
+        written += size;
+        if (pending.size() >= CHUNK) flush(false);
+    }
+
+    template <typename T>
+    void write(const T& value) {
+        write(&value, sizeof(T));
+    }
+
+    // Дописывает нули до смещения offset от начала данных
+    void padTo(std::uint64_t offset) {
+        static constexpr char zeros[packed::ALIGNMENT] = {};
+        while (written < offset) {
+            write(zeros, std::min<std::uint64_t>(offset - written, sizeof(zeros)));
+        }
+    }
+
+    // Сумма считается словами по 8 байт, поэтому до конца передаётся только кратная часть
+    void flush(bool final) {
+        const size_t size = final ? pending.size() : pending.size() / 8 * 8;
+        hash = packed::checksum(pending.data(), size, hash);
+        file.write(pending.data(), static_cast<std::streamsize>(size));
+        pending.erase(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(size));
+    }
+
+    std::uint64_t checksum() const {
+        return hash;
+    }
+};
+
+} // namespace
+
+template <typename Source>
+bool BasicRTree3D<Source>::save(const std::string& filename, BoxEncoding encoding) const {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+
+    const auto guard = pin();
+
+    // Порядок обхода в ширину: потомки каждого узла получают соседние индексы
+    std::vector<NodeId> order{ currentRoot() };
+    std::vector<packed::PackedNode> nodes;
+    size_t leafBegin = SIZE_MAX;
+    std::uint64_t triangleCount = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const auto& node = pool[order[i]];
+        if (node.isLeaf()) {
+            leafBegin = std::min(leafBegin, i);
+            nodes.push_back({ static_cast<std::uint32_t>(triangleCount), node.count });
+            triangleCount += node.count;
+        } else {
+            nodes.push_back({ static_cast<std::uint32_t>(order.size()), node.count });
+            const auto children = pool.getChildren(order[i]);
+            order.insert(order.end(), children.begin(), children.end());
+        }
+    }
+    if (order.size() > UINT32_MAX || triangleCount > UINT32_MAX) return false;
+    // Глубина листьев по сохраняемому порядку: дерево могло измениться после pin
+    size_t leafDepth = 0;
+    for (size_t i = 0; i < leafBegin; i = nodes[i].first) ++leafDepth;
+    if (leafDepth > packed::MAX_HEIGHT) return false;
+
+    const std::uint32_t boxBits = encoding == BoxEncoding::Quantized16 ? 16 :
+                                  encoding == BoxEncoding::Quantized8 ? 8 : 32;
+    const std::uint32_t levels = (1u << (boxBits % 32)) - 1;
+    const MBR& rootBox = pool[order[0]].mbr;
+
+    packed::Header header{};
+    std::copy(std::begin(packed::MAGIC), std::end(packed::MAGIC), header.magic);
+    header.version = packed::VERSION;
+    header.byteOrder = packed::ENDIAN_TAG;
+    header.maxChildren = static_cast<std::uint32_t>(maxChildren);
+    header.height = static_cast<std::uint32_t>(leafDepth);
+    header.boxBits = boxBits;
+    const float rootCoordinates[6] = { rootBox.min.x, rootBox.min.y, rootBox.min.z,
+                                       rootBox.max.x, rootBox.max.y, rootBox.max.z };
+    std::copy(std::begin(rootCoordinates), std::end(rootCoordinates), header.rootBox);
+    header.nodeCount = order.size();
+    header.leafBegin = leafBegin;
+    header.triangleCount = triangleCount;
+    header.nodesOffset = packed::align(sizeof(packed::Header));
+    header.nodeBoxesOffset = packed::align(header.nodesOffset + order.size() * sizeof(packed::PackedNode));
+    header.trianglesOffset = header.nodeBoxesOffset + packed::boxesSize(order.size(), boxBits);
+    header.triangleBoxesOffset = packed::align(header.trianglesOffset + triangleCount * sizeof(Triangle3D));
+    header.fileSize = header.triangleBoxesOffset + packed::boxesSize(triangleCount, boxBits);
+
+    // Рамки квантования сверху вниз: потомки узла i кодируются в frames[i], построенной
+    // по восстановленному прямоугольнику узла — ровно так же их будет декодировать MappedRTree
+    std::vector<packed::Frame> frames;
+    std::vector<std::uint32_t> parents;
+    if (boxBits != 32) {
+        frames.resize(order.size());
+        parents.assign(order.size(), 0);
+        frames[0] = packed::makeFrame(rootBox, levels);
+        for (size_t i = 0; i < leafBegin; ++i) {
+            for (std::uint32_t c = nodes[i].first; c < nodes[i].first + nodes[i].count; ++c) {
+                parents[c] = static_cast<std::uint32_t>(i);
+                const auto quantized = packed::quantize(frames[i], pool[order[c]].mbr, levels);
+                frames[c] = packed::makeFrame(packed::dequantize(frames[i], quantized), levels);
+            }
+        }
+    }
+
+    // Заголовок перезаписывается в конце, когда контрольная сумма данных известна
+    const std::vector<char> headerBytes(header.nodesOffset);
+    file.write(headerBytes.data(), static_cast<std::streamsize>(headerBytes.size()));
+    ChecksumWriter writer(file);
+    writer.write(nodes.data(), nodes.size() * sizeof(packed::PackedNode));
+
+    // Координаты прямоугольников — шестью отдельными массивами, хвост заполнен пустыми MBR.
+    // forEachBox(emit) вызывает emit(box, frame) с рамкой, в которой квантуется box.
+    const std::array<std::pair<Point3D MBR::*, float Point3D::*>, 6> coordinates = { {
+        { &MBR::min, &Point3D::x }, { &MBR::min, &Point3D::y }, { &MBR::min, &Point3D::z },
+        { &MBR::max, &Point3D::x }, { &MBR::max, &Point3D::y }, { &MBR::max, &Point3D::z },
+    } };
+    const auto writeBoxes = [&](std::uint64_t count, auto&& forEachBox) {
+        const MBR empty;
+        const std::uint64_t stride = packed::boxStride(count, boxBits);
+        for (size_t c = 0; c < coordinates.size(); ++c) {
+            const auto [corner, axis] = coordinates[c];
+            forEachBox([&](const MBR& box, const packed::Frame& frame) {
+                if (boxBits == 32) {
+                    writer.write(box.*corner.*axis);
+                    return;
+                }
+                const std::uint32_t value = packed::quantize(frame, box, levels)[c];
+                if (boxBits == 16) {
+                    writer.write(static_cast<std::uint16_t>(value));
+                } else {
+                    writer.write(static_cast<std::uint8_t>(value));
+                }
+            });
+            for (std::uint64_t i = count; i < stride; ++i) {
+                if (boxBits == 32) {
+                    writer.write(empty.*corner.*axis);
+                } else {
+                    const std::uint16_t zero = 0;
+                    writer.write(&zero, boxBits / 8);
+                }
+            }
+        }
+    };
+    const packed::Frame unused{};
+
+    writer.padTo(header.nodeBoxesOffset - header.nodesOffset);
+    writeBoxes(order.size(), [&](auto&& emit) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            emit(pool[order[i]].mbr, frames.empty() ? unused : frames[parents[i]]);
+        }
+    });
+
+    writer.padTo(header.trianglesOffset - header.nodesOffset);
+    for (size_t i = leafBegin; i < order.size(); ++i) {
+        for (const auto& entry : pool.getEntries(order[i])) {
+            const Triangle3D& triangle = source.triangle(entry);
+            writer.write(triangle);
+        }
+    }
+
+    writer.padTo(header.triangleBoxesOffset - header.nodesOffset);
+    // В файл идут точные MBR треугольников, даже если в листьях они хранятся с запасом
+    writeBoxes(triangleCount, [&](auto&& emit) {
+        for (size_t i = leafBegin; i < order.size(); ++i) {
+            for (const auto& entry : pool.getEntries(order[i])) {
+                emit(boxOf(entry), frames.empty() ? unused : frames[i]);
+            }
+        }
+    });
+    writer.flush(true);
+
+    header.payloadChecksum = writer.checksum();
+    header.headerChecksum = packed::headerChecksum(header);
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return static_cast<bool>(file.flush());
+}
+
+template <typename Source>
+QueryStats BasicRTree3D<Source>::queryStats() const {
+    return counters.load();
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::resetQueryStats() {
+    counters.reset();
+}
+
+template <typename Source>
+TreeStats BasicRTree3D<Source>::stats() const {
+    TreeStats result;
+    const auto guard = pin();
+
+    // Уровни обходятся сверху вниз; перекрытие записей узла относится к уровню ниже
+    std::vector<NodeId> level{ currentRoot() }, next;
+    std::vector<MBR> boxes;
+    double childOverlapVolume = 0.0, childOverlapArea = 0.0;
+    while (!level.empty()) {
+        LevelStats stats;
+        stats.overlapVolume = childOverlapVolume;
+        stats.overlapArea = childOverlapArea;
+        childOverlapVolume = childOverlapArea = 0.0;
+        next.clear();
+
+        for (NodeId node : level) {
+            const RTreeNode& n = pool[node];
+            ++stats.nodes;
+            stats.entries += n.count;
+
+            boxes.clear();
+            const MBRBlock& block = pool.getBoxes(node);
+            const size_t first = pool.boxOffset(node);
+            double entryVolume = 0.0, entryArea = 0.0;
+            for (size_t i = 0; i < n.count; ++i) {
+                boxes.push_back(block.get(first + i));
+                entryVolume += boxes.back().volume();
+                entryArea += boxes.back().area();
+            }
+            stats.deadVolume += std::max(0.0, double(n.mbr.volume()) - entryVolume);
+            stats.deadArea += std::max(0.0, double(n.mbr.area()) - entryArea);
+
+            if (n.isLeaf()) continue;
+            for (size_t i = 0; i < boxes.size(); ++i) {
+                for (size_t j = i + 1; j < boxes.size(); ++j) {
+                    if (!boxes[i].intersects(boxes[j])) continue;
+                    MBR common;
+                    common.min = { std::max(boxes[i].min.x, boxes[j].min.x), std::max(boxes[i].min.y, boxes[j].min.y),
+                                   std::max(boxes[i].min.z, boxes[j].min.z) };
+                    common.max = { std::min(boxes[i].max.x, boxes[j].max.x), std::min(boxes[i].max.y, boxes[j].max.y),
+                                   std::min(boxes[i].max.z, boxes[j].max.z) };
+                    childOverlapVolume += common.volume();
+                    childOverlapArea += common.area();
+                }
+            }
+            const auto children = pool.getChildren(node);
+            next.insert(next.end(), children.begin(), children.end());
+        }
+
+        stats.fill = double(stats.entries) / double(stats.nodes * maxChildren);
+        result.nodes += stats.nodes;
+        if (pool[level.front()].isLeaf()) result.entries = stats.entries;
+        result.levels.push_back(stats);
+        std::swap(level, next);
+    }
+
+    std::reverse(result.levels.begin(), result.levels.end());
+    result.height = result.levels.size();
+    result.memoryBytes = sizeof(*this) + pool.memoryUsage() + pendingRetire.capacity() * sizeof(NodeId) +
+                         retired.capacity() * sizeof(retired[0]) + retained.capacity() * sizeof(Retained);
+    result.retainedNodes = retained.size();
+    return result;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::drawNode(NodeId node, std::ofstream& file, float scale) const {
     const float offset = 500;
-    if (!node) return;
+    if (node == NULL_NODE) return;
 
-    if (!node->isLeaf()) {
-        auto internal = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-        // Нарисовать MBR
-        const auto& mbr = internal->getMBR();
-        float x = mbr.min.x * scale;
-        float y = -mbr.max.y * scale; // SVG: ось Y направлена вниз
-        float width = (mbr.max.x - mbr.min.x) * scale;
-        float height = (mbr.max.y - mbr.min.y) * scale;
+    // Нарисовать MBR
+    const auto& mbr = pool[node].mbr;
+    float x = mbr.min.x * scale;
+    float y = -mbr.max.y * scale; // SVG: ось Y направлена вниз
+    float width = (mbr.max.x - mbr.min.x) * scale;
+    float height = (mbr.max.y - mbr.min.y) * scale;
 
-        file << "<rect x=\"" << x + offset << "\" y=\"" << y + offset << "\" width=\"" << width << "\" height=\"" << height
-             << "\" fill=\"none\" stroke=\"black\" stroke-dasharray=\"13,9\" stroke-width=\"2\"/>\n";
+    file << "<rect x=\"" << x + offset << "\" y=\"" << y + offset << "\" width=\"" << width << "\" height=\"" << height
+         << "\" fill=\"none\" stroke=\"black\" stroke-dasharray=\"13,9\" stroke-width=\"2\"/>\n";
 
-        for (const auto& child : internal->getChildren()) {
+    if (!pool[node].isLeaf()) {
+        for (NodeId child : pool.getChildren(node)) {
             drawNode(child, file, scale);
         }
     } else {
-        auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-        // Нарисовать MBR
-        const auto& mbr = leaf->getMBR();
-        float x = mbr.min.x * scale;
-        float y = -mbr.max.y * scale;
-        float width = (mbr.max.x - mbr.min.x) * scale;
-        float height = (mbr.max.y - mbr.min.y) * scale;
-
-        file << "<rect x=\"" << x + offset << "\" y=\"" << y + offset << "\" width=\"" << width << "\" height=\"" << height
-             << "\" fill=\"none\" stroke=\"black\" stroke-dasharray=\"13,9\" stroke-width=\"2\"/>\n";
-
         // Нарисовать треугольники
-        for (const auto& tri : leaf->getTriangles()) {
+        for (const auto& entry : pool.getEntries(node)) {
+            const Triangle3D& tri = source.triangle(entry);
             file << "<polygon points=\""
                  << tri.a.x * scale + offset << "," << -tri.a.y * scale + offset << " "
                  << tri.b.x * scale + offset << "," << -tri.b.y * scale + offset << " "
@@ -211,159 +1148,540 @@ void RTree3D::drawNode(const std::shared_ptr<RTreeNode>& node, std::ofstream& fi
 
 // PRIVATE ----------------------------------------------------------------------------------------------------------------------
 
-std::shared_ptr<RTreeNode> RTree3D::insertRecursive(std::shared_ptr<RTreeNode> node, const Triangle3D& obj) {
-    if (node->isLeaf()) {
-        auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-        if (leaf->getTriangles().size() < maxChildren) {
-            leaf->addTriangle(obj);
-            return nullptr;
+template <typename Source>
+NodeId BasicRTree3D<Source>::currentRoot() const {
+    return publishedRoot.load(std::memory_order_acquire);
+}
+
+template <typename Source>
+EpochManager::Guard BasicRTree3D<Source>::pin() const {
+    return concurrency == Concurrency::CopyOnWrite ? epochs.pin() : EpochManager::Guard();
+}
+
+// Писатели выполняются по одному; без конкурентного режима блокировка не берётся
+template <typename Source>
+std::unique_lock<std::mutex> BasicRTree3D<Source>::lockWriters() {
+    if (concurrency == Concurrency::None) return {};
+    return std::unique_lock(writeMutex);
+}
+
+// Опубликованные узлы меняются только копированием, если их могут видеть читатели или снимки
+template <typename Source>
+bool BasicRTree3D<Source>::copying() const {
+    return concurrency == Concurrency::CopyOnWrite || liveSnapshots.load(std::memory_order_relaxed) > 0;
+}
+
+// Видит ли узел из версий [first, last] хотя бы один живой снимок; вызывается под snapshotMutex
+template <typename Source>
+bool BasicRTree3D<Source>::seenBySnapshot(std::uint64_t first, std::uint64_t last) const {
+    const auto it = snapshots.lower_bound(first);
+    return it != snapshots.end() && it->first <= last;
+}
+
+// Вызывается из любого потока; сами узлы освобождает следующий publish
+template <typename Source>
+void BasicRTree3D<Source>::releaseSnapshot(std::uint64_t snapshotVersion) const {
+    const std::lock_guard guard(snapshotMutex);
+    const auto it = snapshots.find(snapshotVersion);
+    if (--it->second == 0) snapshots.erase(it);
+    --liveSnapshots;
+    snapshotsReleased.store(true);
+}
+
+// Узел, который не видит ни один снимок: сразу в пул или, при CopyOnWrite, через эпохи
+template <typename Source>
+void BasicRTree3D<Source>::reclaim(NodeId node, std::uint64_t epoch) {
+    if (concurrency == Concurrency::None) {
+        pool.release(node);
+    } else {
+        retired.emplace_back(epoch, node);
+    }
+}
+
+template <typename Source>
+NodeId BasicRTree3D<Source>::allocateNode(NodeKind kind) {
+    NodeId node = pool.allocate(kind);
+    pool[node].version = version + 1;
+    return node;
+}
+
+// Опубликованный узел перед изменением копируется; ссылку на копию вставляет вызывающий
+template <typename Source>
+NodeId BasicRTree3D<Source>::writable(NodeId node) {
+    if (!copying() || pool[node].version > version) return node;
+
+    NodeId copy = pool.clone(node);
+    pool[copy].version = version + 1;
+    retire(node);
+    return copy;
+}
+
+template <typename Source>
+NodeId BasicRTree3D<Source>::writableChild(NodeId parent, NodeId child) {
+    NodeId copy = writable(child);
+    if (copy != child) pool.replaceChild(parent, child, copy);
+    return copy;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::retire(NodeId node) {
+    if (!copying()) {
+        pool.release(node);
+    } else {
+        pendingRetire.push_back(node);
+    }
+}
+
+// Завершает операцию записи: публикует корень как новую версию и возвращает в пул узлы,
+// которые не видит ни один читатель или снимок
+template <typename Source>
+void BasicRTree3D<Source>::publish() {
+    ++version;
+    publishedRoot.store(root);
+
+    // Эпоха читается после публикации: читатель, видевший старый корень, отмечен не позже неё
+    const std::uint64_t epoch = epochs.current();
+    const bool dropped = snapshotsReleased.exchange(false);
+    if (!pendingRetire.empty() || (dropped && !retained.empty())) {
+        const std::lock_guard guard(snapshotMutex);
+        // Снятый узел был в дереве с версии своего создания до предыдущей
+        for (NodeId node : pendingRetire) {
+            const std::uint64_t first = pool[node].version;
+            if (first < version && seenBySnapshot(first, version - 1)) {
+                retained.push_back({ first, version - 1, node });
+            } else {
+                reclaim(node, epoch);
+            }
+        }
+        pendingRetire.clear();
+        if (dropped) {
+            std::erase_if(retained, [&](const Retained& r) {
+                if (seenBySnapshot(r.first, r.last)) return false;
+                reclaim(r.node, epoch);
+                return true;
+            });
+        }
+    }
+    if (concurrency == Concurrency::None) return;
+
+    epochs.tryAdvance();
+    const std::uint64_t safe = epochs.current();
+    size_t released = 0;
+    while (released < retired.size() && retired[released].first + 2 <= safe) {
+        pool.release(retired[released++].second);
+    }
+    retired.erase(retired.begin(), retired.begin() + released);
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::insertEntry(const Item& obj) {
+    if (policy == InsertPolicy::RStar) {
+        scratch.reinserted.clear();
+        insertRStar(obj, NULL_NODE, 0, scratch.reinserted);
+        return;
+    }
+
+    root = writable(root);
+    NodeId newChild = insertRecursive(root, obj);
+
+    if (newChild != NULL_NODE) {
+        NodeId newRoot = allocateNode(NodeKind::Inner);
+        pool.addChild(newRoot, root);
+        pool.addChild(newRoot, newChild);
+        root = newRoot;
+    }
+}
+
+template <typename Source>
+NodeId BasicRTree3D<Source>::insertRecursive(NodeId node, const Item& obj) {
+    if (pool[node].isLeaf()) {
+        if (pool[node].count < maxChildren) {
+            pool.addEntry(node, obj.entry, boxOf(obj), obj.handle);
+            return NULL_NODE;
         }
-        return splitLeaf(leaf, obj);
+        return splitLeaf(node, obj);
     }
 
     // Найдём лучший дочерний узел для вставки
-    auto innerNode = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-    std::shared_ptr<RTreeNode> bestChild;
-    float minExpansion = std::numeric_limits<float>::infinity();
+    NodeId bestChild = writableChild(node, chooseSubtree(node, boxOf(obj), false));
+    NodeId newGrandChild = insertRecursive(bestChild, obj);
+
+    // Обработка нового потомка
+    if (newGrandChild != NULL_NODE) {
+        if (pool[node].count < maxChildren) {
+            pool.addChild(node, newGrandChild);
+        } else {
+            return splitInternal(node, newGrandChild); // дальше обрабатывается выше
+        }
+    }
+
+    pool.recalculateMBR(node);
+    return NULL_NODE;
+}
+
+// Квадратичная политика: минимальный прирост площади (см. QuadraticCost); R* — см. chooseSubtreeRStar
+template <typename Source>
+NodeId BasicRTree3D<Source>::chooseSubtree(NodeId node, const MBR& box, bool childrenAreLeaves) const {
+    if (policy == InsertPolicy::RStar) return chooseSubtreeRStar(node, box, childrenAreLeaves);
+
+    NodeId bestChild = NULL_NODE;
+    QuadraticCost minExpansion{ std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity() };
 
-    for (auto& child : innerNode->getChildren()) {
-        auto updatedMbr =  new MBR(child->getMBR());
-        float expansion = updatedMbr->expandToInclude(obj)->volume() - child->getMBR().volume();
+    for (NodeId child : pool.getChildren(node)) {
+        const QuadraticCost expansion = growth(pool[child].mbr, box);
         if (expansion < minExpansion) {
             minExpansion = expansion;
             bestChild = child;
         }
     }
+    return bestChild;
+}
 
-    std::shared_ptr<RTreeNode> newGrandChild = insertRecursive(bestChild, obj);
+template <typename Source>
+void BasicRTree3D<Source>::insertEntries(std::span<const Item> triangles) {
+    if (triangles.empty()) return;
 
-    // Обработка нового потомка
-    if (newGrandChild) {
-        if (innerNode->getChildren().size() < maxChildren) {
-            innerNode->insert(newGrandChild);
-        } else {
-            return std::dynamic_pointer_cast<RTreeNode>(splitInternal(innerNode, newGrandChild)); // дальше обрабатывается выше
+    std::vector<MBR> boxes;
+    boxes.reserve(triangles.size());
+    for (const auto& triangle : triangles) {
+        boxes.push_back(boxOf(triangle));
+    }
+    const auto items = spatialOrder(boxes);
+    root = writable(root);
+    growRoot(insertBatchNode(root, { triangles, boxes }, items, height()));
+}
+
+// Индексы прямоугольников в порядке кривой Мортона по их центрам: соседние в этом порядке
+// записи пакета попадают в одни и те же поддеревья
+template <typename Source>
+std::vector<std::uint32_t> BasicRTree3D<Source>::spatialOrder(std::span<const MBR> boxes) const {
+    MBR bounds;
+    for (const auto& box : boxes) {
+        bounds.expandToInclude(box.center());
+    }
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> keys(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        keys[i] = { curve::morton(boxes[i].center(), bounds), static_cast<std::uint32_t>(i) };
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<std::uint32_t> order(boxes.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        order[i] = keys[i].second;
+    }
+    return order;
+}
+
+// Раскладывает items по потомкам node, вставляет их рекурсивно и возвращает
+// новые узлы того же уровня, если node пришлось разбить
+template <typename Source>
+std::vector<NodeId> BasicRTree3D<Source>::insertBatchNode(NodeId node, const Batch& batch,
+                                             std::span<const std::uint32_t> items, size_t level) {
+    if (pool[node].isLeaf()) {
+        if (pool[node].count + items.size() <= maxChildren) {
+            for (std::uint32_t i : items) {
+                pool.addEntry(node, batch.items[i].entry, batch.boxes[i], batch.items[i].handle);
+            }
+            return {};
+        }
+
+        const auto triangles = pool.getEntries(node);
+        const auto handles = pool.getHandles(node);
+        OverflowEntries entries;
+        const MBRBlock& boxes = pool.getBoxes(node);
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            entries.triangles.push_back({ triangles[i], handles[i] });
+            entries.boxes.push_back(boxes.get(pool.boxOffset(node) + i));
+        }
+        for (std::uint32_t i : items) {
+            entries.triangles.push_back(batch.items[i]);
+            entries.boxes.push_back(batch.boxes[i]);
+        }
+        return splitPacked(node, entries);
+    }
+
+    // Потомок выбирается по MBR до вставки пакета; записи группируются по потомкам
+    const auto current = pool.getChildren(node);
+    const std::vector<NodeId> children(current.begin(), current.end());
+    std::vector<std::uint32_t> choice(items.size());
+    std::vector<size_t> bucketStart(children.size() + 1, 0);
+    for (size_t k = 0; k < items.size(); ++k) {
+        const NodeId best = chooseSubtree(node, batch.boxes[items[k]], level == 1);
+        choice[k] = static_cast<std::uint32_t>(std::find(children.begin(), children.end(), best) - children.begin());
+        ++bucketStart[choice[k] + 1];
+    }
+    for (size_t c = 0; c < children.size(); ++c) {
+        bucketStart[c + 1] += bucketStart[c];
+    }
+    std::vector<std::uint32_t> buckets(items.size());
+    std::vector<size_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+    for (size_t k = 0; k < items.size(); ++k) {
+        buckets[fill[choice[k]]++] = items[k];
+    }
+
+    std::vector<NodeId> added;
+    for (size_t c = 0; c < children.size(); ++c) {
+        if (bucketStart[c] == bucketStart[c + 1]) continue;
+        const NodeId child = writableChild(node, children[c]);
+        const auto bucket = std::span<const std::uint32_t>(buckets).subspan(bucketStart[c], bucketStart[c + 1] - bucketStart[c]);
+        const auto siblings = insertBatchNode(child, batch, bucket, level - 1);
+        added.insert(added.end(), siblings.begin(), siblings.end());
+    }
+
+    pool.recalculateMBR(node);
+    if (pool[node].count + added.size() <= maxChildren) {
+        for (NodeId sibling : added) {
+            pool.addChild(node, sibling);
+        }
+        return {};
+    }
+
+    const auto existing = pool.getChildren(node);
+    OverflowEntries entries;
+    entries.children.assign(existing.begin(), existing.end());
+    entries.children.insert(entries.children.end(), added.begin(), added.end());
+    for (NodeId child : entries.children) {
+        entries.boxes.push_back(pool[child].mbr);
+    }
+    return splitPacked(node, entries);
+}
+
+// Удаляет найденные targets[items] из поддерева. Узел копируется только если в нём
+// что-то изменилось; возвращается его актуальный идентификатор
+template <typename Source>
+NodeId BasicRTree3D<Source>::removeBatchNode(NodeId node, const Targets& targets, std::span<const std::uint32_t> items,
+                                std::vector<char>& found, std::vector<Item>& orphans, bool& changed) {
+    changed = false;
+    if (pool[node].isLeaf()) {
+        std::vector<Entry> matched;
+        const auto triangles = pool.getEntries(node);
+        for (std::uint32_t k : items) {
+            if (found[k]) continue;
+            if (std::find(triangles.begin(), triangles.end(), targets.triangles[k]) != triangles.end()) {
+                found[k] = 1;
+                matched.push_back(targets.triangles[k]);
+            }
+        }
+        if (matched.empty()) return node;
+
+        node = writable(node);
+        pool.removeEntriesIf(node, [&matched](const Entry& t) {
+            return std::find(matched.begin(), matched.end(), t) != matched.end();
+        });
+        changed = true;
+        return node;
+    }
+
+    const auto current = pool.getChildren(node);
+    const std::vector<NodeId> children(current.begin(), current.end());
+    std::vector<std::uint32_t> subset;
+    for (NodeId child : children) {
+        // идем только в те поддеревья, чьи MBR содержат треугольник
+        subset.clear();
+        for (std::uint32_t k : items) {
+            if (!found[k] && pool[child].mbr.contains(targets.boxes[k])) subset.push_back(k);
+        }
+        if (subset.empty()) continue;
+
+        bool childChanged = false;
+        const NodeId updated = removeBatchNode(child, targets, subset, found, orphans, childChanged);
+        if (!childChanged) continue;
+
+        if (!changed) {
+            node = writable(node);
+            changed = true;
+        }
+        if (updated != child) pool.replaceChild(node, child, updated);
+    }
+    if (!changed) return node;
+
+    // Потомки с недобором расформировываются, их треугольники перевставляются
+    const auto updatedChildren = pool.getChildren(node);
+    for (NodeId child : std::vector<NodeId>(updatedChildren.begin(), updatedChildren.end())) {
+        if (pool[child].count < minChildren) {
+            collectAllTriangles(child, orphans);
+            pool.removeChild(node, child);
+            releaseSubtree(child);
         }
     }
+    pool.recalculateMBR(node);
+    return node;
+}
+
+// Делит записи в порядке STR на наименьшее число групп поровну: первая группа — в node,
+// остальные — в новые узлы того же вида, которые и возвращаются. Узлы заполняются
+// наполовину и больше, так что следующие вставки и удаления не разбивают их сразу же
+template <typename Source>
+std::vector<NodeId> BasicRTree3D<Source>::splitPacked(NodeId node, const OverflowEntries& entries) {
+    const size_t count = entries.boxes.size();
+    std::vector<BulkEntry> bulk(count);
+    for (size_t i = 0; i < count; ++i) {
+        bulk[i] = { entries.boxes[i].center(), 0, static_cast<std::uint32_t>(i) };
+    }
+    sortTileRecursive(bulk);
+
+    const size_t groups = (count + maxChildren - 1) / maxChildren;
+    std::vector<size_t> bounds(groups + 1);
+    for (size_t g = 0; g <= groups; ++g) {
+        bounds[g] = count * g / groups;
+    }
+
+    std::vector<size_t> order(bulk.size());
+    for (size_t i = 0; i < bulk.size(); ++i) {
+        order[i] = bulk[i].index;
+    }
+
+    std::vector<NodeId> siblings;
+    for (size_t g = 0; g + 1 < bounds.size(); ++g) {
+        const NodeId target = g == 0 ? node : allocateNode(pool[node].kind);
+        fillNode(target, entries, std::span<const size_t>(order).subspan(bounds[g], bounds[g + 1] - bounds[g]));
+        if (g > 0) siblings.push_back(target);
+    }
+    return siblings;
+}
 
-    node->recalculateMBR();
-    return nullptr;
+// Над корнем и его новыми соседями строятся уровни, пока не останется один узел
+template <typename Source>
+void BasicRTree3D<Source>::growRoot(std::vector<NodeId> siblings) {
+    while (!siblings.empty()) {
+        OverflowEntries entries;
+        entries.children.push_back(root);
+        entries.children.insert(entries.children.end(), siblings.begin(), siblings.end());
+        for (NodeId child : entries.children) {
+            entries.boxes.push_back(pool[child].mbr);
+        }
+
+        root = allocateNode(NodeKind::Inner);
+        if (entries.children.size() <= maxChildren) {
+            for (NodeId child : entries.children) {
+                pool.addChild(root, child);
+            }
+            return;
+        }
+        siblings = splitPacked(root, entries);
+    }
 }
 
-std::shared_ptr<RTreeNode> RTree3D::splitLeaf(std::shared_ptr<RTreeLeaf> leaf, const Triangle3D& newTriangle) {
+template <typename Source>
+NodeId BasicRTree3D<Source>::splitLeaf(NodeId leaf, const Item& newTriangle) {
     // Собираем все объекты
-    std::vector<Triangle3D> allTriangles = leaf->getTriangles();
+    const auto leafTriangles = pool.getEntries(leaf);
+    const auto leafHandles = pool.getHandles(leaf);
+    auto& allTriangles = scratch.splitTriangles;
+    allTriangles.clear();
+    for (size_t i = 0; i < leafTriangles.size(); ++i) {
+        allTriangles.push_back({ leafTriangles[i], leafHandles[i] });
+    }
     allTriangles.push_back(newTriangle);
 
     // Разделяем лист
-    leaf->clearTriangles();
+    pool.clearEntries(leaf);
 
-    auto newLeaf = std::make_shared<RTreeLeaf>();
+    NodeId newLeaf = allocateNode(NodeKind::Leaf);
 
     // Выбираем первую пару
     auto [first, second] = pickSeedsTriangles(allTriangles);
 
     // Добавляем первую пару в разные листья
-    leaf->addTriangle(first);
-    newLeaf->addTriangle(second);
+    pool.addEntry(leaf, first.entry, boxOf(first), first.handle);
+    pool.addEntry(newLeaf, second.entry, boxOf(second), second.handle);
 
     // Распределяем оставшиеся треугольники
     while (!allTriangles.empty()) {
         // Если осталось мало треугольников, сразу кидаем их в подходящий узел
-        if (leaf->getTriangles().size() + allTriangles.size() <= minChildren) {
+        if (pool[leaf].count + allTriangles.size() <= minChildren) {
             for (auto& tri : allTriangles)
-                leaf->addTriangle(tri);
+                pool.addEntry(leaf, tri.entry, boxOf(tri), tri.handle);
             break;
         }
-        if (newLeaf->getTriangles().size() + allTriangles.size() <= minChildren) {
+        if (pool[newLeaf].count + allTriangles.size() <= minChildren) {
             for (auto& tri : allTriangles)
-                newLeaf->addTriangle(tri);
+                pool.addEntry(newLeaf, tri.entry, boxOf(tri), tri.handle);
             break;
         }
 
         // Выбираем следующий треугольник
         auto next = pickNextTriangle(leaf, newLeaf, allTriangles);
 
-        auto updatedLeafMbr = new MBR(leaf->getMBR());
-        auto updatedNewLeafMbr = new MBR(newLeaf->getMBR());
+        const MBR nextBox = boxOf(next);
         // Вычисляем увеличение площади
-        float d1 = updatedLeafMbr->expandToInclude(next)->volume() - leaf->getMBR().volume();
-        float d2 = updatedNewLeafMbr->expandToInclude(next)->volume() - newLeaf->getMBR().volume();
+        const QuadraticCost d1 = growth(pool[leaf].mbr, nextBox);
+        const QuadraticCost d2 = growth(pool[newLeaf].mbr, nextBox);
 
-        if (d1 < d2 || (d1 == d2 && leaf->getTriangles().size() < newLeaf->getTriangles().size()))
-            leaf->addTriangle(next);
+        if (d1 < d2 || (d1 == d2 && pool[leaf].count < pool[newLeaf].count))
+            pool.addEntry(leaf, next.entry, nextBox, next.handle);
         else
-            newLeaf->addTriangle(next);
+            pool.addEntry(newLeaf, next.entry, nextBox, next.handle);
     }
 
     return newLeaf;
 }
 
-std::shared_ptr<RTreeInnerNode> RTree3D::splitInternal(std::shared_ptr<RTreeInnerNode> node, std::shared_ptr<RTreeNode> newChild) {
-    std::vector<std::shared_ptr<RTreeNode>> allChildren = node->getChildren();
+template <typename Source>
+NodeId BasicRTree3D<Source>::splitInternal(NodeId node, NodeId newChild) {
+    const auto children = pool.getChildren(node);
+    auto& allChildren = scratch.splitChildren;
+    allChildren.assign(children.begin(), children.end());
     allChildren.push_back(newChild);
 
     // Разделяем узел
-    node->clearChildren();
-    auto newNode = std::make_shared<RTreeInnerNode>();
+    pool.clearEntries(node);
+    NodeId newNode = allocateNode(NodeKind::Inner);
 
     // Выбираем первую пару
     auto [first, second] = pickSeedsNodes(allChildren);
 
     // Добавляем первую пару
-    node->insert(first);
-    newNode->insert(second);
+    pool.addChild(node, first);
+    pool.addChild(newNode, second);
 
     // Распределяем оставшиеся узлы
     while (!allChildren.empty()) {
-        if (node->getChildren().size() + allChildren.size() <= minChildren) {
-            for (auto& child : allChildren)
-                node->insert(child);
+        if (pool[node].count + allChildren.size() <= minChildren) {
+            for (NodeId child : allChildren)
+                pool.addChild(node, child);
             break;
         }
-        if (newNode->getChildren().size() + allChildren.size() <= minChildren) {
-            for (auto& child : allChildren)
-                newNode->insert(child);
+        if (pool[newNode].count + allChildren.size() <= minChildren) {
+            for (NodeId child : allChildren)
+                pool.addChild(newNode, child);
             break;
         }
 
-        auto next = pickNextNode(node, newNode, allChildren);
+        NodeId next = pickNextNode(node, newNode, allChildren);
 
-        auto updatedNodeMbr = new MBR(node->getMBR());
-        auto updatedNewNodeMbr = new MBR(newNode->getMBR());
-        float d1 = updatedNodeMbr->expandToInclude(next->getMBR())->volume() - node->getMBR().volume();
-        float d2 = updatedNewNodeMbr->expandToInclude(next->getMBR())->volume() - newNode->getMBR().volume();
+        const QuadraticCost d1 = growth(pool[node].mbr, pool[next].mbr);
+        const QuadraticCost d2 = growth(pool[newNode].mbr, pool[next].mbr);
 
-        if (d1 < d2 || (d1 == d2 && node->getChildren().size() < newNode->getChildren().size()))
-            node->insert(next);
+        if (d1 < d2 || (d1 == d2 && pool[node].count < pool[newNode].count))
+            pool.addChild(node, next);
         else
-            newNode->insert(next);
+            pool.addChild(newNode, next);
     }
 
     return newNode;
 }
 
-std::pair<Triangle3D, Triangle3D> RTree3D::pickSeedsTriangles(std::vector<Triangle3D>& triangles) {
-    float maxWaste = -1.0f;
+template <typename Source>
+std::pair<typename BasicRTree3D<Source>::Item, typename BasicRTree3D<Source>::Item>
+BasicRTree3D<Source>::pickSeedsTriangles(std::vector<Item>& triangles) {
+    QuadraticCost maxWaste{ std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
     size_t index1 = 0, index2 = 1;
 
     for (size_t i = 0; i < triangles.size(); ++i) {
         for (size_t j = i + 1; j < triangles.size(); ++j) {
-            MBR mbr1(triangles[i]);
-            MBR mbr2(triangles[j]);
-            MBR combined = MBR::combine(mbr1, mbr2);
-            float waste = combined.volume() - mbr1.volume() - mbr2.volume();
+            const QuadraticCost pairWaste = waste(boxOf(triangles[i]), boxOf(triangles[j]));
 
-            if (waste > maxWaste) {
-                maxWaste = waste;
+            if (pairWaste > maxWaste) {
+                maxWaste = pairWaste;
                 index1 = i;
                 index2 = j;
             }
         }
     }
 
-    Triangle3D t1 = triangles[index1];
-    Triangle3D t2 = triangles[index2];
+    Item t1 = triangles[index1];
+    Item t2 = triangles[index2];
 
     // Удаляем выбранные треугольники из списка
     if (index1 > index2) std::swap(index1, index2);
@@ -373,18 +1691,16 @@ std::pair<Triangle3D, Triangle3D> RTree3D::pickSeedsTriangles(std::vector<Triang
     return {t1, t2};
 }
 
-Triangle3D RTree3D::pickNextTriangle(std::shared_ptr<RTreeNode> group1, std::shared_ptr<RTreeNode> group2, std::vector<Triangle3D>& triangles) {
-    float maxDiff = -1.0f;
+template <typename Source>
+typename BasicRTree3D<Source>::Item BasicRTree3D<Source>::pickNextTriangle(NodeId group1, NodeId group2, std::vector<Item>& triangles) {
+    QuadraticCost maxDiff{ -1.0f, -1.0f };
     size_t bestIndex = 0;
 
+    const MBR& mbr1 = pool[group1].mbr;
+    const MBR& mbr2 = pool[group2].mbr;
     for (size_t i = 0; i < triangles.size(); ++i) {
-        auto box1 = new MBR(group1->getMBR());
-        auto box2 = new MBR(group2->getMBR());
-        box1->expandToInclude(triangles[i]);
-        box2->expandToInclude(triangles[i]);
-        float d1 = box1->volume() - group1->getMBR().volume();
-        float d2 = box2->volume() - group2->getMBR().volume();
-        float diff = std::abs(d1 - d2);
+        const MBR box = boxOf(triangles[i]);
+        const QuadraticCost diff = preference(growth(mbr1, box), growth(mbr2, box));
 
         if (diff > maxDiff) {
             maxDiff = diff;
@@ -392,30 +1708,308 @@ Triangle3D RTree3D::pickNextTriangle(std::shared_ptr<RTreeNode> group1, std::sha
         }
     }
 
-    Triangle3D chosen = triangles[bestIndex];
+    Item chosen = triangles[bestIndex];
     triangles.erase(triangles.begin() + bestIndex);
     return chosen;
 }
 
-std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> RTree3D::pickSeedsNodes(std::vector<std::shared_ptr<RTreeNode>>& nodes) {
-    float maxWaste = -1.0f;
+template <typename Source>
+size_t BasicRTree3D<Source>::height() const {
+    size_t h = 0;
+    for (NodeId node = root; !pool[node].isLeaf(); node = pool.getChildren(node)[0]) {
+        ++h;
+    }
+    return h;
+}
+
+// R*-дерево (Beckmann et al., 1990). level — уровень узла, принимающего запись:
+// 0 для треугольника, уровень поддерева + 1 для перевставляемого узла.
+template <typename Source>
+void BasicRTree3D<Source>::insertRStar(const Item& triangle, NodeId subtree, size_t level, std::vector<bool>& reinserted) {
+    const MBR box = subtree == NULL_NODE ? boxOf(triangle) : pool[subtree].mbr;
+
+    // Перевставки вложены не глубже высоты дерева, кадр каждой глубины переиспользуется.
+    // Вложенный вызов может расширить frames, поэтому после него кадр берётся по индексу
+    const size_t depth = scratch.depth++;
+    if (scratch.frames.size() <= depth) scratch.frames.emplace_back();
+    ReinsertFrame& frame = scratch.frames[depth];
+    frame.triangles.clear();
+    frame.children.clear();
+
+    // Спуск до узла нужного уровня
+    root = writable(root);
+    auto& path = frame.path;
+    path.assign(1, root);
+    for (size_t l = height(); l > level; --l) {
+        path.push_back(writableChild(path.back(), chooseSubtreeRStar(path.back(), box, l == 1)));
+    }
+
+    size_t reinsertLevel = 0;
+
+    // Вставка и обработка переполнения снизу вверх
+    NodeId pending = subtree;
+    bool hasPending = true;
+    for (size_t i = path.size(); i-- > 0;) {
+        const NodeId node = path[i];
+        const size_t nodeLevel = level + (path.size() - 1 - i);
+
+        if (!hasPending) {
+            pool.recalculateMBR(node);
+            continue;
+        }
+        hasPending = false;
+
+        if (pool[node].count < maxChildren) {
+            if (pool[node].isLeaf()) {
+                pool.addEntry(node, triangle.entry, box, triangle.handle);
+            } else {
+                pool.addChild(node, pending);
+                pool.recalculateMBR(node);
+            }
+            continue;
+        }
+
+        auto& entries = scratch.overflow;
+        gatherOverflow(node, triangle, pending, entries);
+
+        // Первое переполнение на уровне — принудительная перевставка, дальше — разбиение
+        if (reinserted.size() <= nodeLevel) reinserted.resize(nodeLevel + 1, false);
+        if (node != root && !reinserted[nodeLevel]) {
+            reinserted[nodeLevel] = true;
+            reinsertLevel = nodeLevel;
+            forcedReinsert(node, entries, frame);
+            continue;
+        }
+
+        NodeId sibling = splitRStar(node, entries);
+        if (node == root) {
+            NodeId newRoot = allocateNode(NodeKind::Inner);
+            pool.addChild(newRoot, root);
+            pool.addChild(newRoot, sibling);
+            root = newRoot;
+        } else {
+            pending = sibling;
+            hasPending = true;
+        }
+    }
+
+    for (size_t i = 0; i < scratch.frames[depth].triangles.size(); ++i) {
+        const Item tri = scratch.frames[depth].triangles[i];
+        insertRStar(tri, NULL_NODE, 0, reinserted);
+    }
+    for (size_t i = 0; i < scratch.frames[depth].children.size(); ++i) {
+        insertRStar({}, scratch.frames[depth].children[i], reinsertLevel, reinserted);
+    }
+    --scratch.depth;
+}
+
+template <typename Source>
+NodeId BasicRTree3D<Source>::chooseSubtreeRStar(NodeId node, const MBR& box, bool childrenAreLeaves) const {
+    const auto children = pool.getChildren(node);
+
+    // Над листьями минимизируем прирост перекрытия, выше — прирост площади;
+    // при равенстве — прирост площади, затем площадь
+    NodeId best = children[0];
+    float bestOverlap = std::numeric_limits<float>::infinity();
+    float bestEnlargement = std::numeric_limits<float>::infinity();
+    float bestArea = std::numeric_limits<float>::infinity();
+
+    for (size_t i = 0; i < children.size(); ++i) {
+        const MBR& current = pool[children[i]].mbr;
+        const MBR enlarged = MBR::combine(current, box);
+        const float area = current.area();
+        const float enlargement = enlarged.area() - area;
+
+        float overlapEnlargement = 0.0f;
+        if (childrenAreLeaves) {
+            for (size_t j = 0; j < children.size(); ++j) {
+                if (j == i) continue;
+                const MBR& other = pool[children[j]].mbr;
+                overlapEnlargement += enlarged.overlap(other) - current.overlap(other);
+            }
+        }
+
+        if (std::tie(overlapEnlargement, enlargement, area) < std::tie(bestOverlap, bestEnlargement, bestArea)) {
+            bestOverlap = overlapEnlargement;
+            bestEnlargement = enlargement;
+            bestArea = area;
+            best = children[i];
+        }
+    }
+    return best;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::gatherOverflow(NodeId node, const Item& triangle, NodeId child, OverflowEntries& entries) const {
+    entries.clear();
+    if (pool[node].isLeaf()) {
+        const auto triangles = pool.getEntries(node);
+        const auto handles = pool.getHandles(node);
+        const MBRBlock& boxes = pool.getBoxes(node);
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            entries.triangles.push_back({ triangles[i], handles[i] });
+            entries.boxes.push_back(boxes.get(pool.boxOffset(node) + i));
+        }
+        entries.triangles.push_back(triangle);
+        entries.boxes.push_back(boxOf(triangle));
+    } else {
+        const auto children = pool.getChildren(node);
+        entries.children.assign(children.begin(), children.end());
+        entries.children.push_back(child);
+        for (NodeId c : entries.children) {
+            entries.boxes.push_back(pool[c].mbr);
+        }
+    }
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::fillNode(NodeId node, const OverflowEntries& entries, std::span<const size_t> order) {
+    pool.clearEntries(node);
+    for (size_t i : order) {
+        if (pool[node].isLeaf()) {
+            pool.addEntry(node, entries.triangles[i].entry, entries.boxes[i], entries.triangles[i].handle);
+        } else {
+            pool.addChild(node, entries.children[i]);
+        }
+    }
+}
+
+template <typename Source>
+NodeId BasicRTree3D<Source>::splitRStar(NodeId node, const OverflowEntries& entries) {
+    const auto& boxes = entries.boxes;
+    const size_t count = boxes.size();
+    const size_t minFill = std::clamp<size_t>(rstarMinimum(), 1, count / 2);
+
+    auto coordinate = [](const Point3D& p, int axis) {
+        return axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+    };
+
+    // Сортировка по нижней (byMax = false) или верхней границе вдоль оси
+    auto& order = scratch.order;
+    auto sortOrder = [&](int axis, bool byMax) {
+        order.resize(count);
+        for (size_t i = 0; i < count; ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](size_t i, size_t j) {
+            const float lo1 = coordinate(boxes[i].min, axis), hi1 = coordinate(boxes[i].max, axis);
+            const float lo2 = coordinate(boxes[j].min, axis), hi2 = coordinate(boxes[j].max, axis);
+            return byMax ? std::tie(hi1, lo1) < std::tie(hi2, lo2) : std::tie(lo1, hi1) < std::tie(lo2, hi2);
+        });
+    };
+
+    // MBR префиксов и суффиксов порядка: все распределения за O(n)
+    auto& prefix = scratch.prefix;
+    auto& suffix = scratch.suffix;
+    prefix.resize(count);
+    suffix.resize(count);
+    auto accumulate = [&](const std::vector<size_t>& order) {
+        prefix[0] = boxes[order[0]];
+        for (size_t i = 1; i < count; ++i) prefix[i] = MBR::combine(prefix[i - 1], boxes[order[i]]);
+        suffix[count - 1] = boxes[order[count - 1]];
+        for (size_t i = count - 1; i-- > 0;) suffix[i] = MBR::combine(suffix[i + 1], boxes[order[i]]);
+    };
+
+    // Ось с минимальной суммой периметров по всем распределениям
+    int bestAxis = 0;
+    float bestMargin = std::numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; ++axis) {
+        float margin = 0.0f;
+        for (bool byMax : { false, true }) {
+            sortOrder(axis, byMax);
+            accumulate(order);
+            for (size_t k = minFill; k <= count - minFill; ++k) {
+                margin += prefix[k - 1].margin() + suffix[k].margin();
+            }
+        }
+        if (margin < bestMargin) {
+            bestMargin = margin;
+            bestAxis = axis;
+        }
+    }
+
+    // Распределение с минимальным перекрытием, затем с минимальной площадью
+    auto& bestOrder = scratch.bestOrder;
+    size_t bestSplit = minFill;
+    float bestOverlap = std::numeric_limits<float>::infinity();
+    float bestArea = std::numeric_limits<float>::infinity();
+    for (bool byMax : { false, true }) {
+        sortOrder(bestAxis, byMax);
+        accumulate(order);
+        for (size_t k = minFill; k <= count - minFill; ++k) {
+            const float overlap = prefix[k - 1].overlap(suffix[k]);
+            const float area = prefix[k - 1].area() + suffix[k].area();
+            if (std::tie(overlap, area) < std::tie(bestOverlap, bestArea)) {
+                bestOverlap = overlap;
+                bestArea = area;
+                bestSplit = k;
+                bestOrder = order;
+            }
+        }
+    }
+
+    NodeId sibling = allocateNode(pool[node].kind);
+    fillNode(node, entries, std::span<const size_t>(bestOrder).first(bestSplit));
+    fillNode(sibling, entries, std::span<const size_t>(bestOrder).subspan(bestSplit));
+    return sibling;
+}
+
+template <typename Source>
+void BasicRTree3D<Source>::forcedReinsert(NodeId node, const OverflowEntries& entries, ReinsertFrame& frame) {
+    const size_t count = entries.boxes.size();
+
+    MBR nodeBox;
+    for (const auto& box : entries.boxes) {
+        nodeBox.expandToInclude(box);
+    }
+    const Point3D center = nodeBox.center();
+
+    auto& distances = scratch.distances;
+    distances.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Point3D c = entries.boxes[i].center();
+        const float dx = c.x - center.x, dy = c.y - center.y, dz = c.z - center.z;
+        distances[i] = { dx * dx + dy * dy + dz * dz, i };
+    }
+    std::sort(distances.begin(), distances.end());
+
+    // Ближайшие остаются в узле, ~30% самых дальних перевставляются, начиная с ближних
+    const size_t reinsertCount = std::clamp<size_t>(maxChildren * 3 / 10, 1, count - std::max<size_t>(rstarMinimum(), 1));
+    const size_t keep = count - reinsertCount;
+
+    auto& order = scratch.order;
+    order.clear();
+    for (size_t i = 0; i < keep; ++i) {
+        order.push_back(distances[i].second);
+    }
+    fillNode(node, entries, order);
+
+    for (size_t i = keep; i < count; ++i) {
+        if (pool[node].isLeaf()) {
+            frame.triangles.push_back(entries.triangles[distances[i].second]);
+        } else {
+            frame.children.push_back(entries.children[distances[i].second]);
+        }
+    }
+}
+
+template <typename Source>
+std::pair<NodeId, NodeId> BasicRTree3D<Source>::pickSeedsNodes(std::vector<NodeId>& nodes) {
+    QuadraticCost maxWaste{ std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
     size_t index1 = 0, index2 = 1;
 
     for (size_t i = 0; i < nodes.size(); ++i) {
         for (size_t j = i + 1; j < nodes.size(); ++j) {
-            MBR combined = MBR::combine(nodes[i]->getMBR(), nodes[j]->getMBR());
-            float waste = combined.volume() - nodes[i]->getMBR().volume() - nodes[j]->getMBR().volume();
+            const QuadraticCost pairWaste = waste(pool[nodes[i]].mbr, pool[nodes[j]].mbr);
 
-            if (waste > maxWaste) {
-                maxWaste = waste;
+            if (pairWaste > maxWaste) {
+                maxWaste = pairWaste;
                 index1 = i;
                 index2 = j;
             }
         }
     }
 
-    auto n1 = nodes[index1];
-    auto n2 = nodes[index2];
+    NodeId n1 = nodes[index1];
+    NodeId n2 = nodes[index2];
 
     if (index1 > index2) std::swap(index1, index2);
     nodes.erase(nodes.begin() + index2);
@@ -424,18 +2018,15 @@ std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> RTree3D::pickS
     return {n1, n2};
 }
 
-std::shared_ptr<RTreeNode> RTree3D::pickNextNode(std::shared_ptr<RTreeInnerNode> group1, std::shared_ptr<RTreeInnerNode> group2, std::vector<std::shared_ptr<RTreeNode>>& nodes) {
-    float maxDiff = -1.0f;
+template <typename Source>
+NodeId BasicRTree3D<Source>::pickNextNode(NodeId group1, NodeId group2, std::vector<NodeId>& nodes) {
+    QuadraticCost maxDiff{ -1.0f, -1.0f };
     size_t bestIndex = 0;
 
+    const MBR& mbr1 = pool[group1].mbr;
+    const MBR& mbr2 = pool[group2].mbr;
     for (size_t i = 0; i < nodes.size(); ++i) {
-        auto box1 = new MBR(group1->getMBR());
-        auto box2 = new MBR(group2->getMBR());
-        box1->expandToInclude(nodes[i]->getMBR());
-        box2->expandToInclude(nodes[i]->getMBR());
-        float d1 = box1->volume() - group1->getMBR().volume();
-        float d2 = box2->volume() - group2->getMBR().volume();
-        float diff = std::abs(d1 - d2);
+        const QuadraticCost diff = preference(growth(mbr1, pool[nodes[i]].mbr), growth(mbr2, pool[nodes[i]].mbr));
 
         if (diff > maxDiff) {
             maxDiff = diff;
@@ -443,117 +2034,192 @@ std::shared_ptr<RTreeNode> RTree3D::pickNextNode(std::shared_ptr<RTreeInnerNode>
         }
     }
 
-    auto chosen = nodes[bestIndex];
+    NodeId chosen = nodes[bestIndex];
     nodes.erase(nodes.begin() + bestIndex);
     return chosen;
 }
 
-std::shared_ptr<RTreeLeaf> RTree3D::find(std::shared_ptr<RTreeNode> node, const Triangle3D& searchTriangle) const {
-    if (!node) return nullptr;
+template <typename Source>
+NodeId BasicRTree3D<Source>::find(NodeId node, const Entry& searchTriangle) const {
+    if (node == NULL_NODE) return NULL_NODE;
 
-    if (node->isLeaf()) {
-        auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-        for (const auto& t : leaf->getTriangles()) {
+    if (pool[node].isLeaf()) {
+        for (const auto& t : pool.getEntries(node)) {
             if (t == searchTriangle) {
-                return leaf;
+                return node;
             }
         }
     } else {
-        auto internal = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-        for (auto child : internal->getChildren()) {
-            if (child->getMBR().contains(searchTriangle)) {
-                auto found= find(child, searchTriangle);
-                if (found) return found;
+        for (NodeId child : pool.getChildren(node)) {
+            if (pool[child].mbr.contains(boxOf(searchTriangle))) {
+                NodeId found = find(child, searchTriangle);
+                if (found != NULL_NODE) return found;
             }
         }
     }
 
-    return nullptr;
+    return NULL_NODE;
 }
 
-void RTree3D::find(const std::shared_ptr<RTreeNode>& node, const MBR& searchMBR, std::vector<Triangle3D>& result) const {
-    if (!node->isLeaf()) {
-        auto inner = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-        for (const auto& child : inner->getChildren()) {
-            if (child->getMBR().intersects(searchMBR)) {
-                find(child, searchMBR, result);
-            }
-        }
+// Путь от node до листа с target; при неудаче path не меняется
+template <typename Source>
+bool BasicRTree3D<Source>::findPath(NodeId node, const Entry& target, std::vector<NodeId>& path) const {
+    path.push_back(node);
+    if (pool[node].isLeaf()) {
+        const auto triangles = pool.getEntries(node);
+        if (std::find(triangles.begin(), triangles.end(), target) != triangles.end()) return true;
     } else {
-        auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-        for (const auto& triangle : leaf->getTriangles()) {
-            MBR triMBR(triangle);
-            if (searchMBR.intersects(triMBR)) {
-                result.push_back(triangle);
-            }
+        const MBR box = boxOf(target);
+        for (NodeId child : pool.getChildren(node)) {
+            // идем только в те поддеревья, чьи MBR содержат треугольник
+            if (pool[child].mbr.contains(box) && findPath(child, target, path)) return true;
         }
     }
+    path.pop_back();
+    return false;
 }
 
-bool RTree3D::removeRecursive(std::shared_ptr<RTreeNode> node, const Triangle3D& target, std::vector<Triangle3D>& reinserts) {
-    if (node->isLeaf()) {
-            auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-        auto it = std::find(leaf->getTriangles().begin(), leaf->getTriangles().end(), target);
-        if (it != leaf->getTriangles().end()) {
-            leaf->remove(*it);;
-            leaf->recalculateMBR();
-            return true;
-        }
-        return false;
+template <typename Source>
+std::vector<typename Source::Entry> BasicRTree3D<Source>::getAllTriangles(NodeId node) const {
+    std::vector<Item> items;
+    collectAllTriangles(node, items);
+    std::vector<Entry> result;
+    result.reserve(items.size());
+    for (const auto& item : items) {
+        result.push_back(item.entry);
     }
+    return result;
+}
 
-    auto internal = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-    for (auto it : internal->getChildren()) {
-        if (it->getMBR().contains(target)) {  // идем только в те поддеревья, чьи MBR пересекаются с треугольником
-            if (removeRecursive(it, target, reinserts)) {
-                // После удаления нужно проверить размер потомка
-                if (it->isLeaf()) {
-                    auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(it);
-                    if (leaf->getTriangles().size() < minChildren) {  // minFill — минимально допустимое количество элементов
-                        // Элементов слишком мало — реинсертим
-                        reinserts.insert(reinserts.end(), leaf->getTriangles().begin(), leaf->getTriangles().end());
-                        internal->remove(it); // Удаляем узел
-                    } else {
-                        it->recalculateMBR();
-                    }
-                } else {
-                    auto childInternal = std::dynamic_pointer_cast<RTreeInnerNode>(it);
-                    if (childInternal->getChildren().size() < minChildren) {
-                        // Элементов слишком мало — реинсертим
-                        for (auto& grandChild : childInternal->getChildren()) {
-                            auto allTriangles = getAllTriangles(grandChild);
-                            reinserts.insert(reinserts.end(), allTriangles.begin(), allTriangles.end());
-                        }
-                        internal->remove(it); // Удаляем узел
-                    } else {
-                        it->recalculateMBR();
-                    }
-                }
-                // После обработки дочернего элемента пересчитываем MBR текущего узла
-                internal->recalculateMBR();
-                return true;
-            }
+template <typename Source>
+void BasicRTree3D<Source>::collectAllTriangles(NodeId node, std::vector<Item>& result) const {
+    if (node == NULL_NODE) return;
+
+    if (pool[node].isLeaf()) {
+        const auto triangles = pool.getEntries(node);
+        const auto handles = pool.getHandles(node);
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            result.push_back({ triangles[i], handles[i] });
+        }
+    } else {
+        for (NodeId child : pool.getChildren(node)) {
+            collectAllTriangles(child, result);
         }
     }
-    return false;
 }
 
-std::vector<Triangle3D> RTree3D::getAllTriangles(const std::shared_ptr<RTreeNode>& node) const {
-    std::vector<Triangle3D> result;
-    collectAllTriangles(node, result);
-    return result;
+// Нулевые компоненты направления заменяются крошечными, чтобы slab-тест не давал NaN
+static Point3D safeInverse(const Point3D& direction) {
+    auto inverse = [](float d) {
+        return 1.0f / (std::abs(d) > 1e-30f ? d : std::copysign(1e-30f, d));
+    };
+    return { inverse(direction.x), inverse(direction.y), inverse(direction.z) };
 }
 
-void RTree3D::collectAllTriangles(const std::shared_ptr<RTreeNode>& node, std::vector<Triangle3D>& result) const {
-    if (!node) return;
+template <typename Source>
+std::optional<typename BasicRTree3D<Source>::RayHit> BasicRTree3D<Source>::raycast(const Ray& ray) const {
+    const auto guard = pin();
+    return raycastFrom(currentRoot(), ray);
+}
 
-    if (node->isLeaf()) {
-        auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-        result.insert(result.end(), leaf->getTriangles().begin(), leaf->getTriangles().end());
-    } else {
-    auto internal = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-        for (const auto& child : internal->getChildren()) {
-            collectAllTriangles(child, result);
+template <typename Source>
+std::optional<typename BasicRTree3D<Source>::RayHit> BasicRTree3D<Source>::raycastFrom(NodeId start, const Ray& ray) const {
+    RayTriangleHit hit;
+    hit.t = ray.tMax;
+    NodeId leaf = NULL_NODE;
+    const QueryStatsScope scope(counters);
+    countQuery(&QueryStats::queries);
+    if (!raycastNode(start, ray, safeInverse(ray.direction), hit, leaf, false)) {
+        return std::nullopt;
+    }
+    countQuery(&QueryStats::hits);
+    return RayHit{ pool.getEntries(leaf)[hit.index], hit.t, hit.u, hit.v };
+}
+
+template <typename Source>
+bool BasicRTree3D<Source>::occluded(const Ray& ray) const {
+    RayTriangleHit hit;
+    hit.t = ray.tMax;
+    NodeId leaf = NULL_NODE;
+    const auto guard = pin();
+    const QueryStatsScope scope(counters);
+    countQuery(&QueryStats::queries);
+    const bool found = raycastNode(currentRoot(), ray, safeInverse(ray.direction), hit, leaf, true);
+    countQuery(&QueryStats::hits, found);
+    return found;
+}
+
+template <typename Source>
+bool BasicRTree3D<Source>::raycastNode(NodeId node, const Ray& ray, const Point3D& invDir, RayTriangleHit& hit, NodeId& hitLeaf, bool anyHit) const {
+    countQuery(&QueryStats::nodesVisited);
+    countQuery(&QueryStats::boxTests, pool[node].count);
+
+    if (pool[node].isLeaf()) {
+        // Точная проверка только для записей, чьи сохранённые MBR пересекает луч;
+        // для номеров геометрия собирается лишь для этих кандидатов
+        const auto entries = pool.getEntries(node);
+        bool found = false;
+        for (size_t chunk = 0; chunk < entries.size(); chunk += 64) {
+            alignas(32) float tNear[64];
+            std::uint64_t hits = pool.rayMask(node, chunk, ray.origin, invDir, hit.t, tNear);
+            std::array<Entry, 64> candidates;
+            std::array<std::uint32_t, 64> positions;
+            size_t count = 0;
+            while (hits) {
+                const auto i = static_cast<std::uint32_t>(chunk + std::countr_zero(hits));
+                hits &= hits - 1;
+                positions[count] = i;
+                candidates[count++] = entries[i];
+            }
+            std::array<Triangle3D, 64> scratch;
+            const Triangle3D* triangles = source.triangles(std::span<const Entry>(candidates.data(), count), scratch.data());
+            countQuery(&QueryStats::triangleTests, count);
+            if (!intersectRayTriangles(ray, triangles, count, hit, anyHit)) continue;
+            hit.index = positions[hit.index];
+            hitLeaf = node;
+            found = true;
+            if (anyHit) break;
+        }
+        if (!found) countQuery(&QueryStats::falsePositives);
+        return found;
+    }
+
+    const auto children = pool.getChildren(node);
+    bool found = false;
+    for (size_t chunk = 0; chunk < children.size(); chunk += 64) {
+        alignas(32) float tNear[64];
+        std::uint64_t hits = pool.rayMask(node, chunk, ray.origin, invDir, hit.t, tNear);
+
+        // Потомки обходятся от ближнего к дальнему; дальше текущего попадания не спускаемся
+        std::array<std::pair<float, std::uint32_t>, 64> order;
+        size_t hitCount = 0;
+        while (hits) {
+            const auto i = static_cast<std::uint32_t>(std::countr_zero(hits));
+            order[hitCount++] = { tNear[i], i };
+            hits &= hits - 1;
+        }
+        std::sort(order.begin(), order.begin() + hitCount);
+
+        for (size_t k = 0; k < hitCount; ++k) {
+            if (order[k].first > hit.t) break;
+            if (raycastNode(children[chunk + order[k].second], ray, invDir, hit, hitLeaf, anyHit)) {
+                found = true;
+                if (anyHit) return true;
+            }
         }
     }
+    return found;
 }
+
+template <typename Source>
+void BasicRTree3D<Source>::releaseSubtree(NodeId node) {
+    if (!pool[node].isLeaf()) {
+        for (NodeId child : pool.getChildren(node)) {
+            releaseSubtree(child);
+        }
+    }
+    retire(node);
+}
+
+template class BasicRTree3D<InlineTriangles>;
+template class BasicRTree3D<IndexedMesh>;
@@ -1,85 +1,770 @@
 #ifndef RTREE3D_H
 #define RTREE3D_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
 #include <iostream>
-
-#include "RTreeInnerNode.h"
-#include "RTreeLeaf.h"
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Epoch.h"
 #include "RTreeNode.h"
+#include "RTreeNodePool.h"
+#include "RTreeQueryRange.h"
+#include "RTreeStats.h"
+#include "TriangleSource.h"
+#include "../geometry/Frustum.h"
+#include "../geometry/Ray.h"
+#include "../geometry/TriangleBox.h"
+
+
+enum class BulkLoadStrategy {
+    SortTileRecursive,
+    Hilbert,
+    Morton
+};
+
+// Результаты запросов параметризованы записью листа: треугольником или его номером (см. TriangleSource.h)
+template <typename Entry>
+struct BasicNeighbor {
+    Entry triangle;
+    float distance;
+};
+
+// Результаты пакетного поиска в формате CSR: попадания запроса i лежат
+// в hits[offsets[i], offsets[i + 1]).
+template <typename Entry>
+struct BasicBatchResult {
+    std::vector<size_t> offsets;
+    std::vector<Entry> hits;
+
+    size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    std::span<const Entry> operator[](size_t query) const {
+        return std::span<const Entry>(hits).subspan(offsets[query], offsets[query + 1] - offsets[query]);
+    }
+};
+
+// Morton: запросы обрабатываются в порядке кривой Мортона по центрам,
+// соседние запросы проходят по одним и тем же узлам
+enum class QueryOrder {
+    AsGiven,
+    Morton
+};
+
+// Отбор записей при поиске по диапазону; флаги объединяются через |.
+// BoundingBox — записи, чьи MBR пересекают запрос; Exact — треугольники, действительно
+// пересекающие запрос (разделяющие оси, см. TriangleBox.h); ContainedSubtrees — поддерево узла,
+// целиком лежащего внутри запроса, выдаётся без проверок записей. Результат от него не меняется.
+enum class QueryMode : std::uint8_t {
+    BoundingBox = 0,
+    Exact = 1,
+    ContainedSubtrees = 2
+};
+
+constexpr QueryMode operator|(QueryMode a, QueryMode b) {
+    return QueryMode(std::uint8_t(a) | std::uint8_t(b));
+}
+
+constexpr bool hasFlag(QueryMode mode, QueryMode flag) {
+    return (std::uint8_t(mode) & std::uint8_t(flag)) != 0;
+}
+
+template <typename Entry>
+struct BasicRayHit {
+    Entry triangle;
+    float t;
+    float u;
+    float v;
+};
 
+using Neighbor = BasicNeighbor<Triangle3D>;
+using BatchResult = BasicBatchResult<Triangle3D>;
+using RayHit = BasicRayHit<Triangle3D>;
 
-class RTree3D {
-    std::shared_ptr<RTreeNode> root;
+// Кодирование прямоугольников в файле save: Quantized16 и Quantized8 хранят их
+// целыми относительно прямоугольника родителя — в 2 и 4 раза компактнее float.
+enum class BoxEncoding {
+    Float,
+    Quantized16,
+    Quantized8
+};
+
+// RStar разбивает и перевставляет узлы не меньше чем по 40% ёмкости, даже если minChildren меньше.
+enum class InsertPolicy {
+    Quadratic,
+    RStar
+};
+
+// CopyOnWrite: запросы из любых потоков без блокировок параллельно с записью.
+// Запись копирует изменяемый путь от корня до листа и атомарно публикует новый корень,
+// старые узлы освобождаются, когда их не может видеть ни один читатель.
+enum class Concurrency {
+    None,
+    CopyOnWrite
+};
+
+// Source задаёт содержимое листьев: InlineTriangles — копии треугольников,
+// IndexedMesh — номера треугольников во внешнем индексированном буфере.
+template <typename Source>
+class BasicRTree3D {
+public:
+    using Entry = typename Source::Entry;
+    using Neighbor = BasicNeighbor<Entry>;
+    using BatchResult = BasicBatchResult<Entry>;
+    using RayHit = BasicRayHit<Entry>;
+
+    class Snapshot;
+
+private:
+    Source source;
+    RTreeNodePool<Entry> pool;
+    NodeId root;                         // рабочий корень писателя
+    std::atomic<NodeId> publishedRoot;   // корень, который видят запросы
     size_t maxChildren;
     size_t minChildren;
+    InsertPolicy policy;
+    Concurrency concurrency;
+
+    EpochManager epochs;
+    std::mutex writeMutex;
+    std::vector<NodeId> pendingRetire;
+    std::vector<std::pair<std::uint64_t, NodeId>> retired;
+
+    // Узел, снятый с дерева, но видимый снимку: был в дереве в версиях [first, last]
+    struct Retained {
+        std::uint64_t first;
+        std::uint64_t last;
+        NodeId node;
+    };
+
+    std::uint64_t version = 0;           // последняя опубликованная версия
+    mutable std::mutex snapshotMutex;
+    mutable std::map<std::uint64_t, size_t> snapshots;   // версия → число живых снимков
+    mutable std::atomic<size_t> liveSnapshots{ 0 };
+    mutable std::atomic<bool> snapshotsReleased{ false };
+    std::vector<Retained> retained;
+
+    mutable QueryCounters counters;
+
+    float updateMargin = 0.0f;
+    // Путь по номерам потомков к следующему узлу refine
+    std::vector<std::uint32_t> refineCursor;
 
 public:
-    RTree3D(size_t minChildren = 1, size_t maxChildren = 3);
+    // Узлы размещаются в resource (см. RTreeNodePool); он должен жить дольше дерева.
+    BasicRTree3D(size_t minChildren = 1, size_t maxChildren = 3, InsertPolicy policy = InsertPolicy::Quadratic,
+                 Concurrency concurrency = Concurrency::None,
+                 std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    BasicRTree3D(Source source, size_t minChildren = 1, size_t maxChildren = 3,
+                 InsertPolicy policy = InsertPolicy::Quadratic, Concurrency concurrency = Concurrency::None,
+                 std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    // Все снимки должны быть уничтожены раньше дерева (см. snapshot()).
+    ~BasicRTree3D();
+
+    const Source& getSource() const {
+        return source;
+    }
+
+    // Возвращает дескриптор записи для remove(handle) и update.
+    EntryHandle insert(const Entry& obj);
+
+    // Ищет лист с target спуском по всем поддеревьям, чьи MBR его содержат,
+    // и удаляет из него все равные target записи.
+    void remove(const Entry& target);
+
+    // Удаляет ровно эту запись: лист берётся из таблицы дескрипторов, путь до корня —
+    // по ссылкам на родителей. Возвращает false, если дескриптор не выдан.
+    bool remove(EntryHandle handle);
+
+    // Заменяет запись, сохраняя дескриптор. Если MBR новой записи укладывается в MBR листа,
+    // запись меняется на месте и пересчитываются только MBR на пути к корню;
+    // иначе она удаляется и вставляется заново. Возвращает false, если дескриптор не выдан.
+    bool update(EntryHandle handle, const Entry& entry);
+
+    // Пакетное update: записи, оставшиеся в своих MBR или в MBR своих листьев, меняются на месте,
+    // как в update; остальные удаляются и вставляются одним пакетом, как в insertBatch.
+    // Неизвестные дескрипторы пропускаются, повторять дескриптор в пакете нельзя.
+    // Возвращает число перевставленных записей.
+    size_t updateBatch(std::span<const EntryHandle> handles, std::span<const Entry> entries);
+
+    // Резервирует память под entries записей: страницы пула под узлы дерева такого размера
+    // при наименьшем заполнении, таблицу дескрипторов и рабочие буферы под его высоту.
+    // Пока записей не больше entries, insert, remove и update не выделяют память.
+    void reserve(size_t entries);
+
+    // Запас для движущейся геометрии: MBR записей листьев хранятся расширенными на margin,
+    // и update, не выводящий треугольник за такой MBR, меняет только саму запись — без
+    // пересчёта MBR узлов и без копирования пути при Concurrency::None.
+    // Действует на записи, вставленные после вызова; прежние перестраивает refine.
+    // При margin > 0 QueryMode::BoundingBox сравнивает запрос с расширенными MBR
+    // и может вернуть лишние записи; Exact, ближайшие, лучи и соединения точны.
+    void setUpdateMargin(float margin);
+
+    // Постепенное улучшение дерева без перестройки: за вызов обрабатывается до budget
+    // внутренних узлов, следующий вызов продолжает обход в глубину с места остановки.
+    // MBR записей листьев заново строятся по текущим треугольникам, затем записи
+    // переносятся между соседними узлами, если это уменьшает их суммарную площадь.
+    void refine(size_t budget);
+
+    // Пакетная вставка: треугольники раскладываются по поддеревьям за один спуск,
+    // каждый затронутый узел переупаковывается и пересчитывается один раз.
+    // Возвращает дескрипторы записей в порядке triangles.
+    std::vector<EntryHandle> insertBatch(std::span<const Entry> triangles);
+
+    // Пакетное удаление; каждый треугольник удаляется так же, как remove().
+    void removeBatch(std::span<const Entry> targets);
+
+    std::vector<Entry> find(const MBR& searchMBR, QueryMode mode = QueryMode::BoundingBox) const;
+
+    // Вызывает visitor(const Entry&) для каждой найденной записи без копирования;
+    // если visitor возвращает false, обход прекращается.
+    template <typename Visitor>
+    void query(const MBR& searchMBR, Visitor&& visitor, QueryMode mode = QueryMode::BoundingBox) const;
+
+    // Ленивый диапазон найденных записей, совместимый с std::ranges.
+    RTreeQueryRange<Entry> query(const MBR& searchMBR) const;
+
+    // Пакет запросов на всех ядрах; все запросы видят одну и ту же версию дерева.
+    BatchResult findBatch(std::span<const MBR> queries, QueryOrder order = QueryOrder::AsGiven,
+                          QueryMode mode = QueryMode::BoundingBox) const;
+
+    // Не более k ближайших к точке треугольников не дальше maxDistance, по возрастанию расстояния.
+    std::vector<Neighbor> nearest(const Point3D& point, size_t k,
+                                  float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+    // Все треугольники не дальше maxDistance от точки, по возрастанию расстояния.
+    std::vector<Neighbor> withinDistance(const Point3D& point, float maxDistance) const;
+
+    // Ближайшее пересечение луча origin + t * direction с треугольником при 0 <= t < tMax.
+    std::optional<RayHit> raycast(const Point3D& origin, const Point3D& direction,
+                                  float tMax = std::numeric_limits<float>::infinity()) const;
+
+    // Есть ли хотя бы одно пересечение при 0 <= t < tMax.
+    bool occluded(const Point3D& origin, const Point3D& direction,
+                  float tMax = std::numeric_limits<float>::infinity()) const;
+
+    // Пакетные варианты: лучи распределяются по всем ядрам.
+    std::vector<std::optional<RayHit>> raycast(std::span<const Ray> rays) const;
+
+    std::vector<std::uint8_t> occluded(std::span<const Ray> rays) const;
+
+    // Записи, чьи MBR не отсекает ни одна плоскость frustum (как classifyBox). Узел целиком
+    // снаружи отбрасывается, целиком внутри — выдаётся без проверок, а потомки пересекающего узла
+    // проверяются только по плоскостям, которые он пересекает. visitor — как в query.
+    template <typename Visitor>
+    void cullFrustum(const Frustum& frustum, Visitor&& visitor) const;
+
+    // Пакет пирамид (например, каскады теней) на всех ядрах. Задача — пирамида и одно
+    // поддерево корня, так что даже несколько пирамид занимают все потоки. Записи каждой
+    // пирамиды идут в том же порядке, что у cullFrustum.
+    BatchResult cullFrustumBatch(std::span<const Frustum> frustums) const;
+
+    // Неизменяемая версия дерева для долгих запросов параллельно с записью. Пока жив хотя бы
+    // один снимок, запись копирует изменяемые пути, как при Concurrency::CopyOnWrite, а снятые
+    // с дерева узлы хранятся, пока их видит какая-либо живая версия. Остальные узлы общие,
+    // так что снимок стоит столько, сколько узлов изменено после него.
+    // Узлы уничтоженных снимков возвращаются в пул при следующей записи. В режиме None
+    // snapshot() нельзя вызывать одновременно с записью; запросы к снимку — можно.
+    // У IndexedMesh снимок фиксирует номера треугольников, но не сам буфер вершин.
+    // Узлы снимка лежат в пуле дерева, и снимок отпускает их через дерево, поэтому дерево
+    // должно жить дольше всех снимков и их копий; отладочная сборка проверяет это в деструкторе.
+    Snapshot snapshot();
+
+    // Запись triangles[i] получает дескриптор {i}; прежние дескрипторы недействительны.
+    void buildTree(const std::vector<Entry>& triangles,
+                   BulkLoadStrategy strategy = BulkLoadStrategy::SortTileRecursive);
 
-    void insert(const Triangle3D& obj);
+    void exportToSVG(const std::string& filename, float scale = 10.0f) const;
 
-    void remove(const Triangle3D& target);
+    // Записывает дерево в упакованном виде для MappedRTree (формат описан в RTreeFile.h).
+    // В файл попадают сами треугольники, даже если листья хранят номера.
+    // Возвращает false, если файл не удалось записать или дерево выше packed::MAX_HEIGHT.
+    bool save(const std::string& filename, BoxEncoding encoding = BoxEncoding::Float) const;
 
-    std::vector<Triangle3D> find(const MBR& searchMBR) const;
+    // Суммарные счётчики find, query, findBatch, nearest, withinDistance, raycast и occluded
+    // с момента создания или resetQueryStats(). Без RTREE_STATS всегда нули.
+    // Ленивый диапазон query(searchMBR) не считается.
+    QueryStats queryStats() const;
 
-    void buildTree(const std::vector<Triangle3D>& triangles);
+    void resetQueryStats();
 
-    void exportToSVG(const std::string& filename, float scale = 10.0f) const;
+    // Высота, заполнение, перекрытие и мёртвое пространство по уровням, занимаемая память.
+    // Обходит всё дерево; по росту перекрытия и мёртвого пространства видно, когда пора перестроить.
+    TreeStats stats() const;
 
 private:
+    // Запись при упаковке: центр треугольника или узла и его индекс в текущем уровне
+    struct BulkEntry {
+        Point3D center;
+        std::uint64_t key;
+        std::uint32_t index;
+    };
+
+    // Запись листа вместе с дескриптором — так записи переносятся при разбиениях и перевставках
+    struct Item {
+        Entry entry;
+        EntryHandle handle;
+    };
+
+    // Пакет вставки вместе с MBR треугольников
+    struct Batch {
+        std::span<const Item> items;
+        std::span<const MBR> boxes;
+    };
+
+    // Удаляемые треугольники вместе с их MBR
+    struct Targets {
+        std::span<const Entry> triangles;
+        std::span<const MBR> boxes;
+    };
+
+    // Записи переполненного узла вместе с новой: треугольники листа или потомки внутреннего узла
+    struct OverflowEntries {
+        std::vector<Item> triangles;
+        std::vector<NodeId> children;
+        std::vector<MBR> boxes;
+
+        void clear() {
+            triangles.clear();
+            children.clear();
+            boxes.clear();
+        }
+    };
+
+    // Кадр перевставки R* на своей глубине вложенности: путь спуска и вытесненные записи
+    struct ReinsertFrame {
+        std::vector<NodeId> path;
+        std::vector<Item> triangles;
+        std::vector<NodeId> children;
+    };
+
+    // Рабочие буферы вставки и удаления. Они сохраняют ёмкость между операциями,
+    // так что после прогрева или reserve insert и remove не выделяют память, кроме новых страниц пула.
+    struct Scratch {
+        std::vector<NodeId> path;
+        std::vector<Item> reinserts;
+        std::vector<Item> escaped;
+        std::vector<bool> reinserted;
+        std::vector<ReinsertFrame> frames;
+        size_t depth = 0;
+        OverflowEntries overflow;
+        std::vector<size_t> order;
+        std::vector<size_t> bestOrder;
+        std::vector<MBR> prefix;
+        std::vector<MBR> suffix;
+        std::vector<std::pair<float, size_t>> distances;
+        std::vector<Item> splitTriangles;
+        std::vector<NodeId> splitChildren;
+    };
+
+    Scratch scratch;
+
+    MBR boxOf(const Entry& entry) const {
+        return MBR(source.triangle(entry));
+    }
+
+    // MBR, с которым запись хранится в листе: с запасом updateMargin
+    MBR boxOf(const Item& item) const {
+        const MBR box = boxOf(item.entry);
+        return updateMargin > 0.0f ? box.inflated(updateMargin) : box;
+    }
+
+    NodeId currentRoot() const;
+
+    EpochManager::Guard pin() const;
+
+    bool copying() const;
+
+    bool seenBySnapshot(std::uint64_t first, std::uint64_t last) const;
+
+    void releaseSnapshot(std::uint64_t snapshotVersion) const;
+
+    void reclaim(NodeId node, std::uint64_t epoch);
+
+    std::unique_lock<std::mutex> lockWriters();
+
+    NodeId allocateNode(NodeKind kind);
+
+    NodeId writable(NodeId node);
+
+    NodeId writableChild(NodeId parent, NodeId child);
+
+    void retire(NodeId node);
+
+    void publish();
+
+    void insertEntry(const Item& obj);
+
+    NodeId insertRecursive(NodeId node, const Item& obj);
+
+    NodeId chooseSubtree(NodeId node, const MBR& box, bool childrenAreLeaves) const;
+
+    void insertEntries(std::span<const Item> triangles);
+
+    std::vector<std::uint32_t> spatialOrder(std::span<const MBR> boxes) const;
 
-    std::shared_ptr<RTreeNode> insertRecursive(std::shared_ptr<RTreeNode> node, const Triangle3D& obj);
+    std::vector<NodeId> insertBatchNode(NodeId node, const Batch& batch, std::span<const std::uint32_t> items, size_t level);
 
-    std::shared_ptr<RTreeNode> splitLeaf(std::shared_ptr<RTreeLeaf> leaf, const Triangle3D& newTriangle);
+    NodeId removeBatchNode(NodeId node, const Targets& targets, std::span<const std::uint32_t> items,
+                           std::vector<char>& found, std::vector<Item>& orphans, bool& changed);
 
-    std::shared_ptr<RTreeInnerNode> splitInternal(std::shared_ptr<RTreeInnerNode> node, std::shared_ptr<RTreeNode> newChild);
+    void removeAlongPath(std::vector<NodeId>& path, const Entry* target, EntryHandle handle);
 
-    std::pair<Triangle3D, Triangle3D> pickSeedsTriangles(std::vector<Triangle3D>& triangles);
+    bool pathToRoot(NodeId leaf, std::vector<NodeId>& path) const;
 
-    Triangle3D pickNextTriangle(std::shared_ptr<RTreeNode> group1, std::shared_ptr<RTreeNode> group2, std::vector<Triangle3D>& triangles);
+    void writablePath(std::vector<NodeId>& path);
 
-    std::pair<std::shared_ptr<RTreeNode>, std::shared_ptr<RTreeNode>> pickSeedsNodes(std::vector<std::shared_ptr<RTreeNode>>& nodes);
+    bool updateInPlace(EntryHandle handle, const Entry& entry);
 
-    std::shared_ptr<RTreeNode> pickNextNode(std::shared_ptr<RTreeInnerNode> group1, std::shared_ptr<RTreeInnerNode> group2, std::vector<std::shared_ptr<RTreeNode>>& nodes);
+    bool updateInLeaf(std::vector<NodeId>& path, EntryHandle handle, const Entry& entry);
 
-    void fixAfterRemove(std::shared_ptr<RTreeNode>& current, std::shared_ptr<RTreeLeaf>& targetLeaf, std::vector<Triangle3D>& reinserts);
+    void refineNode(NodeId node);
 
-    std::shared_ptr<RTreeLeaf> find(std::shared_ptr<RTreeNode> node, const Triangle3D& searchTriangle) const;
+    void refitLeaf(NodeId parent, NodeId leaf);
 
-    void find(const std::shared_ptr<RTreeNode>& node, const MBR& searchMBR, std::vector<Triangle3D>& result) const;
+    bool moveBoundaryEntry(NodeId node, size_t from);
 
-    bool removeRecursive(std::shared_ptr<RTreeNode> node, const Triangle3D& target, std::vector<Triangle3D>& reinserts);
+    void advanceRefineCursor(const std::vector<NodeId>& path);
 
-    std::vector<Triangle3D> getAllTriangles(const std::shared_ptr<RTreeNode>& node) const;
+    std::vector<NodeId> splitPacked(NodeId node, const OverflowEntries& entries);
 
-    void collectAllTriangles(const std::shared_ptr<RTreeNode>& node, std::vector<Triangle3D>& result) const;
+    void growRoot(std::vector<NodeId> siblings);
 
-    void buildNode(std::shared_ptr<RTreeNode> node, size_t level, const std::vector<Triangle3D>& triangles);
+    NodeId splitLeaf(NodeId leaf, const Item& newTriangle);
 
-    std::vector<std::vector<Triangle3D>> splitIntoGroups(const std::vector<Triangle3D>& triangles, size_t groupCount, int level);
+    NodeId splitInternal(NodeId node, NodeId newChild);
 
-    void drawNode(const std::shared_ptr<RTreeNode>& node, std::ofstream& file, float scale) const;
+    std::pair<Item, Item> pickSeedsTriangles(std::vector<Item>& triangles);
 
-    friend std::ostream& operator<<(std::ostream& os, const RTree3D& tree);
+    Item pickNextTriangle(NodeId group1, NodeId group2, std::vector<Item>& triangles);
+
+    size_t height() const;
+
+    void insertRStar(const Item& triangle, NodeId subtree, size_t level, std::vector<bool>& reinserted);
+
+    NodeId chooseSubtreeRStar(NodeId node, const MBR& box, bool childrenAreLeaves) const;
+
+    void gatherOverflow(NodeId node, const Item& triangle, NodeId child, OverflowEntries& entries) const;
+
+    void fillNode(NodeId node, const OverflowEntries& entries, std::span<const size_t> order);
+
+    // Наименьшее заполнение узлов при разбиении и перевставке R*: не меньше 40% ёмкости, как
+    // MinFanout у RTree. При minChildren == 1 упорядоченный поток делил бы узлы 1|M,
+    // и дерево вырождалось бы в цепочку
+    size_t rstarMinimum() const {
+        return std::max(minChildren, (maxChildren * 2 + 4) / 5);
+    }
+
+    NodeId splitRStar(NodeId node, const OverflowEntries& entries);
+
+    void forcedReinsert(NodeId node, const OverflowEntries& entries, ReinsertFrame& frame);
+
+    std::pair<NodeId, NodeId> pickSeedsNodes(std::vector<NodeId>& nodes);
+
+    NodeId pickNextNode(NodeId group1, NodeId group2, std::vector<NodeId>& nodes);
+
+    NodeId find(NodeId node, const Entry& searchTriangle) const;
+
+    std::vector<Neighbor> nearestFrom(NodeId start, const Point3D& point, size_t k, float maxDistance) const;
+
+    std::optional<RayHit> raycast(const Ray& ray) const;
+
+    std::optional<RayHit> raycastFrom(NodeId start, const Ray& ray) const;
+
+    bool occluded(const Ray& ray) const;
+
+    bool raycastNode(NodeId node, const Ray& ray, const Point3D& invDir, RayTriangleHit& hit, NodeId& hitLeaf, bool anyHit) const;
+
+    template <typename Visitor>
+    bool queryNode(NodeId node, const MBR& searchMBR, Visitor& visitor, QueryMode mode) const;
+
+    template <typename Visitor>
+    bool cullNode(NodeId node, size_t begin, size_t end, const Frustum& frustum, std::uint32_t planes,
+                  Visitor& visitor) const;
+
+    template <typename Visitor>
+    bool visitSubtree(NodeId node, Visitor& visitor) const;
+
+    template <typename Visitor>
+    bool visitEntry(const Entry& entry, Visitor& visitor) const;
+
+    bool findPath(NodeId node, const Entry& target, std::vector<NodeId>& path) const;
+
+    std::vector<Entry> getAllTriangles(NodeId node) const;
+
+    void collectAllTriangles(NodeId node, std::vector<Item>& result) const;
+
+    void releaseSubtree(NodeId node);
+
+    void orderEntries(std::vector<BulkEntry>& entries, BulkLoadStrategy strategy) const;
+
+    void sortTileRecursive(std::span<BulkEntry> entries) const;
+
+    void drawNode(NodeId node, std::ofstream& file, float scale) const;
+
+    template <typename S>
+    friend std::ostream& operator<<(std::ostream& os, const BasicRTree3D<S>& tree);
+
+    template <typename A, typename B>
+    friend class RTreeJoin;
+};
+
+// Версия дерева, возвращаемая snapshot(). Копии разделяют одну регистрацию:
+// узлы версии освобождаются после уничтожения последней копии. Дерево должно её пережить.
+template <typename Source>
+class BasicRTree3D<Source>::Snapshot {
+    struct Registration {
+        const BasicRTree3D* tree;
+        std::uint64_t version;
+
+        ~Registration() {
+            tree->releaseSnapshot(version);
+        }
+    };
+
+    const BasicRTree3D* tree = nullptr;
+    NodeId root = NULL_NODE;
+    std::shared_ptr<const Registration> registration;
+
+    Snapshot(const BasicRTree3D* tree, NodeId root, std::uint64_t version)
+        : tree(tree), root(root), registration(new Registration{ tree, version }) {}
+
+    friend class BasicRTree3D;
+
+public:
+    Snapshot() = default;
+
+    bool valid() const {
+        return registration != nullptr;
+    }
+
+    // Номер версии: число операций записи, опубликованных до снимка
+    std::uint64_t version() const {
+        return registration ? registration->version : 0;
+    }
+
+    std::vector<Entry> find(const MBR& searchMBR, QueryMode mode = QueryMode::BoundingBox) const {
+        std::vector<Entry> result;
+        query(searchMBR, [&](const Entry& entry) {
+            result.push_back(entry);
+        }, mode);
+        return result;
+    }
+
+    template <typename Visitor>
+    void query(const MBR& searchMBR, Visitor&& visitor, QueryMode mode = QueryMode::BoundingBox) const {
+        if (!tree) return;
+        const QueryStatsScope scope(tree->counters);
+        countQuery(&QueryStats::queries);
+        tree->queryNode(root, searchMBR, visitor, mode);
+    }
+
+    std::vector<Neighbor> nearest(const Point3D& point, size_t k,
+                                  float maxDistance = std::numeric_limits<float>::infinity()) const {
+        return tree ? tree->nearestFrom(root, point, k, maxDistance) : std::vector<Neighbor>();
+    }
+
+    std::optional<RayHit> raycast(const Point3D& origin, const Point3D& direction,
+                                  float tMax = std::numeric_limits<float>::infinity()) const {
+        return tree ? tree->raycastFrom(root, Ray{ origin, direction, tMax }) : std::nullopt;
+    }
+
+    template <typename Visitor>
+    void cullFrustum(const Frustum& frustum, Visitor&& visitor) const {
+        if (!tree) return;
+        const QueryStatsScope scope(tree->counters);
+        countQuery(&QueryStats::queries);
+        tree->cullNode(root, 0, tree->pool[root].count, frustum, (1u << frustum.size()) - 1, visitor);
+    }
 };
 
-inline std::ostream& operator<<(std::ostream& os, const RTree3D& tree) {
-    std::function<void(const std::shared_ptr<RTreeNode>&, const std::string&, bool)> recur;
-    recur = [&](const std::shared_ptr<RTreeNode>& node, const std::string& prefix, bool isLast) {
+using RTree3D = BasicRTree3D<InlineTriangles>;
+using IndexedRTree3D = BasicRTree3D<IndexedMesh>;
+
+template <typename Source>
+template <typename Visitor>
+void BasicRTree3D<Source>::query(const MBR& searchMBR, Visitor&& visitor, QueryMode mode) const {
+    const auto guard = pin();
+    const QueryStatsScope scope(counters);
+    countQuery(&QueryStats::queries);
+    queryNode(currentRoot(), searchMBR, visitor, mode);
+}
+
+template <typename Source>
+template <typename Visitor>
+void BasicRTree3D<Source>::cullFrustum(const Frustum& frustum, Visitor&& visitor) const {
+    const auto guard = pin();
+    const QueryStatsScope scope(counters);
+    countQuery(&QueryStats::queries);
+    const NodeId start = currentRoot();
+    cullNode(start, 0, pool[start].count, frustum, (1u << frustum.size()) - 1, visitor);
+}
+
+template <typename Source>
+template <typename Visitor>
+bool BasicRTree3D<Source>::visitEntry(const Entry& entry, Visitor& visitor) const {
+    countQuery(&QueryStats::hits);
+    if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, const Entry&>>) {
+        visitor(entry);
+        return true;
+    } else {
+        return visitor(entry);
+    }
+}
+
+template <typename Source>
+template <typename Visitor>
+bool BasicRTree3D<Source>::visitSubtree(NodeId node, Visitor& visitor) const {
+    countQuery(&QueryStats::nodesVisited);
+    if (pool[node].isLeaf()) {
+        for (const Entry& entry : pool.getEntries(node)) {
+            if (!visitEntry(entry, visitor)) return false;
+        }
+        return true;
+    }
+    for (NodeId child : pool.getChildren(node)) {
+        if (!visitSubtree(child, visitor)) return false;
+    }
+    return true;
+}
+
+// Записи [begin, end) узла, которые может видеть пирамида; planes — плоскости, которые пересекает
+// сам узел: по остальным он и все его потомки целиком внутри
+template <typename Source>
+template <typename Visitor>
+bool BasicRTree3D<Source>::cullNode(NodeId node, size_t begin, size_t end, const Frustum& frustum,
+                                    std::uint32_t planes, Visitor& visitor) const {
+    const bool leaf = pool[node].isLeaf();
+    countQuery(&QueryStats::nodesVisited);
+    countQuery(&QueryStats::boxTests, end - begin);
+    [[maybe_unused]] const std::uint64_t hitsBefore = QUERY_STATS_ENABLED ? threadQueryStats.hits : 0;
+
+    for (size_t chunk = begin; chunk < end; chunk += 64) {
+        const size_t count = std::min<size_t>(64, end - chunk);
+        // Запись снаружи хотя бы одной плоскости отбрасывается; inside[p] — записи по внутреннюю сторону p
+        std::uint64_t outside = 0;
+        std::array<std::uint64_t, std::tuple_size_v<Frustum>> inside{};
+        for (std::uint32_t rest = planes; rest; rest &= rest - 1) {
+            const int p = std::countr_zero(rest);
+            std::uint64_t out;
+            pool.planeMasks(node, chunk, frustum[p], out, inside[p]);
+            outside |= out;
+        }
+
+        std::uint64_t visible = ~outside & (count < 64 ? (std::uint64_t(1) << count) - 1 : ~std::uint64_t(0));
+        while (visible) {
+            const size_t i = std::countr_zero(visible);
+            visible &= visible - 1;
+
+            if (leaf) {
+                if (!visitEntry(pool.getEntries(node)[chunk + i], visitor)) return false;
+                continue;
+            }
+            std::uint32_t childPlanes = 0;
+            for (std::uint32_t rest = planes; rest; rest &= rest - 1) {
+                const int p = std::countr_zero(rest);
+                if (!(inside[p] >> i & 1)) childPlanes |= 1u << p;
+            }
+            const NodeId child = pool.getChildren(node)[chunk + i];
+            const bool more = childPlanes ? cullNode(child, 0, pool[child].count, frustum, childPlanes, visitor)
+                                          : visitSubtree(child, visitor);
+            if (!more) return false;
+        }
+    }
+
+    if constexpr (QUERY_STATS_ENABLED) {
+        if (leaf && threadQueryStats.hits == hitsBefore) countQuery(&QueryStats::falsePositives);
+    }
+    return true;
+}
+
+template <typename Source>
+template <typename Visitor>
+bool BasicRTree3D<Source>::queryNode(NodeId node, const MBR& searchMBR, Visitor& visitor, QueryMode mode) const {
+    if (hasFlag(mode, QueryMode::ContainedSubtrees) && searchMBR.contains(pool[node].mbr)) {
+        return visitSubtree(node, visitor);
+    }
+
+    const size_t count = pool[node].count;
+    const bool leaf = pool[node].isLeaf();
+    countQuery(&QueryStats::nodesVisited);
+    countQuery(&QueryStats::boxTests, count);
+    [[maybe_unused]] const std::uint64_t hitsBefore = QUERY_STATS_ENABLED ? threadQueryStats.hits : 0;
+
+    for (size_t chunk = 0; chunk < count; chunk += 64) {
+        std::uint64_t hits = pool.intersectMask(node, chunk, searchMBR);
+
+        if (leaf && hasFlag(mode, QueryMode::Exact) && hits) {
+            // Кандидаты, прошедшие проверку MBR, собираются подряд и проверяются пачкой
+            std::array<Entry, 64> candidates;
+            size_t candidateCount = 0;
+            for (std::uint64_t rest = hits; rest; rest &= rest - 1) {
+                candidates[candidateCount++] = pool.getEntries(node)[chunk + std::countr_zero(rest)];
+            }
+            std::array<Triangle3D, 64> scratch;
+            const Triangle3D* triangles =
+                source.triangles(std::span<const Entry>(candidates.data(), candidateCount), scratch.data());
+            countQuery(&QueryStats::triangleTests, candidateCount);
+            for (std::uint64_t exact = trianglesIntersectBox(triangles, candidateCount, searchMBR.min, searchMBR.max);
+                 exact; exact &= exact - 1) {
+                if (!visitEntry(candidates[std::countr_zero(exact)], visitor)) return false;
+            }
+            continue;
+        }
+
+        while (hits) {
+            const size_t i = chunk + std::countr_zero(hits);
+            hits &= hits - 1;
+
+            if (!leaf) {
+                if (!queryNode(pool.getChildren(node)[i], searchMBR, visitor, mode)) return false;
+                continue;
+            }
+            if (!visitEntry(pool.getEntries(node)[i], visitor)) return false;
+        }
+    }
+
+    if constexpr (QUERY_STATS_ENABLED) {
+        if (leaf && threadQueryStats.hits == hitsBefore) countQuery(&QueryStats::falsePositives);
+    }
+    return true;
+}
+
+template <typename Source>
+std::ostream& operator<<(std::ostream& os, const BasicRTree3D<Source>& tree) {
+    std::function<void(NodeId, const std::string&, bool)> recur;
+    recur = [&](NodeId id, const std::string& prefix, bool isLast) {
+        const auto& node = tree.pool[id];
         os << prefix
            << (isLast ? "└── " : "├── ")
-           << (node->isLeaf() ? "Leaf" : "Node");
+           << (node.isLeaf() ? "Leaf" : "Node");
 
-        const auto& box = node->getMBR();
+        const auto& box = node.mbr;
         os << " [(" << box.min.x << "," << box.min.y << "," << box.min.z << ") - ("
            << box.max.x << "," << box.max.y << "," << box.max.z << ")]\n";
 
-        if (node->isLeaf()) {
-            auto leaf = std::dynamic_pointer_cast<RTreeLeaf>(node);
-            const auto& tris = leaf->getTriangles();
+        if (node.isLeaf()) {
+            const auto tris = tree.pool.getEntries(id);
             std::string childIndent = prefix + (isLast ? "    " : "│   ");
 
             for (size_t i = 0; i < tris.size(); ++i) {
-                const auto& t = tris[i];
+                const Triangle3D& t = tree.source.triangle(tris[i]);
                 os << childIndent << (i == tris.size() - 1 ? "└── " : "├── ")
                    << "Triangle " << i << ":\n";
                 os << childIndent << "    A: (" << t.a.x << ", " << t.a.y << ", " << t.a.z << ")\n";
@@ -87,15 +772,15 @@ inline std::ostream& operator<<(std::ostream& os, const RTree3D& tree) {
                 os << childIndent << "    C: (" << t.c.x << ", " << t.c.y << ", " << t.c.z << ")\n";
             }
         } else {
-            auto inner = std::dynamic_pointer_cast<RTreeInnerNode>(node);
-            const auto& children = inner->getChildren();
+            const auto children = tree.pool.getChildren(id);
             for (size_t i = 0; i < children.size(); ++i) {
                 recur(children[i], prefix + (isLast ? "    " : "│   "), i == children.size() - 1);
             }
         }
     };
 
-    recur(tree.root, "", true);
+    const auto guard = tree.pin();
+    recur(tree.currentRoot(), "", true);
     return os;
 }
 
@@ -0,0 +1,288 @@
+#ifndef RTREEFILE_H
+#define RTREEFILE_H
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "MBR.h"
+#include "MBRBlock.h"
+#include "../geometry/Triangle3D.h"
+
+// Формат файла упакованного дерева (RTree3D::save, MappedRTree).
+//
+// Узлы лежат в порядке обхода в ширину, поэтому потомки любого узла занимают
+// непрерывный диапазон индексов, а листья — хвост массива начиная с leafBegin.
+// Треугольники листьев тоже идут подряд в порядке листьев. Прямоугольники узлов
+// и треугольников хранятся как структура массивов, так что MBRView читает их
+// прямо из отображённой памяти. Все секции выровнены по ALIGNMENT.
+// Числа записываются в порядке байт машины; чужой порядок отвергается при открытии.
+//
+// Прямоугольники хранятся либо как float (boxBits == 32), либо квантованными до 16 или 8 бит
+// относительно рамки родителя (Frame): у потомков корня — относительно rootBox, у остальных —
+// относительно восстановленного прямоугольника их родителя. Округление консервативное:
+// восстановленный прямоугольник всегда содержит исходный.
+namespace packed {
+
+constexpr char MAGIC[8] = { 'R', 'T', 'R', 'E', 'E', '3', 'D', '\0' };
+constexpr std::uint32_t VERSION = 2;
+constexpr std::uint32_t ENDIAN_TAG = 0x01020304;
+constexpr size_t ALIGNMENT = 64;
+// MappedRTree обходит узлы рекурсивно, поэтому более высокие деревья не сохраняются и не открываются
+constexpr std::uint32_t MAX_HEIGHT = 128;
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint32_t maxChildren;
+    std::uint32_t height;               // глубина листьев, не больше MAX_HEIGHT
+    std::uint32_t boxBits;              // 32, 16 или 8
+    std::uint32_t reserved;
+    float rootBox[6];                   // MBR корня: min, затем max
+    std::uint64_t nodeCount;
+    std::uint64_t leafBegin;
+    std::uint64_t triangleCount;
+    std::uint64_t nodesOffset;          // PackedNode[nodeCount]
+    std::uint64_t nodeBoxesOffset;      // 6 массивов по boxStride(nodeCount, boxBits) значений
+    std::uint64_t trianglesOffset;      // Triangle3D[triangleCount]
+    std::uint64_t triangleBoxesOffset;  // 6 массивов по boxStride(triangleCount, boxBits) значений
+    std::uint64_t fileSize;
+    std::uint64_t payloadChecksum;      // байты [nodesOffset, fileSize)
+    std::uint64_t headerChecksum;       // все предыдущие поля заголовка
+};
+
+// Для внутреннего узла first — индекс первого потомка, для листа — первого треугольника.
+struct PackedNode {
+    std::uint32_t first;
+    std::uint32_t count;
+};
+
+static_assert(std::is_trivially_copyable_v<Triangle3D> && sizeof(Triangle3D) == 9 * sizeof(float));
+static_assert(sizeof(Header) % 8 == 0);
+
+inline std::uint64_t align(std::uint64_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Длина одного массива координат: с запасом на чтение целой пачки и выравниванием следующего
+inline std::uint64_t boxStride(std::uint64_t count, std::uint32_t boxBits = 32) {
+    const std::uint64_t bytes = boxBits / 8;
+    return align((count + MBRView::WIDTH) * bytes) / bytes;
+}
+
+inline std::uint64_t boxesSize(std::uint64_t count, std::uint32_t boxBits) {
+    return 6 * boxStride(count, boxBits) * (boxBits / 8);
+}
+
+inline MBRView boxView(const std::byte* base, std::uint64_t count) {
+    const auto* f = reinterpret_cast<const float*>(base);
+    const std::uint64_t stride = boxStride(count);
+    return { f, f + stride, f + 2 * stride, f + 3 * stride, f + 4 * stride, f + 5 * stride };
+}
+
+// Рамка квантования: значение q по оси восстанавливается как min + q * step.
+// Шаг — степень двойки, поэтому q * step вычисляется точно и восстановление даёт
+// одинаковый результат при любых флагах компиляции, в том числе с FMA.
+struct Frame {
+    float min[3];
+    float step[3];
+
+    float decode(int axis, std::uint32_t q) const {
+        return min[axis] + static_cast<float>(q) * step[axis];
+    }
+};
+
+// Квантованный прямоугольник: нижние границы, затем верхние
+using QuantizedBox = std::array<std::uint32_t, 6>;
+
+inline float coordinate(const Point3D& p, int axis) {
+    return axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+}
+
+// Наименьший шаг-степень двойки, при котором levels шагов от min покрывают box
+inline Frame makeFrame(const MBR& box, std::uint32_t levels) {
+    Frame frame;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float lo = coordinate(box.min, axis), hi = coordinate(box.max, axis);
+        // Начинаем со степени двойки не больше extent: отбрасываем мантиссу. Шаг мельче
+        // точности float у границ бесполезен — соседние значения совпали бы после округления, —
+        // поэтому снизу он ограничен ulp наибольшей по модулю границы (и наименьшим нормальным).
+        const float extent = (hi - lo) / static_cast<float>(levels);
+        const std::uint32_t bits = std::isfinite(extent) && extent > 0.0f ? std::bit_cast<std::uint32_t>(extent) : 0;
+        const std::uint32_t magnitude = std::bit_cast<std::uint32_t>(std::max(std::fabs(lo), std::fabs(hi))) & 0x7F800000u;
+        const std::uint32_t ulp = magnitude > (23u << 23) ? magnitude - (23u << 23) : 0;
+        frame.min[axis] = lo;
+        frame.step[axis] = std::bit_cast<float>(std::max({ bits & 0x7F800000u, ulp, 0x00800000u }));
+        while (frame.decode(axis, levels) < hi) {
+            frame.step[axis] *= 2.0f;
+        }
+    }
+    return frame;
+}
+
+// Нижняя граница округляется вниз, верхняя вверх; box должен лежать внутри рамки
+inline QuantizedBox quantize(const Frame& frame, const MBR& box, std::uint32_t levels) {
+    QuantizedBox q;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float lo = coordinate(box.min, axis), hi = coordinate(box.max, axis);
+        const float step = frame.step[axis];
+        auto& qlo = q[axis];
+        auto& qhi = q[axis + 3];
+        qlo = static_cast<std::uint32_t>(std::clamp(std::floor((lo - frame.min[axis]) / step), 0.0f, float(levels)));
+        qhi = static_cast<std::uint32_t>(std::clamp(std::ceil((hi - frame.min[axis]) / step), 0.0f, float(levels)));
+        while (qlo > 0 && frame.decode(axis, qlo) > lo) --qlo;
+        while (qhi < levels && frame.decode(axis, qhi) < hi) ++qhi;
+    }
+    return q;
+}
+
+inline MBR dequantize(const Frame& frame, const QuantizedBox& q) {
+    MBR box;
+    box.min = { frame.decode(0, q[0]), frame.decode(1, q[1]), frame.decode(2, q[2]) };
+    box.max = { frame.decode(0, q[3]), frame.decode(1, q[4]), frame.decode(2, q[5]) };
+    return box;
+}
+
+// Запрос в целых координатах рамки: восстановленный прямоугольник q пересекает запрос
+// ровно тогда, когда q.lo <= loMax и q.hi >= hiMin по всем осям (восстановление монотонно).
+struct QuantizedQuery {
+    std::int32_t loMax[3];
+    std::int32_t hiMin[3];
+    bool empty;
+};
+
+inline QuantizedQuery quantizeQuery(const Frame& frame, const MBR& query, std::uint32_t levels) {
+    QuantizedQuery result{};
+    result.empty = false;
+    const auto top = static_cast<std::int32_t>(levels);
+    for (int axis = 0; axis < 3; ++axis) {
+        // Шаг — степень двойки, умножение на обратный точно так же, как деление
+        const float inverse = 1.0f / frame.step[axis];
+        const float qmax = coordinate(query.max, axis), qmin = coordinate(query.min, axis);
+
+        // Оценки округляются отбрасыванием дробной части, точное значение находят циклы.
+        // Наибольшее k с decode(k) <= qmax
+        const float rmax = (qmax - frame.min[axis]) * inverse;
+        std::int32_t k = rmax < 0.0f ? -1 : rmax > float(top) ? top : static_cast<std::int32_t>(rmax);
+        while (k >= 0 && frame.decode(axis, k) > qmax) --k;
+        while (k < top && frame.decode(axis, k + 1) <= qmax) ++k;
+
+        // Наименьшее m с decode(m) >= qmin
+        const float rmin = (qmin - frame.min[axis]) * inverse;
+        std::int32_t m = rmin < 0.0f ? 0 : rmin > float(top) ? top + 1 : static_cast<std::int32_t>(rmin);
+        while (m > 0 && frame.decode(axis, m - 1) >= qmin) --m;
+        while (m <= top && frame.decode(axis, m) < qmin) ++m;
+
+        result.loMax[axis] = k;
+        result.hiMin[axis] = m;
+        if (k < 0 || m > top) result.empty = true;
+    }
+    return result;
+}
+
+// Квантованные прямоугольники в виде структуры массивов из T (uint16_t или uint8_t)
+template <typename T>
+struct QuantizedView {
+    static constexpr std::uint32_t LEVELS = (1u << (8 * sizeof(T))) - 1;
+
+    const T* column[6];
+
+    static QuantizedView at(const std::byte* base, std::uint64_t count) {
+        const auto* v = reinterpret_cast<const T*>(base);
+        const std::uint64_t stride = boxStride(count, 8 * sizeof(T));
+        return { { v, v + stride, v + 2 * stride, v + 3 * stride, v + 4 * stride, v + 5 * stride } };
+    }
+
+    QuantizedBox get(size_t i) const {
+        QuantizedBox q;
+        for (int c = 0; c < 6; ++c) {
+            q[c] = column[c][i];
+        }
+        return q;
+    }
+
+    // Маска записей [first, first + count), пересекающих запрос; count <= 64, query не пуст.
+    std::uint64_t intersectMask(size_t first, size_t count, const QuantizedQuery& query) const;
+};
+
+template <typename T>
+std::uint64_t QuantizedView<T>::intersectMask(size_t first, size_t count, const QuantizedQuery& query) const {
+    std::uint64_t mask = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // По 8 записей за шаг в 16-битных дорожках; сравнение без знака через сдвиг на 0x8000
+    const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    auto load = [&](int c, size_t j) {
+        if constexpr (sizeof(T) == 2) {
+            return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(column[c] + j)), flip);
+        } else {
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(column[c] + j));
+            return _mm_xor_si128(_mm_unpacklo_epi8(bytes, _mm_setzero_si128()), flip);
+        }
+    };
+    auto bound = [&](std::int32_t value) {
+        return _mm_xor_si128(_mm_set1_epi16(static_cast<short>(value)), flip);
+    };
+    __m128i loMax[3], hiMin[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        loMax[axis] = bound(query.loMax[axis]);
+        hiMin[axis] = bound(query.hiMin[axis]);
+    }
+    for (; i < count; i += 8) {
+        const size_t j = first + i;
+        __m128i miss = _mm_setzero_si128();
+        for (int axis = 0; axis < 3; ++axis) {
+            miss = _mm_or_si128(miss, _mm_cmpgt_epi16(load(axis, j), loMax[axis]));
+            miss = _mm_or_si128(miss, _mm_cmpgt_epi16(hiMin[axis], load(axis + 3, j)));
+        }
+        const auto bits = static_cast<std::uint64_t>(~_mm_movemask_epi8(_mm_packs_epi16(miss, miss)) & 0xFF);
+        mask |= bits << i;
+    }
+    if (count < 64) mask &= (std::uint64_t(1) << count) - 1;
+#else
+    for (; i < count; ++i) {
+        const size_t j = first + i;
+        bool hit = true;
+        for (int axis = 0; axis < 3; ++axis) {
+            hit = hit && std::int32_t(column[axis][j]) <= query.loMax[axis] &&
+                  std::int32_t(column[axis + 3][j]) >= query.hiMin[axis];
+        }
+        if (hit) mask |= std::uint64_t(1) << i;
+    }
+#endif
+    return mask;
+}
+
+// FNV-1a по 64-битным словам: не криптостойкая, но ловит повреждения и читает ~8 байт за шаг
+inline std::uint64_t checksum(const void* data, size_t size, std::uint64_t hash = 0xcbf29ce484222325ull) {
+    constexpr std::uint64_t PRIME = 0x100000001b3ull;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * PRIME;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * PRIME;
+    }
+    return hash;
+}
+
+inline std::uint64_t headerChecksum(const Header& header) {
+    return checksum(&header, offsetof(Header, headerChecksum));
+}
+
+} // namespace packed
+
+#endif //RTREEFILE_H
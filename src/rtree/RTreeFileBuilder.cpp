@@ -0,0 +1,470 @@
+#include "RTreeFileBuilder.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "BulkLoad.h"
+#include "RTreeFile.h"
+#include "SpaceFillingCurve.h"
+#include "../geometry/MeshLoader.h"
+
+namespace {
+
+// Серии читаются кусками не меньше этого; меньшие буферы превращают слияние в случайное чтение
+constexpr size_t MIN_RUN_BUFFER = size_t(1) << 16;
+// Буфер перекладки треугольников между файлом и массивом сортировки
+constexpr size_t SLICE = 4096;
+
+struct Keyed {
+    std::uint64_t key;
+    Triangle3D triangle;
+};
+
+// Буферизованная запись с заданного места файла: уровни дерева и массивы координат
+// заполняются каждый по порядку, но лежат в разных частях файла
+class RegionWriter {
+    std::fstream* file;
+    std::uint64_t offset;
+    std::vector<char> buffer;
+    size_t capacity;
+
+public:
+    RegionWriter(std::fstream& file, std::uint64_t offset, size_t capacity)
+        : file(&file), offset(offset), capacity(capacity) {
+        buffer.reserve(capacity);
+    }
+
+    void write(const void* data, size_t size) {
+        if (buffer.size() + size > capacity) flush();
+        const auto* bytes = static_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void write(const T& value) {
+        write(&value, sizeof(T));
+    }
+
+    void flush() {
+        if (buffer.empty()) return;
+        file->seekp(static_cast<std::streamoff>(offset));
+        file->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        offset += buffer.size();
+        buffer.clear();
+    }
+};
+
+// Серия [first, first + length) файла серий, читаемая кусками через общий поток
+class RunReader {
+    std::fstream* file;
+    std::uint64_t offset;
+    std::uint64_t remaining;
+    std::vector<Triangle3D> buffer;
+    size_t position = 0;
+    size_t capacity;
+
+public:
+    bool failed = false;
+
+    RunReader(std::fstream& file, std::uint64_t first, std::uint64_t length, size_t capacity)
+        : file(&file), offset(first * sizeof(Triangle3D)), remaining(length), capacity(capacity) {}
+
+    bool next(Triangle3D& triangle) {
+        if (position == buffer.size()) {
+            if (remaining == 0) return false;
+            buffer.resize(static_cast<size_t>(std::min<std::uint64_t>(capacity, remaining)));
+            file->seekg(static_cast<std::streamoff>(offset));
+            file->read(reinterpret_cast<char*>(buffer.data()),
+                       static_cast<std::streamsize>(buffer.size() * sizeof(Triangle3D)));
+            if (!*file) {
+                failed = true;
+                return false;
+            }
+            offset += buffer.size() * sizeof(Triangle3D);
+            remaining -= buffer.size();
+            position = 0;
+        }
+        triangle = buffer[position++];
+        return true;
+    }
+};
+
+// Память буферов чтения серий: короткой серии целый буфер не нужен
+std::uint64_t readerBytes(std::span<const std::uint64_t> lengths, size_t bufferTriangles) {
+    std::uint64_t bytes = 0;
+    for (std::uint64_t length : lengths) {
+        bytes += std::min<std::uint64_t>(length, bufferTriangles) * sizeof(Triangle3D);
+    }
+    return bytes;
+}
+
+// Слияние подряд лежащих серий lengths, начиная с треугольника first: sink получает
+// треугольники по возрастанию key, при равных ключах — в порядке серий
+template <typename Key, typename Sink>
+bool mergeSlice(std::fstream& in, std::uint64_t first, std::span<const std::uint64_t> lengths, size_t bufferTriangles,
+                Key&& key, Sink&& sink) {
+    std::vector<RunReader> readers;
+    readers.reserve(lengths.size());
+    for (std::uint64_t length : lengths) {
+        readers.emplace_back(in, first, length, bufferTriangles);
+        first += length;
+    }
+
+    using Head = std::pair<std::uint64_t, size_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<>> heap;
+    std::vector<Triangle3D> heads(readers.size());
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (readers[i].next(heads[i])) heap.push({ key(heads[i]), i });
+    }
+    while (!heap.empty()) {
+        const size_t i = heap.top().second;
+        heap.pop();
+        sink(heads[i]);
+        if (readers[i].next(heads[i])) heap.push({ key(heads[i]), i });
+    }
+    return std::none_of(readers.begin(), readers.end(), [](const RunReader& r) { return r.failed; });
+}
+
+// Упаковка отсортированного потока снизу вверх. У каждого уровня свой незаполненный узел;
+// готовый узел пишется на своё место и добавляется как запись в уровень выше
+class PackedWriter {
+    std::fstream& file;
+    std::vector<bulk::GroupShape> shapes;
+    std::vector<std::uint64_t> levelStart;
+
+    struct Level {
+        std::uint64_t index = 0;       // номер следующего узла уровня
+        std::uint64_t firstChild = 0;  // номер первой записи открытого узла на уровне ниже
+        std::uint32_t filled = 0;
+        MBR box;
+    };
+    std::vector<Level> levels;
+
+    std::vector<RegionWriter> nodeWriters;
+    std::vector<std::array<RegionWriter*, 6>> nodeBoxWriters;
+    std::vector<RegionWriter> boxWriters;
+    RegionWriter* triangleWriter = nullptr;
+    std::array<RegionWriter*, 6> triangleBoxWriters{};
+
+    static std::array<float, 6> coordinates(const MBR& box) {
+        return { box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z };
+    }
+
+    void add(size_t level, const MBR& box) {
+        Level& current = levels[level];
+        current.box.expandToInclude(box);
+        if (++current.filled < shapes[level].groupSize(current.index)) return;
+
+        const std::uint64_t first = level == 0 ? current.firstChild : levelStart[level - 1] + current.firstChild;
+        nodeWriters[level].write(packed::PackedNode{ static_cast<std::uint32_t>(first), current.filled });
+        const auto values = coordinates(current.box);
+        for (size_t c = 0; c < 6; ++c) {
+            nodeBoxWriters[level][c]->write(values[c]);
+        }
+        if (level + 1 < levels.size()) {
+            add(level + 1, current.box);
+        } else {
+            rootBox = current.box;
+        }
+        current.firstChild += current.filled;
+        current.filled = 0;
+        current.box = MBR();
+        ++current.index;
+    }
+
+public:
+    packed::Header header{};
+    MBR rootBox;
+
+    PackedWriter(std::fstream& file, std::uint64_t triangleCount, size_t minChildren, size_t maxChildren,
+                 size_t bufferBytes, size_t& allocated)
+        : file(file) {
+        // Уровни снизу вверх до единственного корня; пустое дерево — один пустой лист
+        for (std::uint64_t items = triangleCount;;) {
+            shapes.emplace_back(items, minChildren, maxChildren);
+            if (shapes.back().groups <= 1) break;
+            items = shapes.back().groups;
+        }
+        // Порядок обхода в ширину — уровни сверху вниз
+        levelStart.assign(shapes.size(), 0);
+        std::uint64_t nodeCount = 1;
+        for (size_t level = shapes.size() - 1; level-- > 0;) {
+            levelStart[level] = nodeCount;
+            nodeCount += shapes[level].groups;
+        }
+        levels.resize(shapes.size());
+
+        std::copy(std::begin(packed::MAGIC), std::end(packed::MAGIC), header.magic);
+        header.version = packed::VERSION;
+        header.byteOrder = packed::ENDIAN_TAG;
+        header.maxChildren = static_cast<std::uint32_t>(maxChildren);
+        header.height = static_cast<std::uint32_t>(shapes.size() - 1);
+        header.boxBits = 32;
+        header.nodeCount = nodeCount;
+        header.leafBegin = levelStart[0];
+        header.triangleCount = triangleCount;
+        header.nodesOffset = packed::align(sizeof(packed::Header));
+        header.nodeBoxesOffset = packed::align(header.nodesOffset + nodeCount * sizeof(packed::PackedNode));
+        header.trianglesOffset = header.nodeBoxesOffset + packed::boxesSize(nodeCount, 32);
+        header.triangleBoxesOffset = packed::align(header.trianglesOffset + triangleCount * sizeof(Triangle3D));
+        header.fileSize = header.triangleBoxesOffset + packed::boxesSize(triangleCount, 32);
+
+        // Буферы: узлы и 6 координат на уровень, треугольники и их 6 координат
+        const size_t writers = 7 * levels.size() + 7;
+        const size_t capacity = std::clamp<size_t>(bufferBytes / writers, 4096, size_t(1) << 20);
+        allocated = writers * capacity;
+        const std::uint64_t nodeStride = packed::boxStride(nodeCount) * sizeof(float);
+        const std::uint64_t triangleStride = packed::boxStride(triangleCount) * sizeof(float);
+
+        nodeWriters.reserve(levels.size());
+        boxWriters.reserve(6 * levels.size() + 7);
+        for (size_t level = 0; level < levels.size(); ++level) {
+            nodeWriters.emplace_back(file, header.nodesOffset + levelStart[level] * sizeof(packed::PackedNode), capacity);
+            std::array<RegionWriter*, 6> columns{};
+            for (size_t c = 0; c < 6; ++c) {
+                boxWriters.emplace_back(file, header.nodeBoxesOffset + c * nodeStride + levelStart[level] * sizeof(float),
+                                        capacity);
+                columns[c] = &boxWriters.back();
+            }
+            nodeBoxWriters.push_back(columns);
+        }
+        boxWriters.emplace_back(file, header.trianglesOffset, capacity);
+        triangleWriter = &boxWriters.back();
+        for (size_t c = 0; c < 6; ++c) {
+            boxWriters.emplace_back(file, header.triangleBoxesOffset + c * triangleStride, capacity);
+            triangleBoxWriters[c] = &boxWriters.back();
+        }
+    }
+
+    void push(const Triangle3D& triangle) {
+        const MBR box(triangle);
+        triangleWriter->write(triangle);
+        const auto values = coordinates(box);
+        for (size_t c = 0; c < 6; ++c) {
+            triangleBoxWriters[c]->write(values[c]);
+        }
+        add(0, box);
+    }
+
+    // Дописывает пустой корень пустого дерева и хвосты массивов координат, как save
+    bool finish() {
+        if (header.triangleCount == 0) {
+            nodeWriters[0].write(packed::PackedNode{ 0, 0 });
+            const auto values = coordinates(MBR());
+            for (size_t c = 0; c < 6; ++c) {
+                nodeBoxWriters[0][c]->write(values[c]);
+            }
+        }
+        const auto empty = coordinates(MBR());
+        auto padColumns = [&](std::uint64_t offset, std::uint64_t count) {
+            const std::uint64_t stride = packed::boxStride(count);
+            for (size_t c = 0; c < 6; ++c) {
+                RegionWriter tail(file, offset + (c * stride + count) * sizeof(float), 4096);
+                for (std::uint64_t i = count; i < stride; ++i) {
+                    tail.write(empty[c]);
+                }
+                tail.flush();
+            }
+        };
+
+        for (auto& writer : nodeWriters) writer.flush();
+        for (auto& writer : boxWriters) writer.flush();
+        padColumns(header.nodeBoxesOffset, header.nodeCount);
+        padColumns(header.triangleBoxesOffset, header.triangleCount);
+
+        const float root[6] = { rootBox.min.x, rootBox.min.y, rootBox.min.z, rootBox.max.x, rootBox.max.y, rootBox.max.z };
+        std::copy(std::begin(root), std::end(root), header.rootBox);
+        return static_cast<bool>(file.flush());
+    }
+};
+
+} // namespace
+
+RTreeFileBuilder::RTreeFileBuilder(std::string filename, size_t memoryBudget, size_t minChildren, size_t maxChildren,
+                                   BulkLoadStrategy strategy)
+    : filename(std::move(filename)), budget(std::max(memoryBudget, MIN_BUDGET)), minChildren(minChildren),
+      maxChildren(std::max<size_t>(maxChildren, 2)),
+      strategy(strategy == BulkLoadStrategy::Morton ? BulkLoadStrategy::Morton : BulkLoadStrategy::Hilbert) {
+    raw.open(tempName(".raw"), std::ios::binary | std::ios::trunc);
+    failed = !raw.is_open();
+}
+
+RTreeFileBuilder::~RTreeFileBuilder() {
+    raw.close();
+    removeTemporaries();
+}
+
+std::string RTreeFileBuilder::tempName(const char* suffix) const {
+    return filename + suffix;
+}
+
+std::uint64_t RTreeFileBuilder::key(const Triangle3D& triangle) const {
+    const Point3D center = MBR(triangle).center();
+    return strategy == BulkLoadStrategy::Morton ? curve::morton(center, bounds) : curve::hilbert(center, bounds);
+}
+
+bool RTreeFileBuilder::add(std::span<const Triangle3D> triangles) {
+    if (failed) return false;
+    for (const auto& triangle : triangles) {
+        bounds.expandToInclude(MBR(triangle).center());
+    }
+    raw.write(reinterpret_cast<const char*>(triangles.data()),
+              static_cast<std::streamsize>(triangles.size() * sizeof(Triangle3D)));
+    count += triangles.size();
+    failed = !raw;
+    return !failed;
+}
+
+bool RTreeFileBuilder::finish() {
+    raw.close();
+    std::vector<std::uint64_t> runLengths;
+    const bool ok = !failed && count <= UINT32_MAX && sortRuns(runLengths) && mergeRuns(runLengths) &&
+                    writeTree(runLengths);
+    failed = true;
+    removeTemporaries();
+    return ok;
+}
+
+// Серии по budget / sizeof(Keyed) треугольников, каждая отсортирована по ключу
+bool RTreeFileBuilder::sortRuns(std::vector<std::uint64_t>& runLengths) {
+    std::ifstream in(tempName(".raw"), std::ios::binary);
+    std::ofstream out(tempName(".run0"), std::ios::binary | std::ios::trunc);
+    if (!in.is_open() || !out.is_open()) return false;
+
+    const size_t chunk = std::max<size_t>(1, (budget - SLICE * sizeof(Triangle3D)) / sizeof(Keyed));
+    std::vector<Keyed> keyed;
+    keyed.reserve(static_cast<size_t>(std::min<std::uint64_t>(chunk, count)));
+    std::vector<Triangle3D> slice(SLICE);
+    peakBytes = std::max(peakBytes, keyed.capacity() * sizeof(Keyed) + slice.size() * sizeof(Triangle3D));
+
+    for (std::uint64_t remaining = count; remaining > 0;) {
+        const size_t length = static_cast<size_t>(std::min<std::uint64_t>(chunk, remaining));
+        keyed.clear();
+        while (keyed.size() < length) {
+            const size_t n = std::min(SLICE, length - keyed.size());
+            if (!in.read(reinterpret_cast<char*>(slice.data()), static_cast<std::streamsize>(n * sizeof(Triangle3D)))) {
+                return false;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                keyed.push_back({ key(slice[i]), slice[i] });
+            }
+        }
+        std::sort(keyed.begin(), keyed.end(), [](const Keyed& a, const Keyed& b) { return a.key < b.key; });
+
+        for (size_t begin = 0; begin < keyed.size(); begin += SLICE) {
+            const size_t n = std::min(SLICE, keyed.size() - begin);
+            for (size_t i = 0; i < n; ++i) {
+                slice[i] = keyed[begin + i].triangle;
+            }
+            out.write(reinterpret_cast<const char*>(slice.data()), static_cast<std::streamsize>(n * sizeof(Triangle3D)));
+        }
+        runLengths.push_back(length);
+        remaining -= length;
+    }
+    runs = runLengths.size();
+    in.close();
+    std::remove(tempName(".raw").c_str());
+    return static_cast<bool>(out.flush());
+}
+
+// Промежуточные проходы: группы по fanIn серий сливаются в одну, пока серий больше fanIn.
+// Половина бюджета — буферы чтения серий, половина — буфер записи
+bool RTreeFileBuilder::mergeRuns(std::vector<std::uint64_t>& runLengths) {
+    const size_t fanIn = std::max<size_t>(2, budget / 2 / MIN_RUN_BUFFER);
+    const size_t readBuffer = budget / 2 / fanIn / sizeof(Triangle3D);
+    auto keyOf = [this](const Triangle3D& t) { return key(t); };
+
+    while (runLengths.size() > fanIn) {
+        const char* inName = runFile == 0 ? ".run0" : ".run1";
+        const char* outName = runFile == 0 ? ".run1" : ".run0";
+        std::fstream in(tempName(inName), std::ios::in | std::ios::binary);
+        std::fstream out(tempName(outName), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!in.is_open() || !out.is_open()) return false;
+
+        RegionWriter writer(out, 0, budget / 2);
+        std::vector<std::uint64_t> merged;
+        std::uint64_t first = 0;
+        for (size_t begin = 0; begin < runLengths.size(); begin += fanIn) {
+            const auto group = std::span<const std::uint64_t>(runLengths).subspan(
+                begin, std::min(fanIn, runLengths.size() - begin));
+            std::uint64_t length = 0;
+            for (std::uint64_t l : group) length += l;
+            peakBytes = std::max<size_t>(peakBytes, budget / 2 + readerBytes(group, readBuffer));
+            const bool ok = mergeSlice(in, first, group, readBuffer, keyOf, [&writer](const Triangle3D& t) {
+                writer.write(t);
+            });
+            if (!ok) return false;
+            merged.push_back(length);
+            first += length;
+        }
+        writer.flush();
+        if (!out.flush()) return false;
+
+        runLengths = std::move(merged);
+        runFile = 1 - runFile;
+        ++passes;
+    }
+    return true;
+}
+
+// Последнее слияние сразу упаковывается в файл дерева; затем считается контрольная сумма
+// данных и пишется заголовок
+bool RTreeFileBuilder::writeTree(const std::vector<std::uint64_t>& runLengths) {
+    std::fstream in(tempName(runFile == 0 ? ".run0" : ".run1"), std::ios::in | std::ios::binary);
+    std::fstream file(filename, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!in.is_open() || !file.is_open()) return false;
+
+    size_t writerBytes = 0;
+    PackedWriter writer(file, count, minChildren, maxChildren, budget / 2, writerBytes);
+    const size_t readBuffer = std::max<size_t>(1, budget / 2 / std::max<size_t>(runLengths.size(), 1) / sizeof(Triangle3D));
+    peakBytes = std::max<size_t>(peakBytes, writerBytes + readerBytes(runLengths, readBuffer));
+
+    auto keyOf = [this](const Triangle3D& t) { return key(t); };
+    if (!mergeSlice(in, 0, runLengths, readBuffer, keyOf, [&writer](const Triangle3D& t) { writer.push(t); })) {
+        return false;
+    }
+    ++passes;
+    if (!writer.finish()) return false;
+
+    // Контрольная сумма — одним последовательным чтением, кусками кратными 8 байтам
+    packed::Header& header = writer.header;
+    std::vector<char> buffer(std::min<size_t>(budget / 2 / 8 * 8, size_t(1) << 24));
+    peakBytes = std::max(peakBytes, writerBytes + buffer.size());
+    std::uint64_t hash = packed::checksum(nullptr, 0);
+    file.seekg(static_cast<std::streamoff>(header.nodesOffset));
+    for (std::uint64_t remaining = header.fileSize - header.nodesOffset; remaining > 0;) {
+        const size_t n = static_cast<size_t>(std::min<std::uint64_t>(buffer.size(), remaining));
+        if (!file.read(buffer.data(), static_cast<std::streamsize>(n))) return false;
+        hash = packed::checksum(buffer.data(), n, hash);
+        remaining -= n;
+    }
+    header.payloadChecksum = hash;
+    header.headerChecksum = packed::headerChecksum(header);
+
+    const std::vector<char> headerBytes(header.nodesOffset);
+    file.seekp(0);
+    file.write(headerBytes.data(), static_cast<std::streamsize>(headerBytes.size()));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return static_cast<bool>(file.flush());
+}
+
+void RTreeFileBuilder::removeTemporaries() const {
+    for (const char* suffix : { ".raw", ".run0", ".run1" }) {
+        std::remove(tempName(suffix).c_str());
+    }
+}
+
+bool buildRTreeFile(const std::string& meshFile, const std::string& filename, size_t memoryBudget,
+                    size_t minChildren, size_t maxChildren) {
+    RTreeFileBuilder builder(filename, memoryBudget, minChildren, maxChildren);
+    // Пачки чтения занимают не больше восьмой части бюджета
+    const size_t chunk = std::max<size_t>(1, std::max(memoryBudget, RTreeFileBuilder::MIN_BUDGET) / 8 / sizeof(Triangle3D));
+    return streamMesh(meshFile, chunk, [&builder](std::span<const Triangle3D> triangles) {
+        return builder.add(triangles);
+    }) && builder.finish();
+}
@@ -0,0 +1,98 @@
+#ifndef RTREEFILEBUILDER_H
+#define RTREEFILEBUILDER_H
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "MBR.h"
+#include "RTree3D.h"
+
+// Построение файла упакованного дерева (формат RTreeFile.h, открывается MappedRTree) из набора
+// треугольников, который не помещается в память.
+//
+// add() дописывает треугольники во временный файл и накапливает их общий MBR. finish() режет
+// его на серии по бюджету памяти, сортирует каждую по ключу кривой от центра MBR треугольника
+// и сливает серии — в несколько проходов, если на все сразу не хватает буферов. Слитый поток
+// упаковывается снизу вверх: лист — подряд идущие треугольники, узел — подряд идущие узлы
+// уровня ниже, группы как в buildTree. Число узлов каждого уровня известно заранее, поэтому
+// уровни пишутся последовательно прямо на свои места в файле, а в памяти держится по одному
+// незаполненному узлу на уровень.
+//
+// memoryBudget ограничивает буферы сортировки, слияния и записи (не меньше MIN_BUDGET).
+// Прямоугольники пишутся как float: квантование требует рамок родителей, а они известны
+// только после записи всех уровней. SortTileRecursive требует нескольких полных сортировок
+// и заменяется на Hilbert. Временные файлы создаются рядом с filename.
+class RTreeFileBuilder {
+public:
+    static constexpr size_t MIN_BUDGET = size_t(1) << 20;
+
+    RTreeFileBuilder(std::string filename, size_t memoryBudget, size_t minChildren = 7, size_t maxChildren = 16,
+                     BulkLoadStrategy strategy = BulkLoadStrategy::Hilbert);
+
+    ~RTreeFileBuilder();
+
+    RTreeFileBuilder(const RTreeFileBuilder&) = delete;
+    RTreeFileBuilder& operator=(const RTreeFileBuilder&) = delete;
+
+    bool add(std::span<const Triangle3D> triangles);
+
+    // Сортирует, сливает и записывает файл, удаляя временные. false при ошибке ввода-вывода
+    // или если треугольников больше, чем позволяет формат (UINT32_MAX).
+    bool finish();
+
+    std::uint64_t triangleCount() const {
+        return count;
+    }
+
+    // Серии первого прохода и число проходов слияния
+    size_t runCount() const {
+        return runs;
+    }
+
+    size_t mergePasses() const {
+        return passes;
+    }
+
+    // Наибольший суммарный размер буферов, выделенных finish
+    size_t peakBufferBytes() const {
+        return peakBytes;
+    }
+
+private:
+    std::string filename;
+    size_t budget;
+    size_t minChildren;
+    size_t maxChildren;
+    BulkLoadStrategy strategy;
+
+    std::ofstream raw;
+    std::uint64_t count = 0;
+    MBR bounds;
+    bool failed = false;
+
+    size_t runs = 0;
+    size_t passes = 0;
+    int runFile = 0;          // серии лежат в ".run0" или ".run1", проходы слияния чередуют их
+    size_t peakBytes = 0;
+
+    std::string tempName(const char* suffix) const;
+
+    std::uint64_t key(const Triangle3D& triangle) const;
+
+    bool sortRuns(std::vector<std::uint64_t>& runLengths);
+
+    bool mergeRuns(std::vector<std::uint64_t>& runLengths);
+
+    bool writeTree(const std::vector<std::uint64_t>& runLengths);
+
+    void removeTemporaries() const;
+};
+
+// Файл дерева прямо из OBJ или STL: треугольники читаются пачками (streamMesh) и передаются
+// RTreeFileBuilder. Вершины OBJ хранятся в памяти сверх memoryBudget.
+bool buildRTreeFile(const std::string& meshFile, const std::string& filename, size_t memoryBudget,
+                    size_t minChildren = 7, size_t maxChildren = 16);
+
+#endif //RTREEFILEBUILDER_H
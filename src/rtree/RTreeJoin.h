@@ -0,0 +1,251 @@
+#ifndef RTREEJOIN_H
+#define RTREEJOIN_H
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Parallel.h"
+#include "RTree3D.h"
+#include "../geometry/TriangleIntersection.h"
+
+// Пространственное соединение двух деревьев: все пары пересекающихся треугольников.
+// Деревья обходятся одновременно; пара узлов раскрывается, только если их MBR пересекаются,
+// дети одного узла отбираются пакетной проверкой против MBR другого. Для пар листьев
+// после проверки MBR записей выполняется точная проверка пересечения треугольников.
+//
+// Верхние уровни раскрываются в ширину, пока пар не хватит на все ядра; затем пары
+// распределяются по WorkStealingPool, и каждая обходится в глубину своим потоком.
+template <typename SourceA, typename SourceB>
+class RTreeJoin {
+public:
+    using TreeA = BasicRTree3D<SourceA>;
+    using TreeB = BasicRTree3D<SourceB>;
+    using EntryA = typename SourceA::Entry;
+    using EntryB = typename SourceB::Entry;
+
+    // Вызывает body(entryA, entryB, worker) для каждой пары; worker — номер участника пула
+    template <typename Body>
+    static void run(const TreeA& a, const TreeB& b, Body&& body) {
+        const auto guardA = a.pin();
+        const auto guardB = b.pin();
+        RTreeJoin(a, b, false).traverse(a.currentRoot(), b.currentRoot(), body);
+    }
+
+    // Соединение дерева с собой: каждая неупорядоченная пара записей проверяется один раз,
+    // пересечение ищется помимо общих вершин и рёбер (meshTrianglesIntersect)
+    template <typename Body>
+    static void runSelf(const TreeA& tree, Body&& body) {
+        const auto guard = tree.pin();
+        const NodeId root = tree.currentRoot();
+        RTreeJoin(tree, tree, true).traverse(root, root, body);
+    }
+
+    // Пары, найденные traverse(body), из буферов потоков в один массив
+    template <typename Traverse>
+    static std::vector<std::pair<EntryA, EntryB>> collect(Traverse&& traverse) {
+        struct alignas(64) WorkerPairs {
+            std::vector<std::pair<EntryA, EntryB>> pairs;
+        };
+
+        std::vector<WorkerPairs> buffers(WorkStealingPool::instance().size());
+        traverse([&buffers](const EntryA& a, const EntryB& b, size_t worker) {
+            buffers[worker].pairs.emplace_back(a, b);
+        });
+
+        size_t total = 0;
+        for (const auto& buffer : buffers) total += buffer.pairs.size();
+        std::vector<std::pair<EntryA, EntryB>> result;
+        result.reserve(total);
+        for (const auto& buffer : buffers) {
+            result.insert(result.end(), buffer.pairs.begin(), buffer.pairs.end());
+        }
+        return result;
+    }
+
+private:
+    static constexpr size_t FRONTIER_PER_WORKER = 16;
+
+    struct NodePair {
+        NodeId a;
+        NodeId b;
+    };
+
+    const TreeA& treeA;
+    const TreeB& treeB;
+    // В соединении с собой пара (a, b) обходится только при a <= b в порядке обхода,
+    // поэтому диагональные пары (n, n) раскрываются в пары детей (i, j) с i <= j.
+    // Листья дерева на одной глубине, так что в паре всегда узлы одного уровня.
+    bool self;
+
+    RTreeJoin(const TreeA& a, const TreeB& b, bool self) : treeA(a), treeB(b), self(self) {}
+
+    template <typename Body>
+    void traverse(NodeId rootA, NodeId rootB, Body& body) const {
+        if (treeA.pool[rootA].count == 0 || treeB.pool[rootB].count == 0) return;
+        if (!treeA.pool[rootA].mbr.intersects(treeB.pool[rootB].mbr)) return;
+        const RTreeJoin& join = *this;
+
+        auto& workers = WorkStealingPool::instance();
+        const size_t target = workers.size() * FRONTIER_PER_WORKER;
+        std::vector<NodePair> frontier{ { rootA, rootB } };
+        std::vector<NodePair> next;
+        while (frontier.size() < target) {
+            next.clear();
+            bool expanded = false;
+            for (const NodePair& pair : frontier) {
+                if (join.bothLeaves(pair)) {
+                    next.push_back(pair);
+                    continue;
+                }
+                join.expand(pair, [&next](const NodePair& child) {
+                    next.push_back(child);
+                });
+                expanded = true;
+            }
+            frontier.swap(next);
+            if (!expanded) break;
+        }
+
+        workers.run(frontier.size(), 1, [&](size_t begin, size_t end, size_t worker) {
+            auto emit = [&body, worker](const EntryA& x, const EntryB& y) {
+                body(x, y, worker);
+            };
+            for (size_t i = begin; i < end; ++i) {
+                join.descend(frontier[i], emit);
+            }
+        });
+    }
+
+    bool bothLeaves(const NodePair& pair) const {
+        return treeA.pool[pair.a].isLeaf() && treeB.pool[pair.b].isLeaf();
+    }
+
+    // Вызывает visit(child) для дочерних пар с пересекающимися MBR. Если внутренние оба узла,
+    // раскрываются оба; иначе — только внутренний.
+    template <typename Visit>
+    void expand(const NodePair& pair, Visit&& visit) const {
+        const auto& poolA = treeA.pool;
+        const auto& poolB = treeB.pool;
+        const bool leafA = poolA[pair.a].isLeaf(), leafB = poolB[pair.b].isLeaf();
+
+        if (leafA) {
+            forEachChild(poolB, pair.b, poolA[pair.a].mbr, [&](size_t j) {
+                visit(NodePair{ pair.a, poolB.getChildren(pair.b)[j] });
+            });
+            return;
+        }
+        if (leafB) {
+            forEachChild(poolA, pair.a, poolB[pair.b].mbr, [&](size_t i) {
+                visit(NodePair{ poolA.getChildren(pair.a)[i], pair.b });
+            });
+            return;
+        }
+        const bool diagonal = self && pair.a == pair.b;
+        forEachChild(poolA, pair.a, poolB[pair.b].mbr, [&](size_t i) {
+            const NodeId childA = poolA.getChildren(pair.a)[i];
+            forEachChild(poolB, pair.b, poolA.getBox(pair.a, i), [&](size_t j) {
+                visit(NodePair{ childA, poolB.getChildren(pair.b)[j] });
+            }, diagonal ? i : 0);
+        });
+    }
+
+    template <typename Emit>
+    void descend(const NodePair& pair, Emit& emit) const {
+        if (bothLeaves(pair)) {
+            joinLeaves(pair, emit);
+            return;
+        }
+        expand(pair, [&](const NodePair& child) {
+            descend(child, emit);
+        });
+    }
+
+    // Треугольники листа B собираются один раз; каждая запись A, задевающая лист B,
+    // сверяется с записями B, чьи MBR пересекают её MBR
+    template <typename Emit>
+    void joinLeaves(const NodePair& pair, Emit& emit) const {
+        const auto& poolA = treeA.pool;
+        const auto& poolB = treeB.pool;
+        const auto entriesA = poolA.getEntries(pair.a);
+        const auto entriesB = poolB.getEntries(pair.b);
+
+        const bool diagonal = self && pair.a == pair.b;
+        std::array<Triangle3D, 64> scratch;
+        for (size_t chunkB = 0; chunkB < entriesB.size(); chunkB += 64) {
+            const auto part = entriesB.subspan(chunkB, std::min<size_t>(64, entriesB.size() - chunkB));
+            const Triangle3D* trianglesB = treeB.source.triangles(part, scratch.data());
+
+            forEachChild(poolA, pair.a, poolB[pair.b].mbr, [&](size_t i) {
+                std::uint64_t hits = poolB.intersectMask(pair.b, chunkB, poolA.getBox(pair.a, i));
+                // В диагональном листе — только записи j > i
+                if (diagonal) hits &= maskFrom(chunkB, i + 1);
+                const Triangle3D triangleA = treeA.source.triangle(entriesA[i]);
+                for (; hits; hits &= hits - 1) {
+                    const size_t j = std::countr_zero(hits);
+                    const bool intersect = self ? meshTrianglesIntersect(triangleA, trianglesB[j])
+                                                : trianglesIntersect(triangleA, trianglesB[j]);
+                    if (intersect) emit(entriesA[i], part[j]);
+                }
+            });
+        }
+    }
+
+    // Маска битов [from - first, 64) блока записей [first, first + 64)
+    static std::uint64_t maskFrom(size_t first, size_t from) {
+        if (from <= first) return ~std::uint64_t(0);
+        return from - first >= 64 ? 0 : ~std::uint64_t(0) << (from - first);
+    }
+
+    // Вызывает visit(i) для записей i >= from узла, чьи MBR пересекают box
+    template <typename Pool, typename Visit>
+    static void forEachChild(const Pool& pool, NodeId node, const MBR& box, Visit&& visit, size_t from = 0) {
+        const size_t count = pool[node].count;
+        for (size_t chunk = from / 64 * 64; chunk < count; chunk += 64) {
+            for (std::uint64_t hits = pool.intersectMask(node, chunk, box) & maskFrom(chunk, from); hits;
+                 hits &= hits - 1) {
+                visit(chunk + std::countr_zero(hits));
+            }
+        }
+    }
+};
+
+// Вызывает callback(entryA, entryB) для каждой пары пересекающихся треугольников деревьев.
+// Вызовы идут одновременно из потоков пула, callback должен быть потокобезопасным.
+// Оба дерева закрепляются на время обхода, параллельная запись в них допустима
+// при Concurrency::CopyOnWrite.
+template <typename SourceA, typename SourceB, typename Callback>
+void join(const BasicRTree3D<SourceA>& treeA, const BasicRTree3D<SourceB>& treeB, Callback&& callback) {
+    RTreeJoin<SourceA, SourceB>::run(treeA, treeB, [&callback](const auto& a, const auto& b, size_t) {
+        callback(a, b);
+    });
+}
+
+// Все пары пересекающихся треугольников; порядок пар не определён.
+template <typename SourceA, typename SourceB>
+std::vector<std::pair<typename SourceA::Entry, typename SourceB::Entry>>
+join(const BasicRTree3D<SourceA>& treeA, const BasicRTree3D<SourceB>& treeB) {
+    return RTreeJoin<SourceA, SourceB>::collect([&](auto&& body) {
+        RTreeJoin<SourceA, SourceB>::run(treeA, treeB, body);
+    });
+}
+
+// Самопересечения сетки: вызывает callback(first, second) для каждой неупорядоченной пары
+// пересекающихся треугольников дерева, кроме соседей, которые касаются только общей вершиной
+// или ребром (см. meshTrianglesIntersect). Вызовы идут из потоков пула по мере нахождения.
+template <typename Source, typename Callback>
+void selfIntersections(const BasicRTree3D<Source>& tree, Callback&& callback) {
+    RTreeJoin<Source, Source>::runSelf(tree, [&callback](const auto& a, const auto& b, size_t) {
+        callback(a, b);
+    });
+}
+
+template <typename Source>
+std::vector<std::pair<typename Source::Entry, typename Source::Entry>> selfIntersections(const BasicRTree3D<Source>& tree) {
+    return RTreeJoin<Source, Source>::collect([&](auto&& body) {
+        RTreeJoin<Source, Source>::runSelf(tree, body);
+    });
+}
+
+#endif //RTREEJOIN_H
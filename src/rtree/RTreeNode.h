@@ -1,12 +1,42 @@
 #ifndef RTREENODE_H
 #define RTREENODE_H
+#include <cstdint>
+#include <limits>
 
-class RTreeNode {
-public:
-    virtual ~RTreeNode() = default;
-    virtual bool isLeaf() const = 0;
-    virtual const MBR& getMBR() const = 0;
-    virtual void recalculateMBR() = 0;
+#include "MBR.h"
+
+using NodeId = std::uint32_t;
+
+constexpr NodeId NULL_NODE = std::numeric_limits<NodeId>::max();
+
+// Дескриптор записи листа: не меняется, пока запись в дереве, как бы её ни перемещали
+// разбиения и перевставки; после удаления записи может быть выдан снова.
+// Отдельный тип, чтобы не путать с номерами треугольников IndexedMesh.
+struct EntryHandle {
+    std::uint32_t index = std::numeric_limits<std::uint32_t>::max();
+
+    bool operator==(const EntryHandle& other) const = default;
+};
+
+constexpr EntryHandle NULL_HANDLE{};
+
+enum class NodeKind : std::uint8_t {
+    Leaf,
+    Inner
+};
+
+struct RTreeNode {
+    MBR mbr;
+    NodeKind kind = NodeKind::Leaf;
+    std::uint32_t count = 0;
+    std::uint32_t slot = 0;
+    // Родитель в дереве писателя; у корня не определён
+    NodeId parent = NULL_NODE;
+    // Версия дерева, в которой узел опубликован впервые. У узлов текущей операции записи —
+    // следующая за опубликованной: они ещё никому не видны, и их можно менять на месте
+    std::uint64_t version = 0;
+
+    bool isLeaf() const { return kind == NodeKind::Leaf; }
 };
 
 #endif //RTREENODE_H
@@ -0,0 +1,463 @@
+#ifndef RTREENODEPOOL_H
+#define RTREENODEPOOL_H
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <memory_resource>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "MBR.h"
+#include "MBRBlock.h"
+#include "RTreeNode.h"
+
+// Узлы адресуются 32-битным индексом. Дочерние индексы и записи листьев (Entry — треугольник
+// или его номер) хранятся в слотах фиксированной ёмкости, отдельно для внутренних узлов и листьев;
+// освобождённые узлы переиспользуются. Рядом со слотом хранятся MBR его записей в виде MBRBlock
+// для пакетных проверок, поэтому геометрия записей нужна пулу только при добавлении.
+//
+// Рядом с каждой записью листа хранится её дескриптор, а пул ведёт таблицу дескриптор → лист
+// и ссылки на родителей, обновляя их при каждом добавлении, копировании и удалении записей
+// и потомков. По ним запись удаляется подъёмом от своего листа, без спуска от корня.
+//
+// Память выделяется страницами: страница k вмещает FIRST_PAGE << k узлов или слотов.
+// Выделенные страницы не перемещаются, поэтому читатели могут обходить опубликованные
+// узлы, пока писатель добавляет новые. Страницы берутся из memory_resource пула
+// (по умолчанию — обычная куча), так что дерево можно разместить в своей арене.
+template <typename Entry>
+class RTreeNodePool {
+    static constexpr size_t FIRST_PAGE_BITS = 6;
+    static constexpr size_t PAGES = 32;
+
+    template <typename Item>
+    struct SlotPage {
+        std::pmr::vector<Item> entries;
+        MBRBlock boxes;
+
+        explicit SlotPage(std::pmr::memory_resource* resource) : entries(resource), boxes(resource) {}
+    };
+
+    template <typename Page, size_t... I>
+    static std::array<Page, PAGES> makePages(std::pmr::memory_resource* resource, std::index_sequence<I...>) {
+        return { { ((void)I, Page(resource))... } };
+    }
+
+    struct Location {
+        size_t page;
+        size_t offset;
+    };
+
+    size_t capacity;
+    size_t boxStride;
+    // Пустой вектор — страница ещё не выделена
+    std::array<std::pmr::vector<RTreeNode>, PAGES> nodePages;
+    std::array<SlotPage<NodeId>, PAGES> childPages;
+    std::array<SlotPage<Entry>, PAGES> entryPages;
+    std::array<std::pmr::vector<EntryHandle>, PAGES> handlePages;
+    size_t nodeCount = 0;
+    size_t innerSlotCount = 0;
+    size_t leafSlotCount = 0;
+    std::vector<NodeId> freeLeaves;
+    std::vector<NodeId> freeInners;
+    // Лист каждого дескриптора; NULL_NODE — дескриптор свободен
+    std::vector<NodeId> handleLeaves;
+    std::vector<EntryHandle> freeHandles;
+
+    static Location locate(size_t index) {
+        const size_t biased = index + (size_t(1) << FIRST_PAGE_BITS);
+        const size_t page = std::bit_width(biased) - 1 - FIRST_PAGE_BITS;
+        return { page, biased - pageSize(page) };
+    }
+
+    static size_t pageSize(size_t page) {
+        return size_t(1) << (page + FIRST_PAGE_BITS);
+    }
+
+    // Создаёт страницы, покрывающие индексы [0, count)
+    void ensureNodePages(size_t count) {
+        bool grown = false;
+        for (size_t page = 0; count > 0 && page <= locate(count - 1).page; ++page) {
+            if (!nodePages[page].empty()) continue;
+            nodePages[page].resize(pageSize(page));
+            grown = true;
+        }
+        if (!grown) return;
+        // Свободных узлов не больше, чем мест на страницах, поэтому release не выделяет память
+        size_t slots = 0;
+        for (size_t page = 0; page < PAGES && !nodePages[page].empty(); ++page) slots += pageSize(page);
+        freeLeaves.reserve(slots);
+        freeInners.reserve(slots);
+    }
+
+    template <typename Item>
+    void ensureSlotPages(std::array<SlotPage<Item>, PAGES>& pages, size_t count) {
+        for (size_t page = 0; count > 0 && page <= locate(count - 1).page; ++page) {
+            if (!pages[page].entries.empty()) continue;
+            pages[page].entries.resize(pageSize(page) * capacity);
+            pages[page].boxes.resize(pageSize(page) * boxStride);
+        }
+    }
+
+    NodeId* childSlot(const RTreeNode& node) {
+        const auto loc = locate(node.slot);
+        return childPages[loc.page].entries.data() + loc.offset * capacity;
+    }
+
+    Entry* entrySlot(const RTreeNode& node) {
+        const auto loc = locate(node.slot);
+        return entryPages[loc.page].entries.data() + loc.offset * capacity;
+    }
+
+    EntryHandle* handleSlot(const RTreeNode& node) {
+        const auto loc = locate(node.slot);
+        return handlePages[loc.page].data() + loc.offset * capacity;
+    }
+
+    void ensureLeafPages(size_t count) {
+        ensureSlotPages(entryPages, count);
+        for (size_t page = 0; count > 0 && page <= locate(count - 1).page; ++page) {
+            if (handlePages[page].empty()) handlePages[page].resize(pageSize(page) * capacity);
+        }
+    }
+
+public:
+    explicit RTreeNodePool(size_t capacity, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : capacity(capacity), boxStride((capacity + MBRBlock::WIDTH - 1) / MBRBlock::WIDTH * MBRBlock::WIDTH),
+          nodePages(makePages<std::pmr::vector<RTreeNode>>(resource, std::make_index_sequence<PAGES>())),
+          childPages(makePages<SlotPage<NodeId>>(resource, std::make_index_sequence<PAGES>())),
+          entryPages(makePages<SlotPage<Entry>>(resource, std::make_index_sequence<PAGES>())),
+          handlePages(makePages<std::pmr::vector<EntryHandle>>(resource, std::make_index_sequence<PAGES>())) {}
+
+    NodeId allocate(NodeKind kind) {
+        auto& freeList = kind == NodeKind::Leaf ? freeLeaves : freeInners;
+        if (!freeList.empty()) {
+            NodeId id = freeList.back();
+            freeList.pop_back();
+            (*this)[id].mbr = MBR();
+            (*this)[id].count = 0;
+            (*this)[id].parent = NULL_NODE;
+            return id;
+        }
+
+        const NodeId id = static_cast<NodeId>(nodeCount++);
+        ensureNodePages(nodeCount);
+        RTreeNode& node = (*this)[id];
+        node = RTreeNode();
+        node.kind = kind;
+        if (kind == NodeKind::Leaf) {
+            node.slot = static_cast<std::uint32_t>(leafSlotCount++);
+            ensureLeafPages(leafSlotCount);
+        } else {
+            node.slot = static_cast<std::uint32_t>(innerSlotCount++);
+            ensureSlotPages(childPages, innerSlotCount);
+        }
+        return id;
+    }
+
+    void reserve(size_t leaves, size_t inners) {
+        ensureNodePages(nodeCount + leaves + inners);
+        ensureLeafPages(leafSlotCount + leaves);
+        ensureSlotPages(childPages, innerSlotCount + inners);
+    }
+
+    // Как reserve, но leaves и inners — всего узлов, считая уже выделенные
+    void reserveTotal(size_t leaves, size_t inners) {
+        ensureNodePages(std::max(nodeCount, leaves + inners));
+        ensureLeafPages(std::max(leafSlotCount, leaves));
+        ensureSlotPages(childPages, std::max(innerSlotCount, inners));
+    }
+
+    void reserveHandles(size_t count) {
+        handleLeaves.reserve(count);
+        freeHandles.reserve(handleLeaves.capacity());
+    }
+
+    void release(NodeId id) {
+        auto& freeList = (*this)[id].isLeaf() ? freeLeaves : freeInners;
+        (*this)[id].count = 0;
+        freeList.push_back(id);
+    }
+
+    // Страницы остаются выделенными и используются заново
+    void clear() {
+        nodeCount = 0;
+        innerSlotCount = 0;
+        leafSlotCount = 0;
+        freeLeaves.clear();
+        freeInners.clear();
+        resetHandles(0);
+    }
+
+    // Новый дескриптор; лист назначает addEntry
+    EntryHandle allocateHandle() {
+        if (!freeHandles.empty()) {
+            const EntryHandle handle = freeHandles.back();
+            freeHandles.pop_back();
+            return handle;
+        }
+        handleLeaves.push_back(NULL_NODE);
+        // Как у свободных узлов: releaseHandle не должен выделять память
+        freeHandles.reserve(handleLeaves.capacity());
+        return { static_cast<std::uint32_t>(handleLeaves.size() - 1) };
+    }
+
+    // Освобождает все дескрипторы и резервирует [0, count) под записи, которые добавит вызывающий
+    void resetHandles(size_t count) {
+        handleLeaves.assign(count, NULL_NODE);
+        freeHandles.clear();
+        freeHandles.reserve(handleLeaves.capacity());
+    }
+
+    // Лист записи с дескриптором handle или NULL_NODE, если дескриптор не выдан
+    NodeId leafOf(EntryHandle handle) const {
+        return handle.index < handleLeaves.size() ? handleLeaves[handle.index] : NULL_NODE;
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    // Байты выделенных страниц и списков свободных узлов
+    size_t memoryUsage() const {
+        size_t bytes = (freeLeaves.capacity() + freeInners.capacity() + handleLeaves.capacity()) * sizeof(NodeId) +
+                       freeHandles.capacity() * sizeof(EntryHandle);
+        for (size_t page = 0; page < PAGES; ++page) {
+            bytes += nodePages[page].capacity() * sizeof(RTreeNode);
+            bytes += childPages[page].entries.capacity() * sizeof(NodeId) + childPages[page].boxes.size() * 6 * sizeof(float);
+            bytes += entryPages[page].entries.capacity() * sizeof(Entry) + entryPages[page].boxes.size() * 6 * sizeof(float);
+            bytes += handlePages[page].capacity() * sizeof(EntryHandle);
+        }
+        return bytes;
+    }
+
+    RTreeNode& operator[](NodeId id) {
+        const auto loc = locate(id);
+        return nodePages[loc.page][loc.offset];
+    }
+
+    const RTreeNode& operator[](NodeId id) const {
+        const auto loc = locate(id);
+        return nodePages[loc.page][loc.offset];
+    }
+
+    std::span<const NodeId> getChildren(NodeId id) const {
+        const auto& node = (*this)[id];
+        const auto loc = locate(node.slot);
+        return { childPages[loc.page].entries.data() + loc.offset * capacity, node.count };
+    }
+
+    std::span<const Entry> getEntries(NodeId id) const {
+        const auto& node = (*this)[id];
+        const auto loc = locate(node.slot);
+        return { entryPages[loc.page].entries.data() + loc.offset * capacity, node.count };
+    }
+
+    // Дескрипторы записей листа, в том же порядке, что getEntries
+    std::span<const EntryHandle> getHandles(NodeId id) const {
+        const auto& node = (*this)[id];
+        const auto loc = locate(node.slot);
+        return { handlePages[loc.page].data() + loc.offset * capacity, node.count };
+    }
+
+    const MBRBlock& getBoxes(NodeId id) const {
+        const auto& node = (*this)[id];
+        const auto page = locate(node.slot).page;
+        return node.isLeaf() ? entryPages[page].boxes : childPages[page].boxes;
+    }
+
+    size_t boxOffset(NodeId id) const {
+        return locate((*this)[id].slot).offset * boxStride;
+    }
+
+    MBRBlock& getBoxes(NodeId id) {
+        return const_cast<MBRBlock&>(std::as_const(*this).getBoxes(id));
+    }
+
+    // MBR записи i узла
+    MBR getBox(NodeId id, size_t i) const {
+        return getBoxes(id).get(boxOffset(id) + i);
+    }
+
+    // Битовая маска записей [first, first + 64) узла, чьи MBR пересекают query.
+    std::uint64_t intersectMask(NodeId id, size_t first, const MBR& query) const {
+        const size_t count = (*this)[id].count;
+        return getBoxes(id).intersectMask(boxOffset(id) + first, std::min<size_t>(64, count - first), query);
+    }
+
+    std::uint64_t rayMask(NodeId id, size_t first, const Point3D& origin, const Point3D& invDir,
+                          float tMax, float* tNear) const {
+        const size_t count = (*this)[id].count;
+        return getBoxes(id).rayMask(boxOffset(id) + first, std::min<size_t>(64, count - first),
+                                    origin, invDir, tMax, tNear);
+    }
+
+    void planeMasks(NodeId id, size_t first, const Plane& plane, std::uint64_t& outside, std::uint64_t& inside) const {
+        const size_t count = (*this)[id].count;
+        getBoxes(id).planeMasks(boxOffset(id) + first, std::min<size_t>(64, count - first), plane, outside, inside);
+    }
+
+    void addChild(NodeId id, NodeId child) {
+        auto& node = (*this)[id];
+        getBoxes(id).set(boxOffset(id) + node.count, (*this)[child].mbr);
+        childSlot(node)[node.count++] = child;
+        node.mbr.expandToInclude((*this)[child].mbr);
+        (*this)[child].parent = id;
+    }
+
+    void addEntry(NodeId id, const Entry& entry, const MBR& box, EntryHandle handle) {
+        auto& node = (*this)[id];
+        getBoxes(id).set(boxOffset(id) + node.count, box);
+        handleSlot(node)[node.count] = handle;
+        entrySlot(node)[node.count++] = entry;
+        node.mbr.expandToInclude(box);
+        handleLeaves[handle.index] = id;
+    }
+
+    // Заменяет запись index листа; MBR листа пересчитывает вызывающий
+    void setEntry(NodeId id, size_t index, const Entry& entry, const MBR& box) {
+        getBoxes(id).set(boxOffset(id) + index, box);
+        entrySlot((*this)[id])[index] = entry;
+    }
+
+    // Заменяет потомка from на to, сохраняя его позицию в слоте
+    void replaceChild(NodeId id, NodeId from, NodeId to) {
+        auto& node = (*this)[id];
+        NodeId* slot = childSlot(node);
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            if (slot[i] == from) {
+                slot[i] = to;
+                getBoxes(id).set(boxOffset(id) + i, (*this)[to].mbr);
+                (*this)[to].parent = id;
+                return;
+            }
+        }
+    }
+
+    // Новый узел того же вида с копией записей id
+    NodeId clone(NodeId id) {
+        const NodeId copy = allocate((*this)[id].kind);
+        const auto& source = (*this)[id];
+        auto& target = (*this)[copy];
+        if (source.isLeaf()) {
+            std::copy_n(entrySlot(source), source.count, entrySlot(target));
+            std::copy_n(handleSlot(source), source.count, handleSlot(target));
+            for (std::uint32_t i = 0; i < source.count; ++i) {
+                handleLeaves[handleSlot(target)[i].index] = copy;
+            }
+        } else {
+            std::copy_n(childSlot(source), source.count, childSlot(target));
+            for (std::uint32_t i = 0; i < source.count; ++i) {
+                (*this)[childSlot(target)[i]].parent = copy;
+            }
+        }
+        MBRBlock& fromBoxes = getBoxes(id);
+        MBRBlock& toBoxes = getBoxes(copy);
+        for (std::uint32_t i = 0; i < source.count; ++i) {
+            toBoxes.set(boxOffset(copy) + i, fromBoxes.get(boxOffset(id) + i));
+        }
+        target.mbr = source.mbr;
+        target.count = source.count;
+        return copy;
+    }
+
+    void removeChild(NodeId id, NodeId child) {
+        auto& node = (*this)[id];
+        NodeId* slot = childSlot(node);
+        MBRBlock& boxes = getBoxes(id);
+        const size_t firstBox = boxOffset(id);
+        std::uint32_t kept = 0;
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            if (slot[i] != child) {
+                slot[kept] = slot[i];
+                boxes.copy(firstBox + kept, firstBox + i);
+                ++kept;
+            }
+        }
+        node.count = kept;
+    }
+
+    void removeEntry(NodeId id, const Entry& entry) {
+        removeEntriesIf(id, [&entry](const Entry& e) {
+            return e == entry;
+        });
+    }
+
+    // Удаляет из листа все записи, для которых pred истинно, и освобождает их дескрипторы;
+    // MBR пересчитывается один раз
+    template <typename Pred>
+    void removeEntriesIf(NodeId id, Pred pred) {
+        auto& node = (*this)[id];
+        Entry* slot = entrySlot(node);
+        EntryHandle* handles = handleSlot(node);
+        MBRBlock& boxes = getBoxes(id);
+        const size_t firstBox = boxOffset(id);
+        std::uint32_t kept = 0;
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            if (!pred(slot[i])) {
+                slot[kept] = slot[i];
+                handles[kept] = handles[i];
+                boxes.copy(firstBox + kept, firstBox + i);
+                ++kept;
+            } else {
+                handleLeaves[handles[i].index] = NULL_NODE;
+                freeHandles.push_back(handles[i]);
+            }
+        }
+        node.count = kept;
+        recalculateMBR(id);
+    }
+
+    // Удаляет запись с дескриптором handle; сам дескриптор остаётся выданным, пока его
+    // не вернут releaseHandle или не назначат новой записи через addEntry
+    void removeHandle(NodeId id, EntryHandle handle) {
+        handleLeaves[handle.index] = NULL_NODE;
+        auto& node = (*this)[id];
+        Entry* slot = entrySlot(node);
+        EntryHandle* handles = handleSlot(node);
+        MBRBlock& boxes = getBoxes(id);
+        const size_t firstBox = boxOffset(id);
+        std::uint32_t kept = 0;
+        for (std::uint32_t i = 0; i < node.count; ++i) {
+            if (handles[i] != handle) {
+                slot[kept] = slot[i];
+                handles[kept] = handles[i];
+                boxes.copy(firstBox + kept, firstBox + i);
+                ++kept;
+            }
+        }
+        node.count = kept;
+        recalculateMBR(id);
+    }
+
+    void releaseHandle(EntryHandle handle) {
+        handleLeaves[handle.index] = NULL_NODE;
+        freeHandles.push_back(handle);
+    }
+
+    void clearEntries(NodeId id) {
+        (*this)[id].count = 0;
+        (*this)[id].mbr = MBR();
+    }
+
+    // Для внутреннего узла заодно обновляет сохранённые MBR потомков.
+    void recalculateMBR(NodeId id) {
+        auto& node = (*this)[id];
+        node.mbr = MBR();
+        MBRBlock& boxes = getBoxes(id);
+        const size_t firstBox = boxOffset(id);
+        if (node.isLeaf()) {
+            for (std::uint32_t i = 0; i < node.count; ++i) {
+                node.mbr.expandToInclude(boxes.get(firstBox + i));
+            }
+        } else {
+            const auto children = getChildren(id);
+            for (size_t i = 0; i < children.size(); ++i) {
+                boxes.set(firstBox + i, (*this)[children[i]].mbr);
+                node.mbr.expandToInclude((*this)[children[i]].mbr);
+            }
+        }
+    }
+};
+
+#endif //RTREENODEPOOL_H
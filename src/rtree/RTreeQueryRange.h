@@ -0,0 +1,153 @@
+#ifndef RTREEQUERYRANGE_H
+#define RTREEQUERYRANGE_H
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+#include "Epoch.h"
+#include "MBR.h"
+#include "RTreeNodePool.h"
+
+// Ленивый обход записей листьев, чьи MBR пересекают запрос. Первые INLINE_DEPTH уровней стека
+// обхода хранятся внутри итератора, поэтому итерация не выделяет память; более глубокие
+// уровни вырожденного дерева уходят в кучу.
+template <typename Entry>
+class RTreeQueryIterator {
+public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Entry*;
+    using reference = const Entry&;
+
+    static constexpr size_t INLINE_DEPTH = 64;
+
+    RTreeQueryIterator() = default;
+
+    RTreeQueryIterator(const RTreeNodePool<Entry>& pool, NodeId root, const MBR& query)
+        : pool(&pool), query(query) {
+        push(root);
+        advance();
+    }
+
+    reference operator*() const {
+        return pool->getEntries(frame(depth - 1).node)[current];
+    }
+
+    pointer operator->() const {
+        return &**this;
+    }
+
+    RTreeQueryIterator& operator++() {
+        advance();
+        return *this;
+    }
+
+    RTreeQueryIterator operator++(int) {
+        RTreeQueryIterator copy = *this;
+        advance();
+        return copy;
+    }
+
+    bool operator==(std::default_sentinel_t) const {
+        return depth == 0;
+    }
+
+    bool operator==(const RTreeQueryIterator& other) const {
+        if (depth != other.depth) return false;
+        if (depth == 0) return true;
+        const auto& top = frame(depth - 1);
+        const auto& otherTop = other.frame(depth - 1);
+        return pool == other.pool && top.node == otherTop.node && top.chunk == otherTop.chunk &&
+               top.hits == otherTop.hits && current == other.current;
+    }
+
+private:
+    struct Frame {
+        NodeId node;
+        std::uint32_t chunk;
+        std::uint64_t hits;
+    };
+
+    const RTreeNodePool<Entry>* pool = nullptr;
+    MBR query;
+    std::array<Frame, INLINE_DEPTH> stack{};
+    std::vector<Frame> deeper;
+    size_t depth = 0;
+    size_t current = 0;
+
+    Frame& frame(size_t level) {
+        return level < INLINE_DEPTH ? stack[level] : deeper[level - INLINE_DEPTH];
+    }
+
+    const Frame& frame(size_t level) const {
+        return level < INLINE_DEPTH ? stack[level] : deeper[level - INLINE_DEPTH];
+    }
+
+    void push(NodeId node) {
+        const Frame top{ node, 0, pool->intersectMask(node, 0, query) };
+        if (depth >= INLINE_DEPTH && deeper.size() <= depth - INLINE_DEPTH) {
+            deeper.push_back(top);
+        } else {
+            frame(depth) = top;
+        }
+        ++depth;
+    }
+
+    // Переходит к следующему попаданию; при исчерпании обхода depth == 0
+    void advance() {
+        while (depth > 0) {
+            auto& top = frame(depth - 1);
+            if (top.hits == 0) {
+                top.chunk += 64;
+                if (top.chunk >= (*pool)[top.node].count) {
+                    --depth;
+                    continue;
+                }
+                top.hits = pool->intersectMask(top.node, top.chunk, query);
+                continue;
+            }
+
+            const size_t i = top.chunk + std::countr_zero(top.hits);
+            top.hits &= top.hits - 1;
+            if ((*pool)[top.node].isLeaf()) {
+                current = i;
+                return;
+            }
+            // push может расширить deeper, поэтому top после него не используется
+            push(pool->getChildren(top.node)[i]);
+        }
+    }
+};
+
+// Диапазон удерживает эпоху, в которой был получен корень, поэтому
+// при конкурентной записи обходит неизменный снимок дерева.
+template <typename Entry>
+class RTreeQueryRange : public std::ranges::view_interface<RTreeQueryRange<Entry>> {
+    const RTreeNodePool<Entry>* pool = nullptr;
+    NodeId root = NULL_NODE;
+    MBR query;
+    EpochManager::Guard guard;
+
+public:
+    RTreeQueryRange() = default;
+
+    RTreeQueryRange(const RTreeNodePool<Entry>& pool, NodeId root, const MBR& query, EpochManager::Guard guard = {})
+        : pool(&pool), root(root), query(query), guard(std::move(guard)) {}
+
+    RTreeQueryIterator<Entry> begin() const {
+        return pool ? RTreeQueryIterator<Entry>(*pool, root, query) : RTreeQueryIterator<Entry>();
+    }
+
+    std::default_sentinel_t end() const {
+        return std::default_sentinel;
+    }
+};
+
+#endif //RTREEQUERYRANGE_H
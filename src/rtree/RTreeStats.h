@@ -0,0 +1,138 @@
+#ifndef RTREESTATS_H
+#define RTREESTATS_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Счётчики обходов дерева. Включаются определением RTREE_STATS (опция CMake RTREE_STATS);
+// без него countQuery ничего не делает, QueryCounters пуст, и обходы компилируются как раньше.
+struct QueryStats {
+    std::uint64_t queries = 0;
+    std::uint64_t nodesVisited = 0;
+    std::uint64_t boxTests = 0;        // проверки MBR: потомков внутренних узлов и записей листьев
+    std::uint64_t triangleTests = 0;   // проверки по геометрии треугольника: луч, расстояние для kNN
+    std::uint64_t hits = 0;
+    std::uint64_t falsePositives = 0;  // листья, в которые спустился обход, но не взял из них ни одного результата
+
+    QueryStats& operator+=(const QueryStats& other) {
+        queries += other.queries;
+        nodesVisited += other.nodesVisited;
+        boxTests += other.boxTests;
+        triangleTests += other.triangleTests;
+        hits += other.hits;
+        falsePositives += other.falsePositives;
+        return *this;
+    }
+};
+
+#ifdef RTREE_STATS
+inline constexpr bool QUERY_STATS_ENABLED = true;
+#else
+inline constexpr bool QUERY_STATS_ENABLED = false;
+#endif
+
+// Обход копит счётчики в переменной своего потока, без атомарных операций;
+// QueryStatsScope переносит насчитанное в дерево по окончании запроса
+inline thread_local QueryStats threadQueryStats;
+
+inline void countQuery(std::uint64_t QueryStats::* counter, std::uint64_t n = 1) {
+    if constexpr (QUERY_STATS_ENABLED) {
+        threadQueryStats.*counter += n;
+    }
+}
+
+// Счётчики дерева; запросы из разных потоков добавляют в них атомарно
+class QueryCounters {
+#ifdef RTREE_STATS
+    std::atomic<std::uint64_t> queries{ 0 };
+    std::atomic<std::uint64_t> nodesVisited{ 0 };
+    std::atomic<std::uint64_t> boxTests{ 0 };
+    std::atomic<std::uint64_t> triangleTests{ 0 };
+    std::atomic<std::uint64_t> hits{ 0 };
+    std::atomic<std::uint64_t> falsePositives{ 0 };
+#endif
+
+public:
+    void add([[maybe_unused]] const QueryStats& stats) {
+#ifdef RTREE_STATS
+        queries.fetch_add(stats.queries, std::memory_order_relaxed);
+        nodesVisited.fetch_add(stats.nodesVisited, std::memory_order_relaxed);
+        boxTests.fetch_add(stats.boxTests, std::memory_order_relaxed);
+        triangleTests.fetch_add(stats.triangleTests, std::memory_order_relaxed);
+        hits.fetch_add(stats.hits, std::memory_order_relaxed);
+        falsePositives.fetch_add(stats.falsePositives, std::memory_order_relaxed);
+#endif
+    }
+
+    QueryStats load() const {
+        QueryStats stats;
+#ifdef RTREE_STATS
+        stats.queries = queries.load(std::memory_order_relaxed);
+        stats.nodesVisited = nodesVisited.load(std::memory_order_relaxed);
+        stats.boxTests = boxTests.load(std::memory_order_relaxed);
+        stats.triangleTests = triangleTests.load(std::memory_order_relaxed);
+        stats.hits = hits.load(std::memory_order_relaxed);
+        stats.falsePositives = falsePositives.load(std::memory_order_relaxed);
+#endif
+        return stats;
+    }
+
+    void reset() {
+#ifdef RTREE_STATS
+        for (auto* counter : { &queries, &nodesVisited, &boxTests, &triangleTests, &hits, &falsePositives }) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+#endif
+    }
+};
+
+// Всё, что поток насчитал за время жизни области, добавляется в counters.
+// Запросы, сделанные из visitor другого запроса, попадают и в его счётчики.
+class QueryStatsScope {
+#ifdef RTREE_STATS
+    QueryCounters& counters;
+    QueryStats start;
+
+public:
+    explicit QueryStatsScope(QueryCounters& counters) : counters(counters), start(threadQueryStats) {}
+
+    ~QueryStatsScope() {
+        const QueryStats& now = threadQueryStats;
+        counters.add({ now.queries - start.queries, now.nodesVisited - start.nodesVisited,
+                       now.boxTests - start.boxTests, now.triangleTests - start.triangleTests,
+                       now.hits - start.hits, now.falsePositives - start.falsePositives });
+    }
+#else
+public:
+    explicit QueryStatsScope(QueryCounters&) {}
+#endif
+
+    QueryStatsScope(const QueryStatsScope&) = delete;
+    QueryStatsScope& operator=(const QueryStatsScope&) = delete;
+};
+
+// Состояние одного уровня дерева (уровень 0 — листья)
+struct LevelStats {
+    size_t nodes = 0;
+    size_t entries = 0;
+    double fill = 0.0;            // entries / (nodes * maxChildren)
+    // Попарные пересечения узлов уровня с общим родителем: объём и площадь поверхности
+    // (у плоских данных объём всегда 0)
+    double overlapVolume = 0.0;
+    double overlapArea = 0.0;
+    // Мёртвое пространство: сумма по узлам max(0, мера узла - сумма мер его записей)
+    double deadVolume = 0.0;
+    double deadArea = 0.0;
+};
+
+struct TreeStats {
+    size_t height = 0;
+    size_t nodes = 0;
+    size_t entries = 0;
+    size_t memoryBytes = 0;          // страницы пула узлов и служебные буферы дерева
+    size_t retainedNodes = 0;        // узлы, снятые с дерева, но ещё видимые снимкам (snapshot)
+    std::vector<LevelStats> levels;  // levels[0] — листья, levels.back() — корень
+};
+
+#endif //RTREESTATS_H
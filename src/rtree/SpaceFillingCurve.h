@@ -0,0 +1,79 @@
+#ifndef SPACEFILLINGCURVE_H
+#define SPACEFILLINGCURVE_H
+#include <algorithm>
+#include <cstdint>
+
+#include "MBR.h"
+
+// Ключи кривых Мортона и Гильберта для точек, квантованных в сетку 2^21 по каждой оси.
+namespace curve {
+
+constexpr int BITS = 21;
+constexpr std::uint32_t GRID_MAX = (1u << BITS) - 1;
+
+inline std::uint32_t quantize(float value, float min, float max) {
+    if (!(max > min)) return 0;
+    float t = (value - min) / (max - min);
+    t = std::clamp(t, 0.0f, 1.0f);
+    return static_cast<std::uint32_t>(t * GRID_MAX);
+}
+
+inline std::uint64_t spreadBits(std::uint32_t v) {
+    std::uint64_t x = v & GRID_MAX;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+inline std::uint64_t morton(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    return spreadBits(x) << 2 | spreadBits(y) << 1 | spreadBits(z);
+}
+
+// J. Skilling, "Programming the Hilbert curve" (2004): координаты
+// переводятся в транспонированный индекс, который затем перемежается.
+inline std::uint64_t hilbert(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    std::uint32_t X[3] = { x, y, z };
+    const std::uint32_t top = 1u << (BITS - 1);
+
+    for (std::uint32_t q = top; q > 1; q >>= 1) {
+        const std::uint32_t p = q - 1;
+        for (int i = 0; i < 3; ++i) {
+            if (X[i] & q) {
+                X[0] ^= p;
+            } else {
+                const std::uint32_t t = (X[0] ^ X[i]) & p;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    X[1] ^= X[0];
+    X[2] ^= X[1];
+    std::uint32_t t = 0;
+    for (std::uint32_t q = top; q > 1; q >>= 1) {
+        if (X[2] & q) t ^= q - 1;
+    }
+    for (auto& v : X) v ^= t;
+
+    return morton(X[0], X[1], X[2]);
+}
+
+inline std::uint64_t morton(const Point3D& p, const MBR& bounds) {
+    return morton(quantize(p.x, bounds.min.x, bounds.max.x),
+                  quantize(p.y, bounds.min.y, bounds.max.y),
+                  quantize(p.z, bounds.min.z, bounds.max.z));
+}
+
+inline std::uint64_t hilbert(const Point3D& p, const MBR& bounds) {
+    return hilbert(quantize(p.x, bounds.min.x, bounds.max.x),
+                   quantize(p.y, bounds.min.y, bounds.max.y),
+                   quantize(p.z, bounds.min.z, bounds.max.z));
+}
+
+} // namespace curve
+
+#endif //SPACEFILLINGCURVE_H
@@ -0,0 +1,55 @@
+#ifndef TRIANGLESOURCE_H
+#define TRIANGLESOURCE_H
+#include <cstdint>
+#include <span>
+
+#include "../geometry/Point3D.h"
+#include "../geometry/Triangle3D.h"
+
+// Источник треугольников определяет, что хранится в листьях дерева (Entry) и как
+// по записи получить геометрию. Записи сравниваются через ==, по нему же работает удаление.
+
+// Листья хранят копии треугольников; поиск возвращает треугольники.
+struct InlineTriangles {
+    using Entry = Triangle3D;
+
+    const Triangle3D& triangle(const Triangle3D& entry) const {
+        return entry;
+    }
+
+    // Треугольники записей подряд в памяти; записи и есть треугольники, scratch не нужен
+    const Triangle3D* triangles(std::span<const Triangle3D> entries, Triangle3D*) const {
+        return entries.data();
+    }
+};
+
+// Листья хранят 32-битные номера треугольников внешнего индексированного буфера;
+// поиск возвращает номера, удаление идёт по номеру. Буферы принадлежат вызывающему
+// и должны жить дольше дерева. Вершины можно менять, но до следующего запроса или другого
+// обращения к дереву номера затронутых треугольников нужно передать в update или updateBatch:
+// дерево хранит MBR, посчитанные по прежним вершинам.
+struct IndexedMesh {
+    using Entry = std::uint32_t;
+
+    std::span<const Point3D> vertices;
+    std::span<const std::uint32_t> indices;   // по три индекса вершин на треугольник
+
+    size_t size() const {
+        return indices.size() / 3;
+    }
+
+    Triangle3D triangle(std::uint32_t id) const {
+        const std::uint32_t* corner = indices.data() + size_t(id) * 3;
+        return { vertices[corner[0]], vertices[corner[1]], vertices[corner[2]] };
+    }
+
+    // Собирает треугольники записей в scratch, рассчитанный на entries.size()
+    const Triangle3D* triangles(std::span<const std::uint32_t> entries, Triangle3D* scratch) const {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            scratch[i] = triangle(entries[i]);
+        }
+        return scratch;
+    }
+};
+
+#endif //TRIANGLESOURCE_H